@@ -4,6 +4,7 @@
     #define __ARDUINOSLIP_H__
 
     #include "slipproto.h"
+    #include "spscring.h"
     #include <Arduino.h>
     #include <FastCRC.h>
     #include <Stream.h>
@@ -13,11 +14,18 @@ namespace sproto {
     /**
      * @brief Arduino/Teensy specific SLIP + CRC protocol implementation.
      *
-     * @tparam S Stream class to use. Usually <Serial>, <Serial1>, <Serial2>, etc.
+     * Received bytes pass through an SpscRing. By default the protocol moves them from the
+     * stream itself whenever it reads. After @ref setAsyncReceive, some other context (an RX
+     * thread or a stream event callback) calls @ref receive instead, and the protocol only
+     * drains the ring.
+     *
+     * @tparam S            Stream class to use. Usually <Serial>, <Serial1>, <Serial2>, etc.
+     * @tparam RX_RING_SIZE receive ring capacity, a power of two
+     * @tparam F            framing bytes, e.g. SlipRfc1055
      */
-    template <class S>
-    class ArduinoSlipProtocol : public SlipProtocolBase<ArduinoSlipProtocol<S>> {
-        typedef SlipProtocolBase<ArduinoSlipProtocol<S>> base_t;
+    template <class S, size_t RX_RING_SIZE = 1024, class F = SlipDefaultFraming>
+    class ArduinoSlipProtocol : public SlipProtocolBase<ArduinoSlipProtocol<S, RX_RING_SIZE, F>, F> {
+        typedef SlipProtocolBase<ArduinoSlipProtocol<S, RX_RING_SIZE, F>, F> base_t;
         friend base_t;
 
      public:
@@ -36,7 +44,7 @@ namespace sproto {
          * @param timeout readBytesUntil timeout.
          */
         ArduinoSlipProtocol(S& stream, bool use_crc = true, unsigned long timeout = 990)
-            : base_t(use_crc), stream_(stream), timeout_(timeout) {
+            : base_t(use_crc), stream_(stream), timeout_(timeout), async_rx_(false) {
         }
 
         /** Start the output stream */
@@ -53,6 +61,44 @@ namespace sproto {
             stream_.end();
         }
 
+        /**
+         * @brief Move whatever the stream has received into the receive ring, straight into its
+         * free space. The ring's only producer: after @ref setAsyncReceive(true) call it from
+         * exactly one context, otherwise leave it to the protocol.
+         *
+         * @return bytes moved. Stops early when the ring is full.
+         */
+        size_t receive() {
+            size_t total = 0;
+            for (;;) {
+                size_t avail = stream_.available();
+                if (avail == 0)
+                    break;
+                uint8_t* dst;
+                size_t n = rx_.pushSpan(dst);
+                if (n == 0)
+                    break;
+                if (n > avail)
+                    n = avail;
+                n = stream_.readBytes(reinterpret_cast<char*>(dst), n);
+                rx_.pushCommit(n);
+                total += n;
+            }
+            return total;
+        }
+
+        /**
+         * @brief Whether another context calls @ref receive. Set before that context starts.
+         */
+        void setAsyncReceive(bool async) {
+            async_rx_ = async;
+        }
+
+        /** @brief The receive ring, e.g. to check how full it runs */
+        SpscRing<RX_RING_SIZE>& rxRing() {
+            return rx_;
+        }
+
      protected:
         /**
          * @copydoc SlipProtocolBase::writeBytes
@@ -68,14 +114,40 @@ namespace sproto {
          */
         error_t readBytesUntil_impl(uint8_t* buffer, const size_t size, const char terminator, size_t& nread) {
             const unsigned long startMillis = millis();
-            // Arduino specific implementation. Could have its own timeout.
-            // Kludg: Keep our timeout shorter.
-            // calls Serial.readBytesUntil(terminator, buffer, size) or similar.
-            nread = stream_.readBytesUntil(terminator, reinterpret_cast<char*>(buffer), size);
-            if (millis() - startMillis >= timeout_) {
-                return ERROR_TIMEOUT;
+            nread                           = 0;
+            for (;;) {
+                const uint8_t* src;
+                size_t n = fill(src);
+                if (n == 0) {
+                    if (millis() - startMillis >= timeout_)
+                        return ERROR_TIMEOUT;
+                    yield(); // let other threads and event handlers run instead of spinning
+                    continue;
+                }
+                const uint8_t* end = static_cast<const uint8_t*>(memchr(src, terminator, n));
+                size_t take        = end ? end - src : n;
+                if (take > size - nread) {
+                    take = size - nread;
+                    end  = nullptr;
+                }
+                memcpy(buffer + nread, src, take);
+                nread += take;
+                rx_.popCommit(end ? take + 1 : take); // the terminator is dropped
+                if (end)
+                    return NO_ERROR;
+                if (nread == size)
+                    return ERROR_BUFFER;
             }
-            return NO_ERROR;
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::readBytes
+         * @details CRTP implementation. A batch pop from the receive ring, never waits.
+         */
+        size_t readBytes_impl(uint8_t* buffer, size_t size) {
+            if (!async_rx_)
+                receive();
+            return rx_.pop(buffer, size);
         }
 
         /**
@@ -83,7 +155,19 @@ namespace sproto {
          * @details CRTP implementation.
          */
         bool hasBytes_impl() {
-            return stream_.available();
+            if (!async_rx_)
+                receive();
+            return !rx_.empty();
+        }
+
+        /** @brief Received bytes at the tail of the ring, fetching more from the stream if we may */
+        size_t fill(const uint8_t*& src) {
+            size_t n = rx_.popSpan(src);
+            if (n == 0 && !async_rx_) {
+                receive();
+                n = rx_.popSpan(src);
+            }
+            return n;
         }
 
         /**
@@ -100,7 +184,9 @@ namespace sproto {
          * @details implementation.
          */
         void clearInput_impl() {
-            Serial.clear();
+            if (!async_rx_)
+                Serial.clear();
+            rx_.clear();
         }
 
         /**
@@ -130,6 +216,8 @@ namespace sproto {
         S& stream_;             ///< Aruino stream to write to
         unsigned long timeout_; ///< Terminated read timeout in msec
         FastCRC16 crc_;
+        SpscRing<RX_RING_SIZE> rx_; ///< received bytes not yet read
+        bool async_rx_;             ///< another context fills rx_
     };
 
 }; // namespace
@@ -0,0 +1,251 @@
+#pragma once
+
+#ifndef __COBSPROTO_H__
+    #define __COBSPROTO_H__
+
+    #include "slipproto.h"
+
+/**
+ * @page cobsprot
+ * COBS framing
+ * ============
+ *
+ * Consistent Overhead Byte Stuffing can take the place of SLIP on a link. Frames carry the
+ * same payload and the same big endian KERMIT CRC, and end with the same kind of END byte;
+ * only the stuffing differs. See @ref slipprot for the frames themselves.
+ *
+ * The payload and CRC are cut at every zero byte into blocks of at most 254 non-zero bytes.
+ * Each block is sent as a code byte, one more than its length, followed by its bytes. The
+ * zero that ended the block is implied by any code below 0xFF. The frame ends with 0x00,
+ * which never appears anywhere else.
+ * @code
+ *	code (1-255), up to 254 non-zero bytes
+ *	...
+ *	0x00
+ * @endcode
+ * |block|...|end|
+ * |-----|---|---|
+ * |code bytes...|...|00|
+ *
+ * A frame of n bytes never grows by more than n / 254 + 1 bytes plus END, whatever the data,
+ * where SLIP can double it. Both directions of a link must use the same framing.
+ */
+
+namespace sproto {
+
+    class CobsEncoder;
+    class CobsDecoder;
+
+    /**
+     * @brief COBS framing for SlipProtocolBase, e.g. ArduinoSlipProtocol<S, 1024, CobsFraming>
+     */
+    struct CobsFraming {
+        static constexpr uint8_t END      = 0x00;
+        static constexpr size_t MAX_BLOCK = 254; ///< non-zero bytes per code byte
+
+        typedef CobsEncoder encoder_t; ///< writes a frame
+        typedef CobsDecoder decoder_t; ///< reads frames
+
+        /** @brief Longest frame for n payload bytes: CRC, a code byte per block and END */
+        static constexpr size_t maxFrameSize(size_t n) { return (n + 2) + (n + 2) / MAX_BLOCK + 1 + 1; }
+    };
+
+    /**
+     * @brief Writes the COBS frame of a gathered payload a piece at a time: stuffed payload and
+     * CRC, then END. Lets a frame of any size go out through a small scratch buffer.
+     *
+     * A code byte must go out before the block it counts, so each block is measured with memchr
+     * before it is copied. The CRC is added up while measuring, and is complete by the time the
+     * last block reaches the two CRC bytes.
+     */
+    class CobsEncoder {
+     public:
+        /**
+         * @param parts     payload pieces, sent back to back as one frame
+         * @param nparts    number of payload pieces
+         * @param use_crc   append the KERMIT CRC of the payload
+         */
+        CobsEncoder(const slice_t* parts, size_t nparts, bool use_crc)
+            : parts_(parts), nparts_(nparts), crc_(0), run_(0), last_(false), done_(false), use_crc_(use_crc) {
+            seek(scan_, 0);
+            copy_ = scan_;
+        }
+
+        /**
+         * @brief Encode as much of the rest of the frame as fits. Any room makes progress.
+         *
+         * @return number of bytes written to dst
+         */
+        size_t encode(uint8_t* dst, size_t size) {
+            uint8_t* out           = dst;
+            const uint8_t* out_end = dst + size;
+            while (out < out_end && !done_) {
+                if (run_ == 0) {
+                    if (last_) {
+                        *out++ = CobsFraming::END;
+                        done_  = true;
+                        break;
+                    }
+                    *out++ = measure();
+                } else {
+                    skipEmpty(copy_);
+                    size_t n = run_;
+                    if (n > static_cast<size_t>(copy_.end - copy_.p))
+                        n = copy_.end - copy_.p;
+                    if (n > static_cast<size_t>(out_end - out))
+                        n = out_end - out;
+                    ::memcpy(out, copy_.p, n);
+                    out += n;
+                    copy_.p += n;
+                    run_ -= n;
+                }
+                if (run_ == 0)
+                    copy_ = scan_; // past the zero that ended the block
+            }
+            return out - dst;
+        }
+
+        /** @brief The whole frame, END included, has been encoded */
+        bool done() const { return done_; }
+
+     protected:
+        /** @brief Position in the payload pieces, followed by the CRC as one more piece */
+        struct cursor_t {
+            size_t part;
+            const uint8_t* p;
+            const uint8_t* end;
+        };
+
+        void seek(cursor_t& c, size_t part) {
+            c.part = part;
+            if (part < nparts_) {
+                c.p   = parts_[part].data;
+                c.end = c.p + parts_[part].size;
+            } else if (part == nparts_) {
+                // the scan gets here first, with the whole payload in the CRC
+                crcbytes_[0] = static_cast<uint8_t>(crc_ >> 8);
+                crcbytes_[1] = static_cast<uint8_t>(crc_ & 0xff);
+                c.p          = crcbytes_;
+                c.end        = crcbytes_ + (use_crc_ ? 2 : 0);
+            } else {
+                c.p = c.end = nullptr;
+            }
+        }
+
+        void skipEmpty(cursor_t& c) {
+            while (c.p == c.end && c.part <= nparts_)
+                seek(c, c.part + 1);
+        }
+
+        /** @brief Find the next block and return its code byte. Sets run_ and last_. */
+        uint8_t measure() {
+            size_t len = 0;
+            bool zero  = false;
+            while (len < CobsFraming::MAX_BLOCK) {
+                skipEmpty(scan_);
+                if (scan_.part > nparts_)
+                    break;
+                size_t avail = scan_.end - scan_.p;
+                if (avail > CobsFraming::MAX_BLOCK - len)
+                    avail = CobsFraming::MAX_BLOCK - len;
+                // runs of zeros are common in binary data. Don't pay for a memchr call.
+                const uint8_t* z = *scan_.p == 0 ? scan_.p : static_cast<const uint8_t*>(::memchr(scan_.p, 0, avail));
+                size_t n         = z ? z - scan_.p : avail;
+                size_t used      = z ? n + 1 : n;
+                if (use_crc_ && scan_.part < nparts_) {
+                    uint16_t c16 = crc_;
+                    for (size_t i = 0; i < used; i++)
+                        c16 = CrcKermit<>::update(c16, scan_.p[i]);
+                    crc_ = c16;
+                }
+                scan_.p += used;
+                len += n;
+                if (z) {
+                    zero = true;
+                    break;
+                }
+            }
+            if (!zero) {
+                skipEmpty(scan_);
+                last_ = scan_.part > nparts_;
+            }
+            run_ = len;
+            return static_cast<uint8_t>(len == CobsFraming::MAX_BLOCK ? 0xFF : len + 1);
+        }
+
+        const slice_t* parts_;
+        size_t nparts_;
+        cursor_t scan_;       ///< first byte not yet measured
+        cursor_t copy_;       ///< first byte of the current block not yet copied
+        uint16_t crc_;        ///< running KERMIT CRC of the payload measured so far
+        uint8_t crcbytes_[2]; ///< CRC, big endian, once the payload is measured
+        size_t run_;          ///< bytes of the current block left to copy
+        bool last_;           ///< current block ends the data, END comes next
+        bool done_;
+        bool use_crc_;
+    };
+
+    /**
+     * @brief Resumable, non-blocking COBS decoder. See FrameDecoder for how to feed it.
+     *
+     * Blocks are moved with memchr and memmove. The only byte looked at on its own is the code
+     * byte in front of each block. The zero a code byte implies is held back until the next code
+     * byte, so the one implied at the end of the frame is dropped.
+     */
+    class CobsDecoder : public FrameDecoder<CobsDecoder> {
+        typedef FrameDecoder<CobsDecoder> base_t;
+        friend base_t;
+
+     public:
+        CobsDecoder(uint8_t* buffer, size_t size)
+            : base_t(buffer, size), run_(0), zero_(false) {}
+
+     protected:
+        void clearState_impl() {
+            run_  = 0;
+            zero_ = false;
+        }
+
+        error_t decodeRun_impl(const uint8_t* src, size_t size, size_t& nused) {
+            const uint8_t* p    = src;
+            const uint8_t* pend = src + size;
+            while (p < pend) {
+                if (run_ > 0) {
+                    size_t avail = pend - p;
+                    if (avail > run_)
+                        avail = run_;
+                    const uint8_t* z = static_cast<const uint8_t*>(::memchr(p, CobsFraming::END, avail));
+                    size_t n         = z ? z - p : avail;
+                    putRun(p, n);
+                    p += n;
+                    run_ -= n;
+                    if (!z)
+                        continue;
+                    misread_ = true; // END inside a block: frame cut short
+                    run_     = 0;
+                }
+                uint8_t code = *p++;
+                if (code == CobsFraming::END) {
+                    zero_ = false;
+                    error_t err;
+                    if (!finish(err))
+                        continue;
+                    nused = p - src;
+                    return err;
+                }
+                if (zero_)
+                    put(0);
+                run_  = code - 1;
+                zero_ = code != 0xFF;
+            }
+            nused = size;
+            return ERROR_INCOMPLETE;
+        }
+
+        size_t run_; ///< bytes left in the current block
+        bool zero_;  ///< a zero follows the current block, unless it ends the frame
+    };
+
+}; // namespace sproto
+
+#endif // #ifndef __COBSPROTO_H__
@@ -0,0 +1,72 @@
+#pragma once
+
+#ifndef __DEVICECMDS_H__
+    #define __DEVICECMDS_H__
+
+    #include <stddef.h>
+    #include <stdint.h>
+
+/**
+ * @page devicecmds
+ * SerialProtoWork device commands
+ * ===============================
+ *
+ * Command ids shared by the firmware and the Micro-Manager adapter.
+ * See @ref slipcommand for the frame layout.
+ *
+ * | id | command      | ! parameters                         | ? reply                            |
+ * |----|--------------|--------------------------------------|------------------------------------|
+ * |  1 | DIGITAL_OUT  | uint pattern                         | uint pattern                       |
+ * |  2 | SEQUENCE     | [uint pattern, uint duration_us] ... | uint steps                         |
+ * |  3 | SEQUENCE_RUN | uint repeats                         | bool running                       |
+ * |  4 | TRIGGERED    | uint pattern ...                     | uint steps                         |
+ * |  5 | TRIGGER_ARM  | bool armed                           | bool armed                         |
+ * |  6 | BULK_CHECK   |                                      | uint size, uint crc, bool complete |
+ *
+ * SEQUENCE replaces the stored sequence, up to SEQUENCE_MAX_STEPS steps in one frame. A step of 0 us sets
+ * its pattern and moves straight on, so a sequence can end on a pattern that is held. Any other
+ * step lasts at least SEQUENCE_MIN_STEP_US, or the whole sequence is NAK'd.
+ * SEQUENCE_RUN plays it from a timer interrupt `repeats` times, 0 stops, 0xFFFFFFFF plays
+ * until stopped. A DIGITAL_OUT write also stops it.
+ *
+ * TRIGGERED replaces the stored triggered sequence, up to SEQUENCE_MAX_STEPS patterns in one
+ * frame. While TRIGGER_ARM is set, each rising edge on the trigger input outputs the next
+ * pattern, wrapping after the last. Arming starts again from the first pattern. Arming stops
+ * a playing SEQUENCE, and SEQUENCE_RUN or a DIGITAL_OUT write disarms.
+ *
+ * From version 3 the device reads and answers only sequenced frames. Version 2 firmware may
+ * predate them and NAKs them, so the adapter needs version 3 or later.
+ *
+ * From version 5 any of these may be sent together in a batch frame.
+ *
+ * From version 6 the device takes bulk transfers (see @ref slipbulk) to these targets:
+ *
+ * | id | target     | takes                                          |
+ * |----|------------|------------------------------------------------|
+ * |  1 | BULK_CHECK | any blob. Keeps only its size and KERMIT CRC.  |
+ *
+ * The BULK_CHECK command reads back what the last transfer to BULK_CHECK left, to check a
+ * link end to end and measure its rate.
+ */
+
+namespace sproto {
+
+    constexpr uint32_t DEVICE_VERSION = 6; ///< returned by `q`. Checked by the adapter.
+    constexpr const char* DEVICE_DESCRIPTION = "SerialProtoWork";
+
+    constexpr uint32_t CMD_DIGITAL_OUT  = 1; ///< 6-bit output pattern on pins 8-13
+    constexpr uint32_t CMD_SEQUENCE     = 2; ///< timed DIGITAL_OUT patterns
+    constexpr uint32_t CMD_SEQUENCE_RUN = 3; ///< play or stop the SEQUENCE
+    constexpr uint32_t CMD_TRIGGERED    = 4; ///< DIGITAL_OUT patterns stepped by the trigger input
+    constexpr uint32_t CMD_TRIGGER_ARM  = 5; ///< follow or ignore the trigger input
+    constexpr uint32_t CMD_BULK_CHECK   = 6; ///< size and CRC that reached BULK_CHECK
+
+    constexpr uint32_t BULK_CHECK = 1; ///< bulk target that only checks what it gets
+
+    constexpr uint32_t SEQUENCE_MAX_STEPS   = 256; ///< capacity of SEQUENCE and TRIGGERED
+    constexpr uint32_t SEQUENCE_MIN_STEP_US = 10;  ///< shortest timed SEQUENCE step
+    constexpr size_t DEVICE_REPLY_SIZE      = 512; ///< reply payload room, bounds a batch ACK
+
+}; // namespace
+
+#endif // #ifndef __DEVICECMDS_H__
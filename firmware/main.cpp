@@ -2,69 +2,234 @@
 // This supports most of C++14
 
 #include "Arduino.h"
+#include "TimerOne.h"
 #include "arduinoslip.h"
+#include "devicecmds.h"
+#include "sequenceplayer.h"
+#include "slipbulk.h"
+#include "slipcommand.h"
 #include "slipproto.h"
+#include "slipthreads.h"
 #include <deque>
+#ifdef SLIP_BENCHMARK
+    #include "slipbench.h"
+#endif
 
 using namespace sproto;
 ArduinoSlipProtocol<usb_serial_class> SlipSerial(Serial);
 
-void setup() {
-    SlipSerial.begin();
-    Serial.println("========== RESET ==========");
+#ifdef SLIP_BENCHMARK
+const size_t bench_size = 1024;
+uint8_t bench_payload[bench_size];
+uint8_t bench_work[3 * bench_size + 8];
+
+void runSlipBenchmark() {
+    bench_result_t results[16];
+    size_t n = benchSlip(results, bench_payload, bench_size, bench_work, 64);
+    for (size_t i = 0; i < n; i++) {
+        Serial.printf("%-24s %8.3f bytes/cycle\n", results[i].name, results[i].bytesPerCycle());
+    }
+    n = benchFraming(results, bench_payload, bench_size, bench_work, 64);
+    for (size_t i = 0; i < n; i++) {
+        Serial.printf("%-24s %8.3f bytes/cycle %6u bytes\n", results[i].name, results[i].bytesPerCycle(), results[i].wire);
+    }
 }
+#endif
 
-const size_t rxbuffer_size = 128;
-char rxbuffer[rxbuffer_size];
+const uint8_t digital_pins[]{8, 9, 10, 11, 12, 13};
+volatile uint32_t digital_pattern = 0;
 
-int outrep = 0;
+void writeDigitalOut(uint32_t pattern) {
+    digital_pattern = pattern & 0x3f;
+    for (size_t i = 0; i < sizeof(digital_pins); i++) {
+        digitalWriteFast(digital_pins[i], (pattern >> i) & 1);
+    }
+}
 
-void loop() {
-    if (outrep++ < 5) {
-        String out1 = "Lorus Ipsum";
-        String out2 = "Favius## Rex\\ \\\\#\\##Aeturnum padre##";
-        Serial.print("   >>");
-        SlipSerial.crcKermitReset();
-        uint16_t crc = SlipSerial.crcKermitCalc(out1.c_str(), out1.length());
-        SlipSerial.writeSlipEscaped(out1.c_str(), out1.length());
-        SlipSerial.writeSlipEnd(crc);
-        Serial.println();
-        Serial.print("   >>");
-        SlipSerial.crcKermitReset();
-        crc = SlipSerial.crcKermitCalc(out2.c_str(), out2.length());
-        SlipSerial.writeSlipEscaped(out2.c_str(), out2.length());
-        SlipSerial.writeSlipEnd(crc);
-        Serial.println();
+// Timer1 is FlexPWM1 submodule 3 on Teensy 4. A new period is double buffered and takes
+// effect at the next reload, as SequencePlayer expects.
+struct TimerOneClock {
+    static constexpr uint32_t MIN_PERIOD_US = SEQUENCE_MIN_STEP_US; // leaves time for the interrupt
+    static constexpr uint32_t MAX_PERIOD_US = 50000;                // setPeriod() tops out near 55.9 ms
+    static void start(uint32_t period_us) {
+        Timer1.setPeriod(period_us);
+        Timer1.start();
     }
-    // Serial.println("Waiting for input");
-    // delay(500);
-    size_t bytes_read = 0;
-    error_t err       = SlipSerial.readSlipEscaped(rxbuffer, rxbuffer_size, bytes_read);
-    if (err != NO_ERROR) {
-        if (err == ERROR_TIMEOUT) {
-            Serial.print("!!timeout ");
-        } else {
-            Serial.print("!!error ");
-            Serial.print(err);
-        }
-        if (bytes_read > 0) {
-            Serial.print("<<[");
-            Serial.print(bytes_read);
-            Serial.print("]");
-            rxbuffer[bytes_read] = '\0';
-            Serial.print(rxbuffer);
-        }
-        Serial.println();
-        SlipSerial.clearInput();
-    } else if (bytes_read > 0) {
-        Serial.print("<<[");
-        Serial.print(bytes_read);
-        Serial.print("]");
-        rxbuffer[bytes_read] = '\0';
-        Serial.println(rxbuffer);
-    } else {
-        // Serial.println("==no input==");
-        // SlipSerial.clearInput();
+    static void setNextPeriod(uint32_t period_us) { Timer1.setPeriod(period_us); }
+    static void stop() { Timer1.stop(); }
+};
+
+DigitalOutputs<TimerOneClock, SEQUENCE_MAX_STEPS> outputs(writeDigitalOut);
+
+void sequenceTick() {
+    outputs.sequence().tick();
+}
+
+const uint8_t trigger_pin = 2; // rising edge steps the triggered sequence
+
+void triggerEdge() {
+    outputs.triggered().trigger();
+}
+
+error_t setDigitalOut(CborValue& params, CborEncoder&) {
+    uint32_t pattern;
+    error_t err = cborReadArgs(params, pattern);
+    if (err != NO_ERROR)
+        return err;
+    outputs.write(pattern); // a direct write overrides either sequence
+    return NO_ERROR;
+}
+
+error_t getDigitalOut(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_uint(&reply, digital_pattern));
+}
+
+error_t setSequence(CborValue& params, CborEncoder&) {
+    return outputs.sequence().load(params);
+}
+
+error_t getSequence(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_uint(&reply, outputs.sequence().size()));
+}
+
+error_t setSequenceRun(CborValue& params, CborEncoder&) {
+    uint32_t repeats;
+    error_t err = cborReadArgs(params, repeats);
+    if (err != NO_ERROR)
+        return err;
+    return outputs.run(repeats);
+}
+
+error_t getSequenceRun(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_boolean(&reply, outputs.sequence().running()));
+}
+
+error_t setTriggered(CborValue& params, CborEncoder&) {
+    return outputs.triggered().load(params);
+}
+
+error_t getTriggered(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_uint(&reply, outputs.triggered().size()));
+}
+
+error_t setTriggerArm(CborValue& params, CborEncoder&) {
+    bool arm;
+    error_t err = cborReadArgs(params, arm);
+    if (err != NO_ERROR)
+        return err;
+    return outputs.arm(arm);
+}
+
+error_t getTriggerArm(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_boolean(&reply, outputs.triggered().armed()));
+}
+
+// BULK_CHECK keeps only the size and CRC of a transfer, for the host to read back
+struct bulk_check_t {
+    uint32_t size;
+    uint16_t crc;
+    bool complete;
+};
+bulk_check_t bulk_check{0, 0, false};
+
+error_t bulkCheckOpen(uint32_t) {
+    bulk_check = bulk_check_t{0, 0, false};
+    return NO_ERROR;
+}
+
+error_t bulkCheckWrite(uint32_t, const uint8_t* data, size_t size) {
+    uint16_t crc = bulk_check.crc;
+    for (size_t i = 0; i < size; i++)
+        crc = CrcKermit<>::update(crc, data[i]);
+    bulk_check.crc = crc;
+    bulk_check.size += size;
+    return NO_ERROR;
+}
+
+void bulkCheckClose(bool complete) {
+    bulk_check.complete = complete;
+}
+
+error_t getBulkCheck(CborValue&, CborEncoder& reply) {
+    error_t err = cborCheck(cbor_encode_uint(&reply, bulk_check.size));
+    if (err == NO_ERROR)
+        err = cborCheck(cbor_encode_uint(&reply, bulk_check.crc));
+    if (err == NO_ERROR)
+        err = cborCheck(cbor_encode_boolean(&reply, bulk_check.complete));
+    return err;
+}
+
+constexpr command_t commands[]{
+    {CMD_DIGITAL_OUT, setDigitalOut, getDigitalOut},
+    {CMD_SEQUENCE, setSequence, getSequence},
+    {CMD_SEQUENCE_RUN, setSequenceRun, getSequenceRun},
+    {CMD_TRIGGERED, setTriggered, getTriggered},
+    {CMD_TRIGGER_ARM, setTriggerArm, getTriggerArm},
+    {CMD_BULK_CHECK, nullptr, getBulkCheck},
+};
+static_assert(commandsSorted(commands), "command table must be sorted by id");
+
+const size_t frame_size = 4096;              // a full CMD_SEQUENCE upload arrives in one frame
+const size_t reply_size = DEVICE_REPLY_SIZE; // status of every command in a batch
+const size_t queue_depth = 4;
+const size_t retain_depth = 8;               // the adapter's widest window
+ThreadedCommandServer<ArduinoSlipProtocol<usb_serial_class>, TeensyThreadShim, frame_size, reply_size, queue_depth, retain_depth>
+    server(SlipSerial, commands, DEVICE_VERSION, DEVICE_DESCRIPTION);
+
+const bulk_sink_t bulk_sinks[]{
+    {BULK_CHECK, bulkCheckOpen, bulkCheckWrite, bulkCheckClose},
+};
+// no more chunks in flight than the server can queue
+BulkReceiver bulk(bulk_sinks, bulkMaxChunk(frame_size), queue_depth);
+
+// handlers and CBOR encoding run on the dispatch thread, so it gets the deepest stack.
+// The server threads sleep while idle and preempt loop() as soon as they have work.
+const thread_config_t rx_thread{1024, 5, 1};
+const thread_config_t dispatch_thread{4096, 10, 1};
+const thread_config_t tx_thread{1024, 5, 1};
+
+// The USB interrupt is chained so data for the RX thread wakes it at once, instead of RX
+// polling the port while idle.
+void (*usb_isr_chained)();
+
+void usbIsr() {
+    usb_isr_chained();
+    if (usb_serial_available())
+        server.notifyRx();
+}
+
+// same number the Teensy 4 core reports as the USB serial number, see usb_init_serialnumber()
+uint32_t usbSerialNumber() {
+    uint32_t num = HW_OCOTP_MAC0 & 0xFFFFFF;
+    if (num < 10000000)
+        num = num * 10;
+    return num;
+}
+
+void setup() {
+    SlipSerial.begin();
+    server.setSerialNumber(usbSerialNumber());
+    server.setFrameHandler(PROTO_BULK, BulkReceiver::handleFrame, &bulk);
+    for (size_t i = 0; i < sizeof(digital_pins); i++) {
+        pinMode(digital_pins[i], OUTPUT);
     }
-    // delay(1000);
+    Timer1.initialize();
+    Timer1.stop();
+    Timer1.attachInterrupt(sequenceTick);
+    pinMode(trigger_pin, INPUT);
+    attachInterrupt(digitalPinToInterrupt(trigger_pin), triggerEdge, RISING);
+    Serial.println("========== RESET ==========");
+    SlipSerial.writeSlipEnd(); // the host drops the banner as a bad frame
+#ifdef SLIP_BENCHMARK
+    runSlipBenchmark();
+#endif
+    usb_isr_chained            = _VectorsRam[IRQ_USB1 + 16];
+    _VectorsRam[IRQ_USB1 + 16] = usbIsr;
+    server.start(rx_thread, dispatch_thread, tx_thread);
+}
+
+void loop() {
+    // The server threads do the work. Sleep until an interrupt: the scheduler is tickless,
+    // so with every thread waiting nothing disturbs the TimerOne outputs.
+    asm volatile("wfi");
 }
@@ -0,0 +1,339 @@
+#pragma once
+
+#ifndef __POSIXSLIP_H__
+    #define __POSIXSLIP_H__
+
+    #include "slipproto.h"
+    #include <FastCRC.h>
+    #include <cerrno>
+    #include <cstdlib>
+    #include <cstring>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <termios.h>
+    #include <time.h>
+    #include <unistd.h>
+
+namespace sproto {
+
+    /**
+     * @brief Linux/POSIX host SLIP + CRC protocol implementation.
+     *
+     * Drives a raw tty or pseudo-terminal file descriptor with poll(), read() and write().
+     * Lets the PC side of the link share the exact framing code used by the firmware, and
+     * lets us exercise the protocol against a pty pair with no board attached.
+     *
+     * **Implementation notes**: Unlike the Arduino Stream, a raw fd has no readBytesUntil.
+     * We read whatever the kernel has into a small receive buffer and hand bytes out up to
+     * the terminator. Bytes following the terminator stay in the receive buffer for the next
+     * call, so nothing read from the fd is ever lost. All timeouts are in microseconds and are
+     * measured against CLOCK_MONOTONIC.
+     *
+     * @tparam F framing bytes, e.g. SlipRfc1055
+     */
+    template <class F = SlipDefaultFraming>
+    class BasicPosixSlipProtocol : public SlipProtocolBase<BasicPosixSlipProtocol<F>, F> {
+        typedef SlipProtocolBase<BasicPosixSlipProtocol<F>, F> base_t;
+        friend base_t;
+
+     public:
+        static constexpr size_t RX_BUFFER_SIZE = 256;
+
+        /**
+         * @brief Construct a new Posix Slip Protocol object.
+         *
+         * @param fd            already open file descriptor, or -1 to @ref open one later
+         * @param use_crc       append and check CRC16 on frames
+         * @param timeout_us    readBytesUntil and write timeout in microseconds
+         */
+        BasicPosixSlipProtocol(int fd = -1, bool use_crc = true, unsigned long timeout_us = 990000UL)
+            : base_t(use_crc), fd_(fd), owns_fd_(false), timeout_us_(timeout_us), rx_head_(0), rx_tail_(0) {
+        }
+
+        ~BasicPosixSlipProtocol() {
+            end();
+        }
+
+        /**
+         * @brief Open a tty device and put it in raw mode.
+         *
+         * @param path  device path, e.g. /dev/ttyACM0 or the slave side of a pty
+         * @param baud  termios baud constant. Ignored by USB CDC devices and ptys.
+         * @return true if the device was opened and configured
+         */
+        bool open(const char* path, speed_t baud = B115200) {
+            end();
+            int fd = ::open(path, O_RDWR | O_NOCTTY | O_NONBLOCK);
+            if (fd < 0)
+                return false;
+            if (!makeRaw(fd, baud)) {
+                ::close(fd);
+                return false;
+            }
+            fd_      = fd;
+            owns_fd_ = true;
+            return true;
+        }
+
+        /**
+         * @brief Attach to an already open file descriptor. The caller keeps ownership.
+         */
+        bool begin(int fd) {
+            end();
+            fd_ = fd;
+            if (fd_ < 0)
+                return false;
+            int flags = ::fcntl(fd_, F_GETFL);
+            return flags >= 0 && ::fcntl(fd_, F_SETFL, flags | O_NONBLOCK) == 0;
+        }
+
+        /** Stop the stream. Closes the descriptor if we opened it. */
+        void end() {
+            if (owns_fd_ && fd_ >= 0)
+                ::close(fd_);
+            fd_      = -1;
+            owns_fd_ = false;
+            rx_head_ = rx_tail_ = 0;
+        }
+
+        int fd() const { return fd_; }
+
+        unsigned long timeout() const { return timeout_us_; }
+        void setTimeout(unsigned long timeout_us) { timeout_us_ = timeout_us; }
+
+        /**
+         * @brief Put a tty descriptor into raw 8N1 mode with no flow control.
+         *
+         * @return true on success or if fd is not a tty (pipes, sockets)
+         */
+        static bool makeRaw(int fd, speed_t baud = B115200) {
+            if (!::isatty(fd))
+                return true;
+            struct termios tio;
+            if (::tcgetattr(fd, &tio) != 0)
+                return false;
+            ::cfmakeraw(&tio);
+            tio.c_cflag |= CLOCAL | CREAD;
+            tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+            tio.c_cc[VMIN]  = 0;
+            tio.c_cc[VTIME] = 0;
+            ::cfsetispeed(&tio, baud);
+            ::cfsetospeed(&tio, baud);
+            return ::tcsetattr(fd, TCSANOW, &tio) == 0;
+        }
+
+        /**
+         * @brief Open a connected pseudo-terminal pair in raw mode for loopback testing.
+         *
+         * @param[out] master   master side descriptor
+         * @param[out] slave    slave side descriptor
+         * @return true if both sides were opened
+         */
+        static bool openPtyPair(int& master, int& slave) {
+            master = ::posix_openpt(O_RDWR | O_NOCTTY);
+            if (master < 0)
+                return false;
+            const char* name = nullptr;
+            if (::grantpt(master) != 0 || ::unlockpt(master) != 0 || (name = ::ptsname(master)) == nullptr) {
+                ::close(master);
+                return false;
+            }
+            slave = ::open(name, O_RDWR | O_NOCTTY);
+            if (slave < 0 || !makeRaw(master) || !makeRaw(slave)) {
+                if (slave >= 0)
+                    ::close(slave);
+                ::close(master);
+                return false;
+            }
+            return true;
+        }
+
+     protected:
+        /** Monotonic clock in microseconds */
+        static unsigned long long nowMicros() {
+            struct timespec ts;
+            ::clock_gettime(CLOCK_MONOTONIC, &ts);
+            return static_cast<unsigned long long>(ts.tv_sec) * 1000000ULL + ts.tv_nsec / 1000;
+        }
+
+        /**
+         * @brief Wait for the descriptor to become readable or writable.
+         *
+         * @param events        POLLIN or POLLOUT
+         * @param deadline_us   absolute deadline from nowMicros()
+         * @return true if the event is ready before the deadline
+         */
+        bool waitFor(short events, unsigned long long deadline_us) {
+            struct pollfd pfd;
+            pfd.fd     = fd_;
+            pfd.events = events;
+            for (;;) {
+                unsigned long long now = nowMicros();
+                if (now >= deadline_us)
+                    return false;
+                // poll() only has millisecond resolution. Round up so we never spin.
+                int wait_ms = static_cast<int>((deadline_us - now + 999) / 1000);
+                int ret     = ::poll(&pfd, 1, wait_ms);
+                if (ret > 0)
+                    return (pfd.revents & (events | POLLHUP | POLLERR)) != 0;
+                if (ret < 0 && errno != EINTR)
+                    return false;
+            }
+        }
+
+        /** Refill the receive buffer with whatever the kernel has. Returns bytes added. */
+        size_t fillRx() {
+            if (rx_head_ == rx_tail_)
+                rx_head_ = rx_tail_ = 0;
+            if (rx_tail_ == RX_BUFFER_SIZE)
+                return 0;
+            ssize_t n = ::read(fd_, rx_buffer_ + rx_tail_, RX_BUFFER_SIZE - rx_tail_);
+            if (n <= 0)
+                return 0;
+            rx_tail_ += static_cast<size_t>(n);
+            return static_cast<size_t>(n);
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::writeBytes
+         * @details CRTP implementation.
+         */
+        size_t writeBytes_impl(const uint8_t* buffer, size_t size) {
+            size_t nwritten                = 0;
+            const unsigned long long until = nowMicros() + timeout_us_;
+            while (nwritten < size) {
+                ssize_t n = ::write(fd_, buffer + nwritten, size - nwritten);
+                if (n > 0) {
+                    nwritten += static_cast<size_t>(n);
+                } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+                    break;
+                } else if (!waitFor(POLLOUT, until)) {
+                    break;
+                }
+            }
+            return nwritten;
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::readBytesUntil
+         * @details CRTP implementation. Returns ERROR_STREAM once the other end has closed: the
+         * descriptor polls readable but has nothing to read.
+         */
+        error_t readBytesUntil_impl(uint8_t* buffer, const size_t size, const char terminator, size_t& nread) {
+            nread                          = 0;
+            const unsigned long long until = nowMicros() + timeout_us_;
+            for (;;) {
+                // hand out buffered bytes up to the terminator
+                const uint8_t* begin = rx_buffer_ + rx_head_;
+                size_t avail         = rx_tail_ - rx_head_;
+                const uint8_t* term  = static_cast<const uint8_t*>(::memchr(begin, terminator, avail));
+                size_t ncopy         = term ? static_cast<size_t>(term - begin) : avail;
+                if (ncopy > size - nread)
+                    ncopy = size - nread;
+                ::memcpy(buffer + nread, begin, ncopy);
+                nread += ncopy;
+                rx_head_ += ncopy;
+                if (term && begin + ncopy == term) {
+                    rx_head_++; // discard the terminator like Arduino Stream does
+                    return NO_ERROR;
+                }
+                if (nread == size)
+                    return ERROR_BUFFER;
+                if (fillRx() > 0)
+                    continue;
+                if (!waitFor(POLLIN, until))
+                    return ERROR_TIMEOUT;
+                if (fillRx() == 0)
+                    return ERROR_STREAM; // hung up
+            }
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::readBytes
+         * @details CRTP implementation.
+         */
+        size_t readBytes_impl(uint8_t* buffer, size_t size) {
+            size_t nread = rx_tail_ - rx_head_;
+            if (nread > size)
+                nread = size;
+            ::memcpy(buffer, rx_buffer_ + rx_head_, nread);
+            rx_head_ += nread;
+            if (nread < size) {
+                ssize_t n = ::read(fd_, buffer + nread, size - nread);
+                if (n > 0)
+                    nread += static_cast<size_t>(n);
+            }
+            return nread;
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::hasBytes
+         * @details CRTP implementation.
+         */
+        bool hasBytes_impl() {
+            if (rx_head_ != rx_tail_)
+                return true;
+            struct pollfd pfd;
+            pfd.fd     = fd_;
+            pfd.events = POLLIN;
+            return ::poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::writeNow
+         * @details CRTP implementation. Waits for the kernel to transmit queued output.
+         */
+        void writeNow_impl() {
+            if (::isatty(fd_))
+                ::tcdrain(fd_);
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::clearInput
+         * @details CRTP implementation.
+         */
+        void clearInput_impl() {
+            rx_head_ = rx_tail_ = 0;
+            if (::isatty(fd_))
+                ::tcflush(fd_, TCIFLUSH);
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::isStreamReady
+         * @details CRTP implementation.
+         */
+        bool isStreamReady_impl() {
+            return fd_ >= 0;
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::crcKermitReset
+         * @details CRTP implementation
+         */
+        void crcKermitReset_impl() {
+            crc_.kermit(NULL, 0);
+        }
+
+        /**
+         * @copydoc SlipProtocolBase::crcKermitCalc
+         * @details CRTP implementation
+         */
+        uint16_t crcKermitCalc_impl(const uint8_t* src, size_t size) {
+            return crc_.kermit_upd(src, size);
+        }
+
+        int fd_;                              ///< tty or pty file descriptor
+        bool owns_fd_;                        ///< close fd_ on end()
+        unsigned long timeout_us_;            ///< Terminated read and write timeout in usec
+        size_t rx_head_;                      ///< next unread byte in rx_buffer_
+        size_t rx_tail_;                      ///< one past last valid byte in rx_buffer_
+        uint8_t rx_buffer_[RX_BUFFER_SIZE]; ///< bytes read from fd_ but not yet consumed
+        FastCRC16 crc_;
+    };
+
+    /** @brief POSIX protocol with the default framing */
+    typedef BasicPosixSlipProtocol<> PosixSlipProtocol;
+
+}; // namespace
+
+#endif // #ifndef __POSIXSLIP_H__
@@ -0,0 +1,321 @@
+#pragma once
+
+#ifndef __SEQUENCEPLAYER_H__
+    #define __SEQUENCEPLAYER_H__
+
+    #include "slipcommand.h"
+
+namespace sproto {
+
+    /**
+     * @brief One step of an output sequence
+     */
+    struct sequence_step_t {
+        uint32_t state;       ///< output pattern
+        uint32_t duration_us; ///< how long the pattern is held. 0 sets it and moves on.
+    };
+
+    /**
+     * @brief Plays a sequence of output patterns from a timer interrupt, so step timing does
+     * not depend on the host or on the main loop.
+     *
+     * Every timer period is one segment. A step longer than the timer's longest period is split
+     * into several segments. The timer must be double buffered: a period set from the interrupt
+     * takes effect when the running period ends. The player therefore always programs the
+     * period of the segment after the one that has just begun.
+     *
+     * @tparam T            timer with static `start(period_us)`, `setNextPeriod(period_us)`,
+     *                      `stop()` and constants `MIN_PERIOD_US`, `MAX_PERIOD_US`
+     * @tparam MAX_STEPS    sequence capacity
+     */
+    template <class T, size_t MAX_STEPS = 256>
+    class SequencePlayer {
+     public:
+        typedef void (*output_fn)(uint32_t state);
+
+        static constexpr uint32_t REPEAT_FOREVER = 0xFFFFFFFF; ///< play until stopped
+
+        /**
+         * @param output    sets the outputs. Called from the timer interrupt.
+         */
+        explicit SequencePlayer(output_fn output)
+            : output_(output), size_(0), running_(false), pos_(0), left_us_(0), repeats_(0) {}
+
+        /**
+         * @brief Replace the sequence with the command parameters, each a `[state, duration_us]`
+         * array.
+         *
+         * @return
+         *  - NO_ERROR      sequence loaded
+         *  - ERROR_COMMAND sequence is playing, a step is malformed or shorter than the timer
+         *                  allows, there are more than MAX_STEPS, or no step takes any time
+         */
+        error_t load(CborValue& params) {
+            if (running_)
+                return ERROR_COMMAND;
+            size_         = 0;
+            size_t n      = 0;
+            uint64_t total = 0;
+            while (!cbor_value_at_end(&params)) {
+                CborValue pair;
+                if (n == MAX_STEPS || !cbor_value_is_array(&params) || cbor_value_enter_container(&params, &pair) != CborNoError)
+                    return ERROR_COMMAND;
+                sequence_step_t& step = steps_[n];
+                if (cborReadArgs(pair, step.state, step.duration_us) != NO_ERROR || !cbor_value_at_end(&pair) ||
+                    cbor_value_leave_container(&params, &pair) != CborNoError)
+                    return ERROR_COMMAND;
+                if (step.duration_us != 0 && step.duration_us < T::MIN_PERIOD_US)
+                    return ERROR_COMMAND;
+                total += step.duration_us;
+                n++;
+            }
+            if (n > 0 && total == 0)
+                return ERROR_COMMAND;
+            size_ = n;
+            return NO_ERROR;
+        }
+
+        /** @brief Number of steps loaded */
+        size_t size() const { return size_; }
+
+        bool running() const { return running_; }
+
+        /**
+         * @brief Play the sequence from the start. The first pattern is output before returning.
+         *
+         * @param repeats   times to play the sequence, REPEAT_FOREVER, or 0 to stop
+         * @return NO_ERROR, or ERROR_COMMAND if no sequence is loaded
+         */
+        error_t start(uint32_t repeats) {
+            stop();
+            if (repeats == 0)
+                return NO_ERROR;
+            if (size_ == 0)
+                return ERROR_COMMAND;
+            pos_     = 0;
+            left_us_ = 0;
+            repeats_ = repeats;
+            segment_t first;
+            nextSegment(first); // never the last, the sequence takes some time
+            if (first.output)
+                output_(first.state);
+            nextSegment(next_);
+            running_ = true;
+            T::start(first.period_us);
+            if (!next_.last)
+                T::setNextPeriod(next_.period_us);
+            return NO_ERROR;
+        }
+
+        /** @brief Stop playing. The outputs keep their current pattern. */
+        void stop() {
+            T::stop();
+            running_ = false;
+        }
+
+        /** @brief Call from the timer interrupt at the end of every period */
+        void tick() {
+            if (!running_)
+                return;
+            // next_ begins now, its period was loaded when the previous one ran out
+            if (next_.output)
+                output_(next_.state);
+            if (next_.last) {
+                stop();
+                return;
+            }
+            nextSegment(next_);
+            if (!next_.last)
+                T::setNextPeriod(next_.period_us);
+        }
+
+     protected:
+        struct segment_t {
+            uint32_t period_us; ///< timer period
+            uint32_t state;     ///< pattern to output when the segment begins
+            bool output;        ///< segment begins a step
+            bool last;          ///< sequence ends here, after output
+        };
+
+        void nextSegment(segment_t& seg) {
+            seg.period_us = 0;
+            seg.state     = 0;
+            seg.output    = false;
+            seg.last      = false;
+            // zero length steps are output back to back, only the last of them shows
+            while (left_us_ == 0) {
+                if (pos_ == size_) {
+                    if (repeats_ != REPEAT_FOREVER && --repeats_ == 0) {
+                        seg.last = true;
+                        return;
+                    }
+                    pos_ = 0;
+                }
+                seg.output = true;
+                seg.state  = steps_[pos_].state;
+                left_us_   = steps_[pos_].duration_us;
+                pos_++;
+            }
+            seg.period_us = left_us_ < T::MAX_PERIOD_US ? left_us_ : T::MAX_PERIOD_US;
+            left_us_ -= seg.period_us;
+            // never leave a remainder the timer cannot time
+            if (left_us_ != 0 && left_us_ < T::MIN_PERIOD_US) {
+                seg.period_us -= T::MIN_PERIOD_US;
+                left_us_ += T::MIN_PERIOD_US;
+            }
+        }
+
+        output_fn output_;
+        sequence_step_t steps_[MAX_STEPS];
+        size_t size_;
+        volatile bool running_;
+        size_t pos_;       ///< next step to begin
+        uint32_t left_us_; ///< time of the current step not yet given to a segment
+        uint32_t repeats_; ///< plays left, including the current one
+        segment_t next_;   ///< segment whose period is loaded next
+    };
+
+    /**
+     * @brief Steps through a list of output patterns, one per external trigger, so a camera
+     * or other instrument can advance the outputs without a host round trip per frame.
+     *
+     * Each @ref trigger outputs the next pattern, wrapping to the first after the last, for as
+     * long as the sequence is armed.
+     *
+     * @tparam MAX_STEPS    sequence capacity
+     */
+    template <size_t MAX_STEPS = 256>
+    class TriggeredSequence {
+     public:
+        typedef void (*output_fn)(uint32_t state);
+
+        /**
+         * @param output    sets the outputs. Called from the trigger interrupt.
+         */
+        explicit TriggeredSequence(output_fn output) : output_(output), size_(0), armed_(false), pos_(0) {}
+
+        /**
+         * @brief Replace the sequence with the command parameters, one uint pattern each.
+         *
+         * @return NO_ERROR, or ERROR_COMMAND if armed, a pattern is malformed or there are
+         * more than MAX_STEPS
+         */
+        error_t load(CborValue& params) {
+            if (armed_)
+                return ERROR_COMMAND;
+            size_    = 0;
+            size_t n = 0;
+            while (!cbor_value_at_end(&params)) {
+                if (n == MAX_STEPS || cborRead(params, states_[n]) != NO_ERROR)
+                    return ERROR_COMMAND;
+                n++;
+            }
+            size_ = n;
+            return NO_ERROR;
+        }
+
+        /** @brief Number of patterns loaded */
+        size_t size() const { return size_; }
+
+        bool armed() const { return armed_; }
+
+        /**
+         * @brief Follow triggers from the first pattern on. The outputs do not change until
+         * the first trigger.
+         *
+         * @return NO_ERROR, or ERROR_COMMAND if no sequence is loaded
+         */
+        error_t arm() {
+            if (size_ == 0)
+                return ERROR_COMMAND;
+            armed_ = false; // keep the interrupt out while pos_ resets
+            pos_   = 0;
+            armed_ = true;
+            return NO_ERROR;
+        }
+
+        /** @brief Ignore triggers. The outputs keep their current pattern. */
+        void disarm() { armed_ = false; }
+
+        /** @brief Call from the trigger input interrupt */
+        void trigger() {
+            if (!armed_)
+                return;
+            output_(states_[pos_]);
+            if (++pos_ == size_)
+                pos_ = 0;
+        }
+
+     protected:
+        output_fn output_;
+        uint32_t states_[MAX_STEPS];
+        size_t size_;
+        volatile bool armed_;
+        size_t pos_; ///< next pattern to output
+    };
+
+    /**
+     * @brief Encode the parameters of a TRIGGERED command, as TriggeredSequence::load reads them.
+     *
+     * @return encoded size, or 0 if buffer is too small
+     */
+    inline size_t encodeTriggered(uint8_t* buffer, size_t size, const uint32_t* states, size_t count) {
+        CborEncoder enc, array;
+        cbor_encoder_init(&enc, buffer, size, 0);
+        cbor_encoder_create_array(&enc, &array, count);
+        for (size_t i = 0; i < count; i++)
+            cbor_encode_uint(&array, states[i]);
+        if (cbor_encoder_close_container(&enc, &array) != CborNoError)
+            return 0;
+        return cbor_encoder_get_buffer_size(&enc, buffer);
+    }
+
+    /**
+     * @brief The digital outputs and what drives them: direct writes, a SequencePlayer and a
+     * TriggeredSequence. Whichever was asked last takes over from the others.
+     *
+     * @tparam T            timer of the SequencePlayer
+     * @tparam MAX_STEPS    capacity of both sequences
+     */
+    template <class T, size_t MAX_STEPS = 256>
+    class DigitalOutputs {
+     public:
+        typedef void (*output_fn)(uint32_t state);
+
+        explicit DigitalOutputs(output_fn output) : output_(output), sequence_(output), triggered_(output) {}
+
+        SequencePlayer<T, MAX_STEPS>& sequence() { return sequence_; }
+        TriggeredSequence<MAX_STEPS>& triggered() { return triggered_; }
+
+        /** @brief Output a pattern now. Stops the sequence and disarms the triggered one. */
+        void write(uint32_t state) {
+            sequence_.stop();
+            triggered_.disarm();
+            output_(state);
+        }
+
+        /** @brief Play the sequence, see SequencePlayer::start. Disarms the triggered one. */
+        error_t run(uint32_t repeats) {
+            triggered_.disarm();
+            return sequence_.start(repeats);
+        }
+
+        /** @brief Arm or disarm the triggered sequence. Arming stops the sequence. */
+        error_t arm(bool armed) {
+            if (!armed) {
+                triggered_.disarm();
+                return NO_ERROR;
+            }
+            sequence_.stop();
+            return triggered_.arm();
+        }
+
+     protected:
+        output_fn output_;
+        SequencePlayer<T, MAX_STEPS> sequence_;
+        TriggeredSequence<MAX_STEPS> triggered_;
+    };
+
+}; // namespace
+
+#endif // #ifndef __SEQUENCEPLAYER_H__
@@ -0,0 +1,246 @@
+#pragma once
+
+#ifndef __SLIPBENCH_H__
+    #define __SLIPBENCH_H__
+
+    #include "cobsproto.h"
+    #include "slipproto.h"
+    #if defined(__IMXRT1062__)
+        #include <Arduino.h> // ARM_DWT_CYCCNT
+    #elif defined(__x86_64__) || defined(__i386__)
+        #include <x86intrin.h>
+    #else
+        #include <chrono>
+    #endif
+
+namespace sproto {
+
+    /**
+     * @brief Free running cycle counter for benchmarks. DWT cycle counter on the Teensy 4,
+     * TSC on x86 hosts. Other hosts count nanoseconds instead of cycles.
+     */
+    inline uint32_t benchCycles() {
+    #if defined(__IMXRT1062__)
+        return ARM_DWT_CYCCNT;
+    #elif defined(__x86_64__) || defined(__i386__)
+        return static_cast<uint32_t>(__rdtsc());
+    #else
+        return static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now().time_since_epoch())
+                                         .count());
+    #endif
+    }
+
+    /** @brief Where the benchmarks store what they computed, so the optimizer cannot discard the work */
+    inline volatile size_t& benchSink() {
+        static volatile size_t sink;
+        return sink;
+    }
+
+    /**
+     * @brief One benchmark measurement
+     */
+    struct bench_result_t {
+        const char* name;
+        size_t bytes;    ///< payload bytes processed
+        uint32_t cycles; ///< cycles taken
+        size_t wire;     ///< encoded frame size of one payload, 0 if not measured
+
+        float bytesPerCycle() const { return cycles ? static_cast<float>(bytes) / cycles : 0.0f; }
+    };
+
+    /** @brief Payload with no bytes to escape, the common case */
+    inline void benchFillClean(uint8_t* buf, size_t size) {
+        for (size_t i = 0; i < size; i++) {
+            uint8_t c = static_cast<uint8_t>('0' + i % 64);
+            buf[i]    = (c == SLIP_END || c == SLIP_ESC) ? 'a' : c;
+        }
+    }
+
+    /** @brief Payload where every byte must be escaped */
+    inline void benchFillWorst(uint8_t* buf, size_t size) {
+        for (size_t i = 0; i < size; i++)
+            buf[i] = (i & 1) ? SLIP_ESC : SLIP_END;
+    }
+
+    /** @brief Payload of pseudo-random bytes, framing bytes included */
+    inline void benchFillRandom(uint8_t* buf, size_t size) {
+        uint32_t rnd = 12345;
+        for (size_t i = 0; i < size; i++) {
+            rnd    = rnd * 1103515245 + 12345;
+            buf[i] = static_cast<uint8_t>(rnd >> 16);
+        }
+    }
+
+    /** @brief Payload of zeros, the worst case for COBS: one block per byte */
+    inline void benchFillZeros(uint8_t* buf, size_t size) {
+        ::memset(buf, 0, size);
+    }
+
+    inline uint32_t benchScan(const uint8_t* (*find)(const uint8_t*, const uint8_t*),
+                              const uint8_t* buf, size_t size, int reps, size_t& sink) {
+        uint32_t start = benchCycles();
+        for (int r = 0; r < reps; r++) {
+            const uint8_t* p   = buf;
+            const uint8_t* end = buf + size;
+            while ((p = find(p, end)) < end) {
+                sink++;
+                p++;
+            }
+        }
+        return benchCycles() - start;
+    }
+
+    inline uint32_t benchEscape(const uint8_t* buf, size_t size, uint8_t* scratch, size_t scratch_size, int reps, size_t& sink) {
+        uint32_t start = benchCycles();
+        for (int r = 0; r < reps; r++) {
+            uint16_t crc       = 0;
+            const uint8_t* src = buf;
+            while (src < buf + size)
+                sink += slipEscapeKermit(src, buf + size, scratch, scratch_size, crc);
+            sink += crc;
+        }
+        return benchCycles() - start;
+    }
+
+    inline uint32_t benchDecode(const uint8_t* encoded, size_t encoded_size, uint8_t* frame, size_t frame_size, int reps, size_t& sink) {
+        uint32_t start = benchCycles();
+        for (int r = 0; r < reps; r++) {
+            SlipDecoder decoder(frame, frame_size);
+            size_t nused = 0;
+            decoder.decode(encoded, encoded_size, nused);
+            sink += decoder.crcOk();
+        }
+        return benchCycles() - start;
+    }
+
+    /**
+     * @brief Encode a whole frame with CRC, SLIP_TX_BUFFER_SIZE bytes at a time as
+     * writeSlipFrame does. The frame is left in out and its size in wire.
+     */
+    template <class F>
+    inline uint32_t benchFrameEncode(const uint8_t* buf, size_t size, uint8_t* out, int reps, size_t& wire) {
+        slice_t part{buf, size};
+        uint32_t start = benchCycles();
+        for (int r = 0; r < reps; r++) {
+            typename F::encoder_t encoder(&part, 1, true);
+            uint8_t* p = out;
+            while (!encoder.done())
+                p += encoder.encode(p, SLIP_TX_BUFFER_SIZE);
+            wire = p - out;
+        }
+        return benchCycles() - start;
+    }
+
+    template <class F>
+    inline uint32_t benchFrameDecode(const uint8_t* encoded, size_t encoded_size, uint8_t* frame, size_t frame_size, int reps, size_t& sink) {
+        uint32_t start = benchCycles();
+        for (int r = 0; r < reps; r++) {
+            typename F::decoder_t decoder(frame, frame_size);
+            size_t nused = 0;
+            decoder.decode(encoded, encoded_size, nused);
+            sink += decoder.crcOk();
+        }
+        return benchCycles() - start;
+    }
+
+    /**
+     * @brief Compare whole frame encode+CRC and decode+CRC with SLIP (default framing) and COBS
+     * on clean, random, SLIP worst case and COBS worst case payloads. Each encode result also
+     * gives the frame size on the wire.
+     *
+     * @param results   array to fill. Needs room for 16 results.
+     * @param payload   payload buffer
+     * @param size      payload size
+     * @param work      work buffer, at least 3 * size + 8 bytes
+     * @param reps      repetitions per measurement
+     * @return number of results filled
+     */
+    inline size_t benchFraming(bench_result_t* results, uint8_t* payload, size_t size, uint8_t* work, int reps) {
+        static const char* const names[] = {
+            "clean  slip encode", "clean  slip decode", "clean  cobs encode", "clean  cobs decode",
+            "random slip encode", "random slip decode", "random cobs encode", "random cobs decode",
+            "slip-w slip encode", "slip-w slip decode", "slip-w cobs encode", "slip-w cobs decode",
+            "cobs-w slip encode", "cobs-w slip decode", "cobs-w cobs encode", "cobs-w cobs decode"};
+        uint8_t* encoded = work;                // whole frame, CRC and END
+        uint8_t* frame   = work + 2 * size + 5; // decoded frame
+        size_t sink      = 0;
+        size_t n         = 0;
+        for (int kind = 0; kind < 4; kind++) {
+            if (kind == 0)
+                benchFillClean(payload, size);
+            else if (kind == 1)
+                benchFillRandom(payload, size);
+            else if (kind == 2)
+                benchFillWorst(payload, size);
+            else
+                benchFillZeros(payload, size);
+            size_t total = size * reps;
+            size_t wire  = 0;
+
+            results[n] = {names[n], total, benchFrameEncode<SlipDefaultFraming>(payload, size, encoded, reps, wire), wire};
+            n++;
+            results[n] = {names[n], total, benchFrameDecode<SlipDefaultFraming>(encoded, wire, frame, size + 3, reps, sink), 0};
+            n++;
+            results[n] = {names[n], total, benchFrameEncode<CobsFraming>(payload, size, encoded, reps, wire), wire};
+            n++;
+            results[n] = {names[n], total, benchFrameDecode<CobsFraming>(encoded, wire, frame, size + 3, reps, sink), 0};
+            n++;
+        }
+        benchSink() = sink;
+        return n;
+    }
+
+    /**
+     * @brief Measure scan, escape+CRC and decode+CRC throughput on clean and worst-case payloads.
+     *
+     * The scan is measured with both the scalar loop and slipFindSpecial (SLIP_SCAN_NAME) so
+     * one run shows the speedup. Build with SLIP_SCALAR_SCAN to compare the escape and decode
+     * paths without the fast scan.
+     *
+     * @param results   array to fill. Needs room for 8 results.
+     * @param payload   payload buffer
+     * @param size      payload size
+     * @param work      work buffer, at least 3 * size + 8 bytes
+     * @param reps      repetitions per measurement
+     * @return number of results filled
+     */
+    inline size_t benchSlip(bench_result_t* results, uint8_t* payload, size_t size, uint8_t* work, int reps) {
+        static const char* const names[] = {
+            "clean  scan scalar", "clean  scan " SLIP_SCAN_NAME, "clean  escape+crc", "clean  decode+crc",
+            "worst  scan scalar", "worst  scan " SLIP_SCAN_NAME, "worst  escape+crc", "worst  decode+crc"};
+        uint8_t* encoded = work;                // escaped payload, CRC and END
+        uint8_t* frame   = work + 2 * size + 5; // decoded frame
+        size_t sink      = 0;
+        size_t n         = 0;
+        for (int worst = 0; worst < 2; worst++) {
+            if (worst)
+                benchFillWorst(payload, size);
+            else
+                benchFillClean(payload, size);
+            // encode once as decoder input. benchEscape rewrites the same bytes.
+            uint16_t crc       = 0;
+            const uint8_t* src = payload;
+            size_t nenc        = slipEscapeKermit(src, payload + size, encoded, 2 * size, crc);
+            uint8_t crcbytes[2]{static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc & 0xff)};
+            src = crcbytes;
+            nenc += slipEscape(src, crcbytes + 2, encoded + nenc, 4);
+            encoded[nenc++] = SLIP_END;
+
+            size_t total = size * reps;
+            results[n]   = {names[n], total, benchScan(slipFindSpecialScalar<>, payload, size, reps, sink), 0};
+            n++;
+            results[n] = {names[n], total, benchScan(slipFindSpecial<>, payload, size, reps, sink), 0};
+            n++;
+            results[n] = {names[n], total, benchEscape(payload, size, encoded, 2 * size, reps, sink), 0};
+            n++;
+            results[n] = {names[n], total, benchDecode(encoded, nenc, frame, size + 3, reps, sink), 0};
+            n++;
+        }
+        benchSink() = sink;
+        return n;
+    }
+
+}; // namespace
+
+#endif // #ifndef __SLIPBENCH_H__
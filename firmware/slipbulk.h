@@ -0,0 +1,493 @@
+#pragma once
+
+#ifndef __SLIPBULK_H__
+    #define __SLIPBULK_H__
+
+    #include "slipcommand.h"
+
+/**
+ * @page slipbulk
+ * Bulk transfers
+ * ==============
+ *
+ * A blob too large for one frame, such as a lookup table or a waveform, is sent as numbered
+ * chunks in `$` frames. The receiver hands the chunks to a sink in order, and grants the
+ * sender credits so it never has more chunks in flight than the receiver can queue. Every
+ * field is a CBOR uint, except the error code of `x`, and a chunk's bytes follow its header
+ * as they are.
+ * @code
+ *	sender                                      receiver
+ *	$ o transfer target size chunk_size     ->
+ *	                                        <-  $ c transfer next credits chunk_size
+ *	$ d transfer index bytes...             ->
+ *	...                                     <-  $ c transfer next credits chunk_size
+ *	                                        <-  $ r transfer next credits chunk_size
+ *	$ x transfer error                      <>  $ x transfer error
+ * @endcode
+ *
+ * `next` is the first chunk the receiver does not have yet; every chunk before it has been
+ * written to the sink. The sender may send chunks up to `next + credits - 1`. The receiver
+ * sends a `c` every credits / 2 chunks and once the last chunk is in, and answers the open
+ * with the chunk size it takes, which is at most the one asked for.
+ *
+ * A damaged chunk is dropped, and so is every chunk after it until it comes again. Every
+ * damaged frame, and the first chunk out of order or duplicate since the last progress, is
+ * answered with an `r`, and the sender goes back to `next`. A resent chunk that is damaged
+ * again so costs another `r`, not a timeout. If a trailing chunk or a credit is lost
+ * the sender hears nothing, and goes back to the last chunk acknowledged after a timeout of
+ * its own.
+ *
+ * An open with the transfer number of the current or last transfer resumes it: the answer
+ * says where it got to. Any other number starts over, and gives up a transfer still open.
+ * Either side ends a transfer early with `x`. Bulk frames never carry a sequence number and
+ * are not NAK'd. A damaged frame is answered with `r` while a transfer is open, so commands
+ * sent during one should carry a sequence number.
+ */
+
+namespace sproto {
+
+    constexpr uint8_t BULK_OPEN   = 'o';
+    constexpr uint8_t BULK_DATA   = 'd';
+    constexpr uint8_t BULK_CREDIT = 'c';
+    constexpr uint8_t BULK_RESEND = 'r';
+    constexpr uint8_t BULK_ABORT  = 'x';
+
+    /** @brief longest header in front of a chunk's bytes: `$`, `d`, transfer and index */
+    constexpr size_t BULK_DATA_HEAD = 2 + 5 + 5;
+
+    /** @brief largest chunk whose decoded frame, CRC included, fits in frame_size bytes */
+    constexpr size_t bulkMaxChunk(size_t frame_size) {
+        return frame_size - BULK_DATA_HEAD - 2;
+    }
+
+    /** @brief Read one field of a bulk frame and move past it */
+    template <class T>
+    error_t bulkRead(CborSequenceReader& fields, T& value) {
+        CborParser parser;
+        CborValue it;
+        error_t err = fields.next(parser, it);
+        if (err == NO_ERROR)
+            err = cborRead(it, value);
+        if (err == NO_ERROR)
+            fields.advance(it);
+        return err;
+    }
+
+    /**
+     * @brief Where a bulk transfer goes. Called on the thread that dispatches commands.
+     */
+    struct bulk_sink_t {
+        uint32_t id;                                                          ///< target id
+        error_t (*open)(uint32_t size);                                       ///< anything but NO_ERROR refuses the transfer
+        error_t (*write)(uint32_t offset, const uint8_t* data, size_t size); ///< next bytes, in order. An error ends the transfer.
+        void (*close)(bool complete);                                         ///< all bytes arrived, or the transfer was given up
+    };
+
+    /**
+     * @brief Receiving end of bulk transfers, served by a CommandServer:
+     *
+     * @code
+     *  BulkReceiver bulk(sinks, bulkMaxChunk(FRAME_SIZE), DEPTH);
+     *  server.setFrameHandler(PROTO_BULK, BulkReceiver::handleFrame, &bulk);
+     * @endcode
+     *
+     * One transfer is open at a time.
+     */
+    class BulkReceiver {
+     public:
+        /**
+         * @param sinks     transfer targets
+         * @param max_chunk largest chunk taken, see bulkMaxChunk
+         * @param credits   chunks the sender may have in flight. No more than the frames the
+         *                  server can queue, so a stream without flow control never overruns.
+         */
+        template <size_t N>
+        BulkReceiver(const bulk_sink_t (&sinks)[N], size_t max_chunk, uint32_t credits)
+            : sinks_(sinks), nsinks_(N), max_chunk_(max_chunk), credits_(credits ? credits : 1), sink_(nullptr),
+              transfer_(0), size_(0), chunk_(0), nchunks_(0), next_(0), unacked_(0), resent_(false) {}
+
+        /** @brief frame_fn for CommandServer::setFrameHandler */
+        static error_t handleFrame(void* self, const uint8_t* frame, size_t size, uint8_t* reply, size_t& reply_size) {
+            return static_cast<BulkReceiver*>(self)->handle(frame, size, reply, reply_size);
+        }
+
+        /** @brief A transfer is open and some of it has yet to arrive */
+        bool active() const { return sink_ && next_ < nchunks_; }
+
+        /** @copydoc frame_fn */
+        error_t handle(const uint8_t* frame, size_t size, uint8_t* reply, size_t& reply_size) {
+            size_t room = reply_size;
+            reply_size  = 0;
+            if (!frame) {
+                // perhaps a chunk, ask for it again
+                if (!active())
+                    return ERROR_ENCODING;
+                resent_    = false;
+                reply_size = writeResend(reply, room);
+                return NO_ERROR;
+            }
+            if (size < 2)
+                return ERROR_COMMAND;
+            CborSequenceReader fields(frame + 2, size - 2);
+            uint32_t transfer;
+            if (bulkRead(fields, transfer) != NO_ERROR)
+                return ERROR_COMMAND;
+            switch (frame[1]) {
+            case BULK_OPEN:
+                return open(transfer, fields, reply, room, reply_size);
+            case BULK_DATA:
+                return data(transfer, fields, reply, room, reply_size);
+            case BULK_ABORT:
+                if (transfer == transfer_)
+                    close(false);
+                return NO_ERROR;
+            }
+            return ERROR_COMMAND;
+        }
+
+     protected:
+        error_t open(uint32_t transfer, CborSequenceReader& fields, uint8_t* reply, size_t room, size_t& reply_size) {
+            uint32_t target, size, chunk;
+            if (bulkRead(fields, target) != NO_ERROR || bulkRead(fields, size) != NO_ERROR || bulkRead(fields, chunk) != NO_ERROR)
+                return ERROR_COMMAND;
+            if (sink_ && transfer == transfer_) {
+                resent_    = false;
+                reply_size = writeCredit(BULK_CREDIT, reply, room);
+                return NO_ERROR;
+            }
+            close(false);
+            const bulk_sink_t* sink = nullptr;
+            for (size_t i = 0; i < nsinks_ && !sink; i++) {
+                if (sinks_[i].id == target)
+                    sink = &sinks_[i];
+            }
+            error_t err = (sink && chunk > 0) ? sink->open(size) : ERROR_COMMAND;
+            if (err != NO_ERROR) {
+                reply_size = writeAbort(transfer, err, reply, room);
+                return err;
+            }
+            sink_      = sink;
+            transfer_  = transfer;
+            size_      = size;
+            chunk_     = chunk < max_chunk_ ? chunk : static_cast<uint32_t>(max_chunk_);
+            nchunks_   = static_cast<uint32_t>((static_cast<uint64_t>(size) + chunk_ - 1) / chunk_);
+            next_      = 0;
+            unacked_   = 0;
+            resent_    = false;
+            if (nchunks_ == 0)
+                sink_->close(true);
+            reply_size = writeCredit(BULK_CREDIT, reply, room);
+            return NO_ERROR;
+        }
+
+        error_t data(uint32_t transfer, CborSequenceReader& fields, uint8_t* reply, size_t room, size_t& reply_size) {
+            uint32_t index;
+            if (bulkRead(fields, index) != NO_ERROR)
+                return ERROR_COMMAND;
+            if (!sink_ || transfer != transfer_) {
+                reply_size = writeAbort(transfer, ERROR_COMMAND, reply, room);
+                return ERROR_COMMAND;
+            }
+            size_t size = (index + 1 == nchunks_) ? size_ - index * chunk_ : chunk_;
+            if (index != next_ || index >= nchunks_ || fields.remaining() != size) {
+                // one went missing, or the sender went back further than it had to
+                reply_size = writeResend(reply, room);
+                return NO_ERROR;
+            }
+            error_t err = sink_->write(index * chunk_, fields.pos(), size);
+            if (err != NO_ERROR) {
+                close(false);
+                reply_size = writeAbort(transfer, err, reply, room);
+                return err;
+            }
+            next_++;
+            unacked_++;
+            resent_ = false;
+            if (next_ == nchunks_)
+                sink_->close(true);
+            if (next_ == nchunks_ || unacked_ >= (credits_ + 1) / 2) {
+                unacked_   = 0;
+                reply_size = writeCredit(BULK_CREDIT, reply, room);
+            }
+            return NO_ERROR;
+        }
+
+        /** @brief give up the open transfer */
+        void close(bool complete) {
+            if (active())
+                sink_->close(complete);
+            sink_ = nullptr;
+        }
+
+        /** @brief `r`, at most once until the transfer moves on again or a frame arrives damaged */
+        size_t writeResend(uint8_t* reply, size_t room) {
+            if (resent_)
+                return 0;
+            resent_ = true;
+            return writeCredit(BULK_RESEND, reply, room);
+        }
+
+        size_t writeCredit(uint8_t code, uint8_t* reply, size_t room) {
+            reply[0] = PROTO_BULK;
+            reply[1] = code;
+            CborSequenceWriter out(reply + 2, room - 2);
+            const uint32_t fields[]{transfer_, next_, credits_, chunk_};
+            for (uint32_t field : fields) {
+                cbor_encode_uint(&out.next(), field);
+                out.commit();
+            }
+            return out.overflow() ? 0 : 2 + out.size();
+        }
+
+        size_t writeAbort(uint32_t transfer, error_t err, uint8_t* reply, size_t room) {
+            reply[0] = PROTO_BULK;
+            reply[1] = BULK_ABORT;
+            CborSequenceWriter out(reply + 2, room - 2);
+            cbor_encode_uint(&out.next(), transfer);
+            out.commit();
+            cbor_encode_int(&out.next(), err);
+            out.commit();
+            return out.overflow() ? 0 : 2 + out.size();
+        }
+
+        const bulk_sink_t* sinks_;
+        size_t nsinks_;
+        size_t max_chunk_;
+        uint32_t credits_;
+        const bulk_sink_t* sink_; ///< of the current or last transfer, nullptr if given up
+        uint32_t transfer_;
+        uint32_t size_;
+        uint32_t chunk_;
+        uint32_t nchunks_;
+        uint32_t next_;    ///< first chunk not yet written to the sink
+        uint32_t unacked_; ///< chunks written since the last credit
+        bool resent_;      ///< an `r` went out since the last progress
+    };
+
+    /**
+     * @brief Sending end of a bulk transfer. Sends a blob from memory as fast as the
+     * receiver's credits allow.
+     *
+     * Never blocks. Call @ref poll until it returns something other than ERROR_INCOMPLETE.
+     * Timeouts are up to the caller: if @ref acked has not moved for a while, call @ref retry.
+     * The sender reads every frame on the link while a transfer runs, and drops those that are
+     * not its own.
+     *
+     * @tparam D Derived protocol class, e.g. PosixSlipProtocol
+     */
+    template <class D>
+    class BulkSender {
+     public:
+        typedef SlipProtocolBase<D, typename D::framing_t> proto_t;
+
+        /**
+         * @param proto     protocol to send on
+         * @param rxbuffer  credit frame receive buffer
+         * @param rxsize    size of receive buffer
+         */
+        BulkSender(proto_t& proto, uint8_t* rxbuffer, size_t rxsize)
+            : proto_(proto), decoder_(rxbuffer, rxsize), state_(STATE_IDLE), error_(ERROR_COMMAND), transfer_(0), target_(0),
+              data_(nullptr), size_(0), chunk_(0), nchunks_(0), acked_(0), sent_(0), limit_(0), resent_(0) {}
+
+        /**
+         * @brief Open a transfer. The blob must stay valid until it ends.
+         *
+         * @param transfer  transfer number. That of an interrupted transfer resumes it, any
+         *                  other starts over.
+         * @param target    sink id on the receiver
+         * @param data      blob to send
+         * @param size      size of data
+         * @param chunk     chunk size to ask for. The receiver may take less.
+         * @return NO_ERROR or ERROR_STREAM if the open could not be written
+         */
+        error_t begin(uint32_t transfer, uint32_t target, const uint8_t* data, uint32_t size, uint32_t chunk) {
+            state_    = STATE_OPENING;
+            transfer_ = transfer;
+            target_   = target;
+            data_     = data;
+            size_     = size;
+            chunk_    = chunk;
+            acked_ = sent_ = limit_ = 0;
+            resent_   = 0;
+            return writeOpen();
+        }
+
+        /**
+         * @brief Read the receiver's credits and send the chunks they allow.
+         *
+         * @return
+         *  - ERROR_INCOMPLETE  the transfer is running
+         *  - NO_ERROR          every chunk has been acknowledged
+         *  - anything else     the transfer ended early, with the receiver's error or ERROR_STREAM
+         */
+        error_t poll() {
+            while (running()) {
+                error_t err = proto_.readSlipFrame(decoder_);
+                if (err == ERROR_INCOMPLETE)
+                    break;
+                if (err == ERROR_STREAM)
+                    return fail(err);
+                if (err == NO_ERROR)
+                    receive();
+            }
+            if (state_ == STATE_SENDING)
+                send();
+            return state_ == STATE_DONE ? NO_ERROR : running() ? ERROR_INCOMPLETE : error_;
+        }
+
+        /** @brief Nothing has been heard for too long: open again, or go back to the last chunk acknowledged */
+        void retry() {
+            if (state_ == STATE_OPENING) {
+                writeOpen();
+            } else if (state_ == STATE_SENDING) {
+                resent_ += sent_ - acked_;
+                sent_ = acked_;
+            }
+        }
+
+        /** @brief End the transfer early and tell the receiver */
+        void abort() {
+            if (!running())
+                return;
+            uint8_t frame[2 + 5 + 5];
+            frame[0] = PROTO_BULK;
+            frame[1] = BULK_ABORT;
+            CborSequenceWriter out(frame + 2, sizeof(frame) - 2);
+            cbor_encode_uint(&out.next(), transfer_);
+            out.commit();
+            cbor_encode_int(&out.next(), ERROR_COMMAND);
+            out.commit();
+            proto_.writeSlipFrame(frame, 2 + out.size());
+            fail(ERROR_COMMAND);
+        }
+
+        /** @brief Bytes the receiver has written to its sink */
+        uint32_t acked() const {
+            uint64_t bytes = static_cast<uint64_t>(acked_) * chunk_;
+            return bytes < size_ ? static_cast<uint32_t>(bytes) : size_;
+        }
+
+        /** @brief Chunks sent more than once */
+        uint32_t resent() const { return resent_; }
+
+        /** @brief Chunk size the receiver took. Known once the transfer is open. */
+        uint32_t chunkSize() const { return chunk_; }
+
+     protected:
+        enum state_t : uint8_t {
+            STATE_IDLE,
+            STATE_OPENING,
+            STATE_SENDING,
+            STATE_DONE,
+            STATE_FAILED,
+        };
+
+        bool running() const { return state_ == STATE_OPENING || state_ == STATE_SENDING; }
+
+        error_t fail(error_t err) {
+            state_ = STATE_FAILED;
+            error_ = err;
+            return err;
+        }
+
+        error_t writeOpen() {
+            uint8_t frame[2 + 4 * 5];
+            frame[0] = PROTO_BULK;
+            frame[1] = BULK_OPEN;
+            CborSequenceWriter out(frame + 2, sizeof(frame) - 2);
+            const uint32_t fields[]{transfer_, target_, size_, chunk_};
+            for (uint32_t field : fields) {
+                cbor_encode_uint(&out.next(), field);
+                out.commit();
+            }
+            return proto_.writeSlipFrame(frame, 2 + out.size()) > 0 ? NO_ERROR : ERROR_STREAM;
+        }
+
+        /** @brief take in a credit, resend or abort of this transfer */
+        void receive() {
+            const uint8_t* frame = decoder_.frame();
+            size_t size          = decoder_.frameSize();
+            if (proto_.use_crc_) {
+                if (!decoder_.crcOk() || size < 2)
+                    return;
+                size -= 2;
+            }
+            if (size < 2 || frame[0] != PROTO_BULK)
+                return;
+            CborSequenceReader fields(frame + 2, size - 2);
+            uint32_t transfer, next, credits, chunk;
+            if (bulkRead(fields, transfer) != NO_ERROR || transfer != transfer_)
+                return;
+            if (frame[1] == BULK_ABORT) {
+                int32_t err = ERROR_COMMAND;
+                bulkRead(fields, err);
+                fail(err);
+                return;
+            }
+            if ((frame[1] != BULK_CREDIT && frame[1] != BULK_RESEND) || bulkRead(fields, next) != NO_ERROR ||
+                bulkRead(fields, credits) != NO_ERROR || bulkRead(fields, chunk) != NO_ERROR)
+                return;
+            if (state_ == STATE_OPENING) {
+                if (chunk == 0 || chunk > chunk_) {
+                    fail(ERROR_ENCODING);
+                    return;
+                }
+                chunk_   = chunk;
+                nchunks_ = static_cast<uint32_t>((static_cast<uint64_t>(size_) + chunk_ - 1) / chunk_);
+                state_   = STATE_SENDING;
+            }
+            if (next > nchunks_ || next < acked_)
+                return; // not this transfer, or stale
+            acked_ = next;
+            if (frame[1] == BULK_RESEND && sent_ > next) {
+                resent_ += sent_ - next;
+                sent_ = next;
+            }
+            if (sent_ < acked_)
+                sent_ = acked_;
+            limit_ = next + credits;
+            if (acked_ == nchunks_)
+                state_ = STATE_DONE;
+        }
+
+        void send() {
+            uint32_t end = limit_ < nchunks_ ? limit_ : nchunks_;
+            while (sent_ < end) {
+                uint8_t head[BULK_DATA_HEAD];
+                head[0] = PROTO_BULK;
+                head[1] = BULK_DATA;
+                CborSequenceWriter out(head + 2, sizeof(head) - 2);
+                cbor_encode_uint(&out.next(), transfer_);
+                out.commit();
+                cbor_encode_uint(&out.next(), sent_);
+                out.commit();
+                uint32_t offset = sent_ * chunk_;
+                uint32_t size   = size_ - offset < chunk_ ? size_ - offset : chunk_;
+                slice_t parts[]{{head, 2 + out.size()}, {data_ + offset, size}};
+                if (proto_.writeSlipFrame(parts, 2) == 0) {
+                    fail(ERROR_STREAM);
+                    return;
+                }
+                sent_++;
+            }
+        }
+
+        proto_t& proto_;
+        typename proto_t::decoder_t decoder_;
+        state_t state_;
+        error_t error_; ///< why the transfer ended early
+        uint32_t transfer_;
+        uint32_t target_;
+        const uint8_t* data_;
+        uint32_t size_;
+        uint32_t chunk_;
+        uint32_t nchunks_;
+        uint32_t acked_;  ///< chunks the receiver has
+        uint32_t sent_;   ///< next chunk to send
+        uint32_t limit_;  ///< first chunk the credits do not cover
+        uint32_t resent_; ///< chunks sent again
+    };
+
+}; // namespace
+
+#endif // #ifndef __SLIPBULK_H__
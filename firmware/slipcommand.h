@@ -0,0 +1,899 @@
+#pragma once
+
+#ifndef __SLIPCOMMAND_H__
+    #define __SLIPCOMMAND_H__
+
+    #include "slipproto.h"
+
+/**
+ * @page slipcommand
+ * CBOR command layer
+ * ==================
+ *
+ * Decoded command frame (before SLIP escaping)
+ * @code
+ *	| ! / ? | CBOR uint command id | CBOR array of parameters | CRC HI LO |
+ * @endcode
+ *
+ * The parameter array may be left out if a command takes no parameters. A query reply carries
+ * the command id echo followed by a CBOR array of results.
+ *
+ * Commands are looked up in a constant table of @ref command_t sorted by id. A table with
+ * consecutive ids is indexed directly, otherwise it is binary searched. Either way there are
+ * no string compares. Parameters are parsed by tinycbor straight out of the received frame
+ * buffer into the handler's local variables with @ref cborReadArgs.
+ *
+ * A successful `!` set command is answered with a bare `+`. A successful `?` query is answered
+ * with `+`, the command id echo, whatever the handler encoded, and a CRC. Any failure is
+ * answered with a bare `-`. Requests wrapped in a `@` sequence number are answered in the
+ * same wrapper (see @ref slipprot).
+ *
+ * A `*` batch frame carries a CBOR sequence of commands. Each is a CBOR array of the type
+ * code as a CBOR uint, the command id and, unless it is left out, the parameter array:
+ * @code
+ *	| * | [type, id, [params]] | [type, id] | ... | CRC HI LO |
+ * @endcode
+ *
+ * The commands are run back to back and answered by one `+` frame holding a CBOR sequence
+ * with one array per command: `[0, id, [results]]` for a query, `[0]` for a set, and
+ * `[error]` with the negative error_t of a command that failed. A failed command does not
+ * stop the ones after it. A command that is not well-formed CBOR does, as the start of the
+ * next one is unknown, and so does a reply buffer too full to take another status. The ACK
+ * then has fewer entries than the batch had commands, and the rest were not run.
+ */
+
+namespace sproto {
+
+    constexpr error_t ERROR_COMMAND = -6; ///< unknown command, unsupported type, or bad parameters
+
+    /**
+     * @brief Command handler
+     *
+     * @param params    parser inside the parameter array of the received frame
+     * @param reply     array encoder for query results. Ignored for set commands.
+     * @return NO_ERROR to ACK, anything else to NAK
+     */
+    typedef error_t (*command_fn)(CborValue& params, CborEncoder& reply);
+
+    /**
+     * @brief One command table entry. Either handler may be nullptr if unsupported.
+     */
+    struct command_t {
+        uint32_t id;     ///< CBOR-encoded command id
+        command_fn set;  ///< handles `!`
+        command_fn get;  ///< handles `?`
+    };
+
+    /** @brief Ids strictly increase. Use in a static_assert on the table. */
+    constexpr bool commandsSorted(const command_t* table, size_t count) {
+        for (size_t i = 1; i < count; i++) {
+            if (table[i].id <= table[i - 1].id)
+                return false;
+        }
+        return true;
+    }
+
+    template <size_t N>
+    constexpr bool commandsSorted(const command_t (&table)[N]) {
+        return commandsSorted(table, N);
+    }
+
+    /** @brief Ids are consecutive, so an id maps to its index by subtraction */
+    constexpr bool commandsDense(const command_t* table, size_t count) {
+        for (size_t i = 1; i < count; i++) {
+            if (table[i].id != table[0].id + i)
+                return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Lookup over a constant, sorted table of commands.
+     */
+    class CommandTable {
+     public:
+        template <size_t N>
+        constexpr CommandTable(const command_t (&table)[N])
+            : table_(table), count_(N), dense_(commandsDense(table, N)) {}
+
+        /** @return matching command, or nullptr */
+        const command_t* find(uint32_t id) const {
+            if (count_ == 0)
+                return nullptr;
+            if (dense_) {
+                uint32_t i = id - table_[0].id; // wraps for ids below the first
+                return i < count_ ? &table_[i] : nullptr;
+            }
+            size_t lo = 0, hi = count_;
+            while (lo < hi) {
+                size_t mid = (lo + hi) / 2;
+                if (table_[mid].id < id)
+                    lo = mid + 1;
+                else
+                    hi = mid;
+            }
+            return (lo < count_ && table_[lo].id == id) ? &table_[lo] : nullptr;
+        }
+
+        size_t size() const { return count_; }
+
+     protected:
+        const command_t* table_;
+        size_t count_;
+        bool dense_;
+    };
+
+    /** @brief Zero-copy view of a CBOR text or byte string. Valid until the next frame is received. */
+    struct cbor_string_t {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    inline error_t cborCheck(CborError err) {
+        return err == CborNoError ? NO_ERROR : ERROR_COMMAND;
+    }
+
+    /**
+     * @brief Read one parameter and advance the parser.
+     * @return NO_ERROR or ERROR_COMMAND if the type does not match
+     */
+    inline error_t cborRead(CborValue& it, bool& value) {
+        if (!cbor_value_is_boolean(&it) || cbor_value_get_boolean(&it, &value) != CborNoError)
+            return ERROR_COMMAND;
+        return cborCheck(cbor_value_advance_fixed(&it));
+    }
+
+    inline error_t cborRead(CborValue& it, int32_t& value) {
+        int64_t v;
+        if (!cbor_value_is_integer(&it) || cbor_value_get_int64_checked(&it, &v) != CborNoError)
+            return ERROR_COMMAND;
+        if (v < INT32_MIN || v > INT32_MAX)
+            return ERROR_COMMAND;
+        value = static_cast<int32_t>(v);
+        return cborCheck(cbor_value_advance_fixed(&it));
+    }
+
+    inline error_t cborRead(CborValue& it, uint32_t& value) {
+        uint64_t v;
+        if (!cbor_value_is_unsigned_integer(&it) || cbor_value_get_uint64(&it, &v) != CborNoError)
+            return ERROR_COMMAND;
+        if (v > UINT32_MAX)
+            return ERROR_COMMAND;
+        value = static_cast<uint32_t>(v);
+        return cborCheck(cbor_value_advance_fixed(&it));
+    }
+
+    inline error_t cborRead(CborValue& it, double& value) {
+        if (cbor_value_is_double(&it)) {
+            if (cbor_value_get_double(&it, &value) != CborNoError)
+                return ERROR_COMMAND;
+        } else if (cbor_value_is_float(&it)) {
+            float f;
+            if (cbor_value_get_float(&it, &f) != CborNoError)
+                return ERROR_COMMAND;
+            value = f;
+        } else if (cbor_value_is_integer(&it)) {
+            int64_t v;
+            if (cbor_value_get_int64_checked(&it, &v) != CborNoError)
+                return ERROR_COMMAND;
+            value = static_cast<double>(v);
+        } else {
+            return ERROR_COMMAND;
+        }
+        return cborCheck(cbor_value_advance_fixed(&it));
+    }
+
+    inline error_t cborRead(CborValue& it, float& value) {
+        double v;
+        error_t err = cborRead(it, v);
+        value       = static_cast<float>(v);
+        return err;
+    }
+
+    /**
+     * @brief Text or byte string, without copying. Only definite length (single chunk)
+     * strings can be viewed in place.
+     */
+    inline error_t cborRead(CborValue& it, cbor_string_t& value) {
+        CborValue next = it;
+        size_t len     = 0;
+        if (cbor_value_is_text_string(&it)) {
+            const char* ptr = nullptr;
+            if (cbor_value_get_text_string_chunk(&it, &ptr, &len, &next) != CborNoError || !ptr)
+                return ERROR_COMMAND;
+            value.data  = reinterpret_cast<const uint8_t*>(ptr);
+            size_t more = 0;
+            if (cbor_value_get_text_string_chunk(&next, &ptr, &more, &next) != CborNoError || ptr)
+                return ERROR_COMMAND;
+        } else if (cbor_value_is_byte_string(&it)) {
+            const uint8_t* ptr = nullptr;
+            if (cbor_value_get_byte_string_chunk(&it, &ptr, &len, &next) != CborNoError || !ptr)
+                return ERROR_COMMAND;
+            value.data  = ptr;
+            size_t more = 0;
+            if (cbor_value_get_byte_string_chunk(&next, &ptr, &more, &next) != CborNoError || ptr)
+                return ERROR_COMMAND;
+        } else {
+            return ERROR_COMMAND;
+        }
+        value.size = len;
+        it         = next;
+        return NO_ERROR;
+    }
+
+    /**
+     * @brief Reads consecutive top-level CBOR items (an RFC 8742 CBOR sequence) from one buffer.
+     * A tinycbor parser only walks a single top-level item, so each item gets its own parser.
+     */
+    class CborSequenceReader {
+     public:
+        CborSequenceReader(const uint8_t* buffer, size_t size)
+            : pos_(buffer), end_(buffer + size) {}
+
+        bool atEnd() const { return pos_ >= end_; }
+
+        /** @brief start parsing the next item */
+        error_t next(CborParser& parser, CborValue& it) {
+            if (atEnd())
+                return ERROR_COMMAND;
+            return cborCheck(cbor_parser_init(pos_, end_ - pos_, 0, &parser, &it));
+        }
+
+        /** @brief move past an item once `it` has been advanced over it */
+        void advance(const CborValue& it) {
+            pos_ = cbor_value_get_next_byte(&it);
+        }
+
+        const uint8_t* pos() const { return pos_; }
+        size_t remaining() const { return atEnd() ? 0 : end_ - pos_; }
+
+     protected:
+        const uint8_t* pos_;
+        const uint8_t* end_;
+    };
+
+    /**
+     * @brief Writes consecutive top-level CBOR items into one buffer. Each item gets a fresh
+     * encoder positioned after the previous one.
+     */
+    class CborSequenceWriter {
+     public:
+        CborSequenceWriter(uint8_t* buffer, size_t size)
+            : begin_(buffer), pos_(buffer), end_(buffer + size), overflow_(false) {}
+
+        /** @brief encoder for the next item. Call @ref commit when the item is complete. */
+        CborEncoder& next() {
+            cbor_encoder_init(&encoder_, pos_, end_ - pos_, 0);
+            return encoder_;
+        }
+
+        /** @return false if the item did not fit and was dropped */
+        bool commit() {
+            if (cbor_encoder_get_extra_bytes_needed(&encoder_) > 0) {
+                overflow_ = true;
+                return false;
+            }
+            pos_ += cbor_encoder_get_buffer_size(&encoder_, pos_);
+            return true;
+        }
+
+        const uint8_t* data() const { return begin_; }
+        size_t size() const { return pos_ - begin_; }
+        /** @brief bytes left for further items */
+        size_t room() const { return end_ - pos_; }
+        /** @brief an item did not fit and was dropped */
+        bool overflow() const { return overflow_; }
+
+     protected:
+        uint8_t* begin_;
+        uint8_t* pos_;
+        uint8_t* end_;
+        bool overflow_;
+        CborEncoder encoder_;
+    };
+
+    /** @brief Parser over an empty array, standing in for parameters that were left out */
+    inline error_t cborEmptyArray(CborParser& parser, CborValue& array) {
+        static const uint8_t empty_array[]{0x80};
+        return cborCheck(cbor_parser_init(empty_array, 1, 0, &parser, &array));
+    }
+
+    /** @brief End of parameter list */
+    inline error_t cborReadArgs(CborValue&) {
+        return NO_ERROR;
+    }
+
+    /**
+     * @brief Read parameters in order directly into the handler's variables.
+     *
+     * @code
+     *  uint32_t pattern; float delay;
+     *  error_t err = cborReadArgs(params, pattern, delay);
+     * @endcode
+     */
+    template <class T, class... Rest>
+    error_t cborReadArgs(CborValue& it, T& first, Rest&... rest) {
+        error_t err = cborRead(it, first);
+        return err != NO_ERROR ? err : cborReadArgs(it, rest...);
+    }
+
+    /**
+     * @brief Send a command or query frame.
+     *
+     * @param proto         protocol to write to
+     * @param type          PROTO_SET or PROTO_GET
+     * @param id            command id
+     * @param params        CBOR-encoded parameter array, may be nullptr
+     * @param params_size   size of params
+     * @return NO_ERROR or ERROR_STREAM if the frame could not be written
+     */
+    template <class D, class F>
+    error_t writeCommand(SlipProtocolBase<D, F>& proto, uint8_t type, uint32_t id, const uint8_t* params, size_t params_size) {
+        uint8_t head[1 + 5]; // type and CBOR uint32
+        head[0] = type;
+        CborEncoder enc;
+        cbor_encoder_init(&enc, head + 1, sizeof(head) - 1, 0);
+        cbor_encode_uint(&enc, id);
+        slice_t parts[]{{head, 1 + cbor_encoder_get_buffer_size(&enc, head + 1)}, {params, params_size}};
+        size_t nparts = params_size ? 2 : 1;
+        return proto.writeSlipFrame(parts, nparts) > 0 ? NO_ERROR : ERROR_STREAM;
+    }
+
+    /**
+     * @brief Send a command or query frame wrapped in a sequence number.
+     *
+     * @param proto         protocol to write to
+     * @param seq           sequence number echoed in the reply
+     * @param type          PROTO_SET, PROTO_GET, or a single letter code such as PROTO_QUERY
+     * @param id            command id. Ignored for single letter codes.
+     * @param params        CBOR-encoded parameter array, may be nullptr
+     * @param params_size   size of params
+     * @return NO_ERROR or ERROR_STREAM if the frame could not be written
+     */
+    template <class D, class F>
+    error_t writeCommand(SlipProtocolBase<D, F>& proto, uint8_t seq, uint8_t type, uint32_t id, const uint8_t* params, size_t params_size) {
+        uint8_t head[3 + 5]; // @, seq, type and CBOR uint32
+        head[0]     = PROTO_SEQ;
+        head[1]     = seq;
+        head[2]     = type;
+        size_t size = 3;
+        if (type == PROTO_SET || type == PROTO_GET) {
+            CborEncoder enc;
+            cbor_encoder_init(&enc, head + 3, sizeof(head) - 3, 0);
+            cbor_encode_uint(&enc, id);
+            size += cbor_encoder_get_buffer_size(&enc, head + 3);
+        } else {
+            params_size = 0;
+        }
+        slice_t parts[]{{head, size}, {params, params_size}};
+        size_t nparts = params_size ? 2 : 1;
+        return proto.writeSlipFrame(parts, nparts) > 0 ? NO_ERROR : ERROR_STREAM;
+    }
+
+    /**
+     * @brief Collects commands into the payload of one batch frame.
+     *
+     * @code
+     *  uint8_t buffer[256];
+     *  CommandBatch batch(buffer, sizeof(buffer));
+     *  batch.add(PROTO_SET, CMD_DIGITAL_OUT, params, params_size);
+     *  batch.add(PROTO_GET, CMD_SEQUENCE, nullptr, 0);
+     *  writeBatch(proto, batch);
+     * @endcode
+     */
+    class CommandBatch {
+     public:
+        CommandBatch(uint8_t* buffer, size_t size)
+            : begin_(buffer), pos_(buffer), end_(buffer + size), count_(0) {}
+
+        /**
+         * @brief Append a command.
+         *
+         * @param type          PROTO_SET or PROTO_GET
+         * @param id            command id
+         * @param params        CBOR-encoded parameter array, may be nullptr
+         * @param params_size   size of params
+         * @return NO_ERROR, or ERROR_BUFFER if the command does not fit. The batch is unchanged.
+         */
+        error_t add(uint8_t type, uint32_t id, const uint8_t* params, size_t params_size) {
+            uint8_t head[1 + 2 + 5]; // array, CBOR uint8 type and uint32 id
+            head[0] = static_cast<uint8_t>(params_size ? 0x83 : 0x82); // array of 3 or 2 items
+            CborEncoder enc;
+            cbor_encoder_init(&enc, head + 1, sizeof(head) - 1, 0);
+            cbor_encode_uint(&enc, type);
+            cbor_encode_uint(&enc, id);
+            size_t head_size = 1 + cbor_encoder_get_buffer_size(&enc, head + 1);
+            if (head_size + params_size > static_cast<size_t>(end_ - pos_))
+                return ERROR_BUFFER;
+            memcpy(pos_, head, head_size);
+            pos_ += head_size;
+            if (params_size) {
+                memcpy(pos_, params, params_size);
+                pos_ += params_size;
+            }
+            count_++;
+            return NO_ERROR;
+        }
+
+        void clear() {
+            pos_   = begin_;
+            count_ = 0;
+        }
+
+        /** @brief commands added */
+        size_t count() const { return count_; }
+        const uint8_t* data() const { return begin_; }
+        size_t size() const { return pos_ - begin_; }
+
+     protected:
+        uint8_t* begin_;
+        uint8_t* pos_;
+        uint8_t* end_;
+        size_t count_;
+    };
+
+    /**
+     * @brief Send a batch frame.
+     *
+     * @return NO_ERROR or ERROR_STREAM if the frame could not be written
+     */
+    template <class D, class F>
+    error_t writeBatch(SlipProtocolBase<D, F>& proto, const CommandBatch& batch) {
+        uint8_t head[]{PROTO_BATCH};
+        slice_t parts[]{{head, 1}, {batch.data(), batch.size()}};
+        return proto.writeSlipFrame(parts, 2) > 0 ? NO_ERROR : ERROR_STREAM;
+    }
+
+    /**
+     * @brief Send a batch frame wrapped in a sequence number.
+     *
+     * @return NO_ERROR or ERROR_STREAM if the frame could not be written
+     */
+    template <class D, class F>
+    error_t writeBatch(SlipProtocolBase<D, F>& proto, uint8_t seq, const CommandBatch& batch) {
+        uint8_t head[]{PROTO_SEQ, seq, PROTO_BATCH};
+        slice_t parts[]{{head, 3}, {batch.data(), batch.size()}};
+        return proto.writeSlipFrame(parts, 2) > 0 ? NO_ERROR : ERROR_STREAM;
+    }
+
+    /**
+     * @brief Room a status-only batch entry always fits in: array head and CBOR int32. A batch
+     * of n set commands always runs to the end in a reply of n * BATCH_STATUS_SIZE bytes.
+     */
+    constexpr size_t BATCH_STATUS_SIZE = 1 + 5;
+
+    /**
+     * @brief Reads the ACK of a batch frame, one entry per command in the order they were added.
+     */
+    class BatchReplyReader {
+     public:
+        /**
+         * @param reply     CBOR payload after the ACK
+         * @param size      size of reply
+         */
+        BatchReplyReader(const uint8_t* reply, size_t size) : entries_(reply, size) {}
+
+        /**
+         * @brief Outcome of the next command.
+         *
+         * @param[out] status   NO_ERROR, or the error the command failed with
+         * @param[out] result   for a query, the command id echo and result array, as a single
+         *                      query reply carries them. Empty for a set or a failure.
+         * @return
+         *  - NO_ERROR          status and result are set
+         *  - ERROR_INCOMPLETE  no more entries. Commands left over were not run.
+         *  - ERROR_COMMAND     the entry is malformed
+         */
+        error_t next(error_t& status, slice_t& result) {
+            if (entries_.atEnd())
+                return ERROR_INCOMPLETE;
+            CborParser parser;
+            CborValue entry, fields;
+            int value = 0;
+            if (entries_.next(parser, entry) != NO_ERROR || !cbor_value_is_array(&entry) ||
+                cbor_value_enter_container(&entry, &fields) != CborNoError || !cbor_value_is_integer(&fields) ||
+                cbor_value_get_int_checked(&fields, &value) != CborNoError || cbor_value_advance_fixed(&fields) != CborNoError)
+                return ERROR_COMMAND;
+            result.data = cbor_value_get_next_byte(&fields);
+            while (!cbor_value_at_end(&fields)) {
+                if (cbor_value_advance(&fields) != CborNoError)
+                    return ERROR_COMMAND;
+            }
+            result.size = cbor_value_get_next_byte(&fields) - result.data;
+            if (cbor_value_leave_container(&entry, &fields) != CborNoError)
+                return ERROR_COMMAND;
+            entries_.advance(entry);
+            status = value;
+            return NO_ERROR;
+        }
+
+     protected:
+        CborSequenceReader entries_;
+    };
+
+    /**
+     * @brief Handler of the frames of one type code that are not commands, e.g. PROTO_BULK
+     * frames for a BulkReceiver. See CommandServer::setFrameHandler.
+     *
+     * @param context           as given to setFrameHandler
+     * @param frame             frame from its type code on, without CRC. nullptr for a frame that
+     *                          arrived damaged, which might have been one of the handler's.
+     * @param size              size of frame
+     * @param reply             buffer for the payload of a reply frame
+     * @param[in,out] reply_size room in reply, then the size of the reply, 0 for none
+     * @return NO_ERROR, or the error to NAK with if there is no reply
+     */
+    typedef error_t (*frame_fn)(void* context, const uint8_t* frame, size_t size, uint8_t* reply, size_t& reply_size);
+
+    /**
+     * @brief Command server. Reads frames without blocking, dispatches them through a
+     * CommandTable and writes the ACK/NAK.
+     *
+     * @tparam D Derived protocol class, e.g. ArduinoSlipProtocol<usb_serial_class>
+     */
+    template <class D>
+    class CommandServer {
+     public:
+        typedef SlipProtocolBase<D, typename D::framing_t> proto_t;
+
+        /**
+         * @param proto         protocol to serve
+         * @param commands      command table
+         * @param rxbuffer      frame receive buffer
+         * @param rxsize        size of receive buffer
+         * @param txbuffer      query reply encoding buffer
+         * @param txsize        size of reply buffer
+         * @param version       device version returned by `q`
+         * @param description   device description returned by `q`
+         */
+        CommandServer(proto_t& proto, CommandTable commands, uint8_t* rxbuffer, size_t rxsize,
+                      uint8_t* txbuffer, size_t txsize, uint32_t version, const char* description)
+            : proto_(proto), commands_(commands), decoder_(rxbuffer, rxsize), txbuffer_(txbuffer), txsize_(txsize),
+              version_(version), description_(description), serial_number_(0), on_reset_(nullptr), handler_code_(0),
+              handler_(nullptr), handler_context_(nullptr), retain_(nullptr), retain_slot_(0), retain_depth_(0),
+              retain_next_(0), sequenced_(false), seq_(0), request_crc_(0) {}
+
+        /** @brief called after the `r` reset code is acknowledged */
+        void onReset(void (*fn)()) { on_reset_ = fn; }
+
+        /** @brief USB serial number appended to the `q` reply. 0 leaves it out. */
+        void setSerialNumber(uint32_t serial_number) { serial_number_ = serial_number; }
+
+        /**
+         * @brief Hand frames of type code `code` to `fn` instead of NAKing them. Damaged frames
+         * go to it too, so it can answer for one of its own. One handler at a time; nullptr
+         * removes it.
+         */
+        void setFrameHandler(uint8_t code, frame_fn fn, void* context) {
+            handler_code_    = code;
+            handler_         = fn;
+            handler_context_ = context;
+        }
+
+        /**
+         * @brief Keep the last `depth` sequenced replies, so a request the host sends again
+         * because its reply went missing gets the same reply instead of running twice. Only on
+         * links with a CRC, which tells a request sent again from a new one that reuses its
+         * sequence number.
+         *
+         * @param buffer    room for the replies, split into depth slots of size / depth bytes.
+         *                  A reply longer than a slot less RETAIN_HEAD is not kept, and its
+         *                  request runs again if it is sent again.
+         * @param size      size of buffer
+         * @param depth     replies to keep, at least the host's window
+         */
+        void setRetainBuffer(uint8_t* buffer, size_t size, size_t depth) {
+            retain_       = buffer;
+            retain_depth_ = buffer && depth ? depth : 0;
+            retain_slot_  = retain_depth_ ? size / retain_depth_ : 0;
+            retain_next_  = 0;
+            if (retain_slot_ < RETAIN_HEAD)
+                retain_depth_ = 0;
+            for (size_t i = 0; i < retain_depth_; i++)
+                memset(retain_ + i * retain_slot_, 0, RETAIN_HEAD);
+        }
+
+        /** @brief per slot of the retain buffer: sequence number, request CRC and reply size */
+        static constexpr size_t RETAIN_HEAD = 1 + 2 + 2;
+
+        /**
+         * @brief Handle at most one received frame. Never blocks.
+         *
+         * @return ERROR_INCOMPLETE if no frame was ready, otherwise the dispatch result
+         */
+        error_t poll() {
+            error_t err = proto_.readSlipFrame(decoder_);
+            if (err == ERROR_INCOMPLETE)
+                return err;
+            if (err != NO_ERROR)
+                return reject(err);
+            return dispatch(decoder_.frame(), decoder_.frameSize(), decoder_.crcOk());
+        }
+
+        /**
+         * @brief NAK a frame that could not be read, e.g. one too large for the buffer.
+         *
+         * @param err   the read error
+         * @return err
+         */
+        error_t reject(error_t err) {
+            sequenced_ = false;
+            return damaged(err);
+        }
+
+        /**
+         * @brief Dispatch one decoded frame and write the reply.
+         *
+         * @param frame     decoded frame, starting with the type code
+         * @param size      frame size including any CRC
+         * @param crc_ok    CRC trailer is valid (see SlipDecoder::crcOk)
+         */
+        error_t dispatch(const uint8_t* frame, size_t size, bool crc_ok) {
+            sequenced_ = false;
+            if (size == 0)
+                return ERROR_ENCODING;
+            if (size == 1)
+                return dispatchCode(frame[0]);
+            if (proto_.use_crc_) {
+                if (!crc_ok || size < 3)
+                    return damaged(ERROR_ENCODING);
+                request_crc_ = static_cast<uint16_t>((frame[size - 2] << 8) | frame[size - 1]);
+                size -= 2;
+            }
+            if (handler_ && frame[0] == handler_code_)
+                return dispatchFrame(frame, size);
+            if (frame[0] == PROTO_SEQ) {
+                if (size < 3)
+                    return nak(ERROR_ENCODING);
+                sequenced_ = true;
+                seq_       = frame[1];
+                if (replay())
+                    return NO_ERROR;
+                frame += 2;
+                size -= 2;
+                if (size == 1)
+                    return dispatchCode(frame[0]);
+            }
+            if (frame[0] == PROTO_BATCH)
+                return dispatchBatch(frame + 1, size - 1);
+            return dispatchCommand(frame[0], frame + 1, size - 1);
+        }
+
+     protected:
+        /** @brief Look up the handler of a command and run it */
+        error_t execute(uint8_t type, uint32_t id, CborValue& params, CborEncoder& results) {
+            const command_t* cmd = commands_.find(id);
+            command_fn handler   = nullptr;
+            if (cmd)
+                handler = (type == PROTO_SET) ? cmd->set : (type == PROTO_GET) ? cmd->get : nullptr;
+            if (!handler)
+                return ERROR_COMMAND;
+            return handler(params, results);
+        }
+
+        error_t dispatchCommand(uint8_t type, const uint8_t* payload, size_t payload_size) {
+            CborSequenceReader seq(payload, payload_size);
+            CborParser parser;
+            CborValue it;
+            uint32_t id = 0;
+            if (seq.next(parser, it) != NO_ERROR || cborRead(it, id) != NO_ERROR)
+                return nak(ERROR_COMMAND);
+            seq.advance(it);
+            // parameters are the contents of the optional array that follows
+            CborParser params_parser;
+            CborValue array, params;
+            error_t err = seq.atEnd() ? cborEmptyArray(params_parser, array)
+                                      : cborCheck(cbor_parser_init(seq.pos(), seq.remaining(), 0, &params_parser, &array));
+            if (err != NO_ERROR || !cbor_value_is_array(&array) || cbor_value_enter_container(&array, &params) != CborNoError)
+                return nak(ERROR_COMMAND);
+
+            CborSequenceWriter reply(txbuffer_, txsize_);
+            cbor_encode_uint(&reply.next(), id);
+            reply.commit();
+            CborEncoder& outer = reply.next();
+            CborEncoder results;
+            cbor_encoder_create_array(&outer, &results, CborIndefiniteLength);
+            err = execute(type, id, params, results);
+            if (err != NO_ERROR)
+                return nak(err);
+            if (type == PROTO_SET)
+                return writeCode(PROTO_ACK);
+            cbor_encoder_close_container(&outer, &results);
+            reply.commit();
+            if (reply.overflow())
+                return nak(ERROR_BUFFER);
+            return writeReply(reply.size());
+        }
+
+        /** @brief Run the commands of a batch in order and ACK with the status of each */
+        error_t dispatchBatch(const uint8_t* payload, size_t payload_size) {
+            CborSequenceReader commands(payload, payload_size);
+            CborSequenceWriter reply(txbuffer_, txsize_);
+            while (!commands.atEnd() && reply.room() >= BATCH_STATUS_SIZE) {
+                CborParser parser;
+                CborValue item;
+                if (commands.next(parser, item) != NO_ERROR) {
+                    writeBatchStatus(reply, ERROR_COMMAND);
+                    break;
+                }
+                CborValue end = item;
+                if (cbor_value_advance(&end) != CborNoError) {
+                    writeBatchStatus(reply, ERROR_COMMAND); // the next command starts who knows where
+                    break;
+                }
+                commands.advance(end);
+                dispatchBatched(reply, item);
+            }
+            return writeReply(reply.size());
+        }
+
+        /** @brief Run one command of a batch and append its entry to the reply */
+        void dispatchBatched(CborSequenceWriter& reply, const CborValue& item) {
+            CborParser params_parser;
+            CborValue fields, array, params;
+            uint32_t type = 0, id = 0;
+            error_t err = ERROR_COMMAND;
+            if (cbor_value_is_array(&item) && cbor_value_enter_container(&item, &fields) == CborNoError)
+                err = cborReadArgs(fields, type, id);
+            if (err == NO_ERROR) {
+                if (cbor_value_at_end(&fields))
+                    err = cborEmptyArray(params_parser, array);
+                else
+                    array = fields;
+            }
+            if (err == NO_ERROR && (!cbor_value_is_array(&array) || cbor_value_enter_container(&array, &params) != CborNoError))
+                err = ERROR_COMMAND;
+            if (err == NO_ERROR) {
+                CborEncoder& outer = reply.next();
+                CborEncoder entry, results;
+                cbor_encoder_create_array(&outer, &entry, 3);
+                cbor_encode_int(&entry, NO_ERROR);
+                cbor_encode_uint(&entry, id);
+                cbor_encoder_create_array(&entry, &results, CborIndefiniteLength);
+                err = execute(type, id, params, results);
+                if (err == NO_ERROR && type == PROTO_GET) {
+                    cbor_encoder_close_container(&entry, &results);
+                    cbor_encoder_close_container(&outer, &entry);
+                    if (reply.commit())
+                        return;
+                    err = ERROR_BUFFER; // the query has no side effects, only its results are lost
+                }
+            }
+            writeBatchStatus(reply, err); // drops whatever a set or a failed query encoded
+        }
+
+        /** @brief status-only batch entry. Fits if BATCH_STATUS_SIZE bytes are free. */
+        void writeBatchStatus(CborSequenceWriter& reply, error_t err) {
+            CborEncoder& outer = reply.next();
+            CborEncoder entry;
+            cbor_encoder_create_array(&outer, &entry, 1);
+            cbor_encode_int(&entry, err);
+            cbor_encoder_close_container(&outer, &entry);
+            reply.commit();
+        }
+
+        error_t dispatchCode(uint8_t code) {
+            if (code == PROTO_QUERY) {
+                CborSequenceWriter reply(txbuffer_, txsize_);
+                cbor_encode_uint(&reply.next(), version_);
+                reply.commit();
+                cbor_encode_text_string(&reply.next(), description_, strlen(description_));
+                reply.commit();
+                if (serial_number_) {
+                    cbor_encode_uint(&reply.next(), serial_number_);
+                    reply.commit();
+                }
+                if (reply.overflow())
+                    return nak(ERROR_BUFFER);
+                return writeReply(reply.size());
+            } else if (code == PROTO_RESET) {
+                error_t err = writeCode(PROTO_ACK);
+                if (on_reset_)
+                    on_reset_();
+                return err;
+            }
+            return nak(ERROR_COMMAND);
+        }
+
+        /** @brief Pass a frame to the frame handler and write its reply */
+        error_t dispatchFrame(const uint8_t* frame, size_t size) {
+            size_t reply_size = txsize_;
+            error_t err       = handler_(handler_context_, frame, size, txbuffer_, reply_size);
+            if (reply_size > 0)
+                return proto_.writeSlipFrame(txbuffer_, reply_size) > 0 ? err : ERROR_STREAM;
+            return err != NO_ERROR ? nak(err) : NO_ERROR;
+        }
+
+        /** @brief NAK a damaged frame, unless the frame handler answers for it */
+        error_t damaged(error_t err) {
+            return handler_ ? dispatchFrame(nullptr, 0) : nak(err);
+        }
+
+        error_t writeReply(size_t size) {
+            uint8_t head[]{PROTO_SEQ, seq_, PROTO_ACK};
+            slice_t parts[]{{sequenced_ ? head : head + 2, sequenced_ ? 3u : 1u}, {txbuffer_, size}};
+            if (sequenced_)
+                retain(parts, 2);
+            return proto_.writeSlipFrame(parts, 2) > 0 ? NO_ERROR : ERROR_STREAM;
+        }
+
+        /** @brief bare ACK or NAK, never CRC'd unless it must carry a sequence number */
+        error_t writeCode(uint8_t code) {
+            if (sequenced_) {
+                uint8_t head[]{PROTO_SEQ, seq_, code};
+                slice_t part{head, 3};
+                retain(&part, 1);
+                return proto_.writeSlipFrame(head, 3) > 0 ? NO_ERROR : ERROR_STREAM;
+            }
+            return proto_.writeBareFrame(code) ? NO_ERROR : ERROR_STREAM;
+        }
+
+        error_t nak(error_t err) {
+            writeCode(PROTO_NAK);
+            return err;
+        }
+
+        /** @brief Keep the reply to the current sequenced request in place of the oldest */
+        void retain(const slice_t* parts, size_t nparts) {
+            if (!retain_depth_ || !proto_.use_crc_)
+                return;
+            uint8_t* slot = retain_ + retain_next_ * retain_slot_;
+            retain_next_  = (retain_next_ + 1) % retain_depth_;
+            size_t size   = 0;
+            for (size_t i = 0; i < nparts; i++)
+                size += parts[i].size;
+            if (size > retain_slot_ - RETAIN_HEAD || size > 0xFFFF) {
+                size = 0; // too long to keep
+            } else {
+                uint8_t* p = slot + RETAIN_HEAD;
+                for (size_t i = 0; i < nparts; i++) {
+                    memcpy(p, parts[i].data, parts[i].size);
+                    p += parts[i].size;
+                }
+            }
+            slot[0] = seq_;
+            slot[1] = static_cast<uint8_t>(request_crc_ >> 8);
+            slot[2] = static_cast<uint8_t>(request_crc_ & 0xff);
+            slot[3] = static_cast<uint8_t>(size >> 8);
+            slot[4] = static_cast<uint8_t>(size & 0xff);
+        }
+
+        /** @brief Answer a request sent again with the reply it got the first time */
+        bool replay() {
+            if (!proto_.use_crc_)
+                return false;
+            for (size_t i = 0; i < retain_depth_; i++) {
+                const uint8_t* slot = retain_ + i * retain_slot_;
+                size_t size         = (slot[3] << 8) | slot[4];
+                if (size && slot[0] == seq_ && ((slot[1] << 8) | slot[2]) == request_crc_) {
+                    proto_.writeSlipFrame(slot + RETAIN_HEAD, size);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        proto_t& proto_;
+        CommandTable commands_;
+        typename proto_t::decoder_t decoder_;
+        uint8_t* txbuffer_;
+        size_t txsize_;
+        uint32_t version_;
+        const char* description_;
+        uint32_t serial_number_;
+        void (*on_reset_)();
+        uint8_t handler_code_;
+        frame_fn handler_;
+        void* handler_context_;
+        uint8_t* retain_;      ///< recent sequenced replies, see setRetainBuffer
+        size_t retain_slot_;   ///< bytes per reply slot
+        size_t retain_depth_;
+        size_t retain_next_;   ///< slot the next reply replaces
+        bool sequenced_;       ///< current request came with a sequence number
+        uint8_t seq_;          ///< its sequence number
+        uint16_t request_crc_; ///< and its CRC
+    };
+
+}; // namespace
+
+#endif // #ifndef __SLIPCOMMAND_H__
@@ -0,0 +1,323 @@
+#pragma once
+
+#ifndef __SLIPPIPELINE_H__
+    #define __SLIPPIPELINE_H__
+
+    #include "slipcommand.h"
+
+namespace sproto {
+
+    /**
+     * @brief Host side of the sequenced protocol. Keeps up to `window` requests in flight and
+     * matches replies to requests by sequence number, in any order.
+     *
+     * Stop-and-wait costs a full round trip per command, which over USB full speed is at least
+     * one 1 ms frame each way. With several requests in flight the command rate is bounded by
+     * the link bandwidth instead.
+     *
+     * Never blocks. Call @ref poll until the reply to a request is @ref done, then read it with
+     * @ref result and free its slot with @ref release. Timeouts are up to the caller:
+     * @ref resend a request that took too long, or @ref release it and any late reply is
+     * dropped.
+     *
+     * Each slot keeps the encoded frame of its request, so a lost frame is repaired by sending
+     * that one request again, never by starting over. The device answers in order: @ref poll
+     * sends the oldest request still waiting again when a bare NAK says a frame arrived
+     * damaged, and any request still waiting when a reply to a later one arrives. A device that
+     * sends @ref MAX_NAKS bare NAKs in a row and no reply is not seeing damage but refusing
+     * sequenced frames, e.g. firmware that predates them, and the oldest request completes as
+     * a NAK.
+     *
+     * @tparam D            Derived protocol class, e.g. PosixSlipProtocol
+     * @tparam MAX_WINDOW   number of request slots
+     * @tparam REPLY_SIZE   largest reply payload kept per slot
+     * @tparam REQUEST_SIZE largest encoded request frame kept per slot. A longer one is sent
+     *                      but cannot be sent again.
+     */
+    template <class D, size_t MAX_WINDOW = 8, size_t REPLY_SIZE = 64, size_t REQUEST_SIZE = 64>
+    class CommandPipeline {
+     public:
+        typedef SlipProtocolBase<D, typename D::framing_t> proto_t;
+
+        static constexpr uint8_t MAX_NAKS = 4; ///< bare NAKs in a row that refuse a request
+
+        /**
+         * @param proto     protocol to send requests on
+         * @param rxbuffer  reply frame receive buffer
+         * @param rxsize    size of receive buffer
+         * @param window    requests allowed in flight, 1 is stop-and-wait
+         */
+        CommandPipeline(proto_t& proto, uint8_t* rxbuffer, size_t rxsize, size_t window = MAX_WINDOW)
+            : proto_(proto), decoder_(rxbuffer, rxsize), writer_(proto.use_crc_), inflight_(0), next_seq_(0),
+              sent_order_(0), resent_(0), naks_(0) {
+            setWindow(window);
+            for (size_t i = 0; i < MAX_WINDOW; i++)
+                slots_[i].state = SLOT_FREE;
+        }
+
+        size_t window() const { return window_; }
+        /** @brief Requests allowed in flight, clamped to 1..MAX_WINDOW */
+        void setWindow(size_t window) { window_ = window < 1 ? 1 : window > MAX_WINDOW ? MAX_WINDOW : window; }
+
+        /** @brief Requests sent and not yet answered */
+        size_t inFlight() const { return inflight_; }
+
+        /** @brief A new request can be submitted */
+        bool ready() const { return inflight_ < window_ && freeSlot() != nullptr; }
+
+        /**
+         * @brief Send a request with the next sequence number.
+         *
+         * @param type          PROTO_SET, PROTO_GET, or a single letter code such as PROTO_QUERY
+         * @param id            command id. Ignored for single letter codes.
+         * @param params        CBOR-encoded parameter array, may be nullptr
+         * @param params_size   size of params
+         * @param[out] seq      sequence number of the request
+         * @return
+         *  - NO_ERROR      request sent
+         *  - ERROR_BUFFER  window is full, poll and release first
+         *  - ERROR_STREAM  request could not be written
+         */
+        error_t submit(uint8_t type, uint32_t id, const uint8_t* params, size_t params_size, uint8_t& seq) {
+            slot_t* slot = freeSlot();
+            if (inflight_ >= window_ || !slot)
+                return ERROR_BUFFER;
+            seq = next_seq_++;
+            return send(slot, seq, [&](auto& proto) { return writeCommand(proto, seq, type, id, params, params_size); });
+        }
+
+        /**
+         * @brief Send a batch frame with the next sequence number. However many commands it
+         * holds, it takes one slot and gets one reply; read the status of each command from
+         * its @ref result with a BatchReplyReader. REPLY_SIZE must fit the whole reply.
+         *
+         * @return as @ref submit
+         */
+        error_t submitBatch(const CommandBatch& batch, uint8_t& seq) {
+            slot_t* slot = freeSlot();
+            if (inflight_ >= window_ || !slot)
+                return ERROR_BUFFER;
+            seq = next_seq_++;
+            return send(slot, seq, [&](auto& proto) { return writeBatch(proto, seq, batch); });
+        }
+
+        /** @brief Send a single letter code such as PROTO_QUERY */
+        error_t submitCode(uint8_t code, uint8_t& seq) {
+            return submit(code, 0, nullptr, 0, seq);
+        }
+
+        /**
+         * @brief Read at most one reply frame and match it to its request.
+         *
+         * @return ERROR_INCOMPLETE if no frame was ready, NO_ERROR otherwise. Frames that are
+         * damaged, unsequenced or answer a released request are dropped.
+         */
+        error_t poll() {
+            error_t err = proto_.readSlipFrame(decoder_);
+            if (err == ERROR_INCOMPLETE || err == ERROR_STREAM)
+                return err;
+            if (err != NO_ERROR)
+                return NO_ERROR;
+            const uint8_t* frame = decoder_.frame();
+            size_t size          = decoder_.frameSize();
+            if (size == 1 && frame[0] == PROTO_NAK) {
+                // in place of the reply to the oldest request waiting
+                slot_t* oldest = nullptr;
+                for (size_t i = 0; i < MAX_WINDOW; i++) {
+                    if (slots_[i].state == SLOT_SENT && (!oldest || before(slots_[i], *oldest)))
+                        oldest = &slots_[i];
+                }
+                if (oldest && ++naks_ >= MAX_NAKS) {
+                    naks_         = 0;
+                    oldest->code  = PROTO_NAK;
+                    oldest->size  = 0;
+                    oldest->state = SLOT_DONE;
+                    inflight_--;
+                } else if (oldest) {
+                    resend(*oldest);
+                }
+                return NO_ERROR;
+            }
+            if (proto_.use_crc_) {
+                if (!decoder_.crcOk() || size < 5)
+                    return NO_ERROR;
+                size -= 2;
+            }
+            if (size < 3 || frame[0] != PROTO_SEQ)
+                return NO_ERROR;
+            naks_ = 0;
+            slot_t* slot = find(frame[1], SLOT_SENT);
+            if (!slot)
+                return NO_ERROR;
+            // replies come in order, so those of requests sent before this one went missing
+            for (size_t i = 0; i < MAX_WINDOW; i++) {
+                if (slots_[i].state == SLOT_SENT && before(slots_[i], *slot))
+                    resend(slots_[i]);
+            }
+            size -= 3;
+            slot->code = frame[2];
+            slot->size = size;
+            if (size <= REPLY_SIZE)
+                memcpy(slot->reply, frame + 3, size);
+            slot->state = SLOT_DONE;
+            inflight_--;
+            return NO_ERROR;
+        }
+
+        /** @brief The reply to seq has arrived */
+        bool done(uint8_t seq) const {
+            return find(seq, SLOT_DONE) != nullptr;
+        }
+
+        /** @brief seq was sent and is still waiting for its reply */
+        bool pending(uint8_t seq) const {
+            return find(seq, SLOT_SENT) != nullptr;
+        }
+
+        /**
+         * @brief Outcome of a request.
+         *
+         * @param seq           sequence number from @ref submit
+         * @param[out] reply    CBOR reply payload after the ACK, valid until @ref release
+         * @param[out] size     size of reply
+         * @return
+         *  - NO_ERROR          ACK
+         *  - ERROR_COMMAND     NAK
+         *  - ERROR_BUFFER      ACK, but the reply did not fit in REPLY_SIZE
+         *  - ERROR_INCOMPLETE  no reply yet, or seq is unknown
+         */
+        error_t result(uint8_t seq, const uint8_t*& reply, size_t& size) const {
+            const slot_t* slot = find(seq, SLOT_DONE);
+            if (!slot)
+                return ERROR_INCOMPLETE;
+            reply = slot->reply;
+            size  = slot->size;
+            if (slot->code != PROTO_ACK)
+                return ERROR_COMMAND;
+            return slot->size <= REPLY_SIZE ? NO_ERROR : ERROR_BUFFER;
+        }
+
+        /**
+         * @brief Send a request still waiting for its reply again, e.g. after a timeout. The
+         * device answers it again without running it twice if it was run already.
+         *
+         * @return
+         *  - NO_ERROR          sent again
+         *  - ERROR_INCOMPLETE  seq is not waiting for a reply
+         *  - ERROR_BUFFER      the request was too long to keep
+         *  - ERROR_STREAM      the request could not be written
+         */
+        error_t resend(uint8_t seq) {
+            slot_t* slot = find(seq, SLOT_SENT);
+            return slot ? resend(*slot) : ERROR_INCOMPLETE;
+        }
+
+        /** @brief Requests sent more than once */
+        uint32_t resent() const { return resent_; }
+
+        /** @brief Free the slot of a request, answered or not */
+        void release(uint8_t seq) {
+            slot_t* slot = find(seq, SLOT_SENT);
+            if (slot) {
+                inflight_--;
+            } else {
+                slot = find(seq, SLOT_DONE);
+            }
+            if (slot)
+                slot->state = SLOT_FREE;
+        }
+
+     protected:
+        enum slot_state_t : uint8_t {
+            SLOT_FREE,
+            SLOT_SENT,
+            SLOT_DONE,
+        };
+
+        struct slot_t {
+            slot_state_t state;
+            uint8_t seq;
+            uint8_t code;        ///< PROTO_ACK or PROTO_NAK
+            size_t size;         ///< reply payload size
+            uint32_t order;      ///< when the request was last sent
+            size_t request_size; ///< encoded request frame size, 0 if it did not fit
+            uint8_t reply[REPLY_SIZE];
+            uint8_t request[REQUEST_SIZE];
+        };
+
+        /**
+         * @brief Encode a request into its slot, so it can be sent again, then send it and mark
+         * the slot sent.
+         *
+         * @param write     writes the request to the protocol it is given
+         */
+        template <class W>
+        error_t send(slot_t* slot, uint8_t seq, W write) {
+            writer_.begin(slot->request, REQUEST_SIZE);
+            slot->request_size = write(writer_) == NO_ERROR ? writer_.size() : 0;
+            error_t err;
+            if (slot->request_size)
+                err = proto_.writeEncodedFrame(slot->request, slot->request_size) ? NO_ERROR : ERROR_STREAM;
+            else
+                err = write(proto_); // too long to keep, send it as it is
+            if (err != NO_ERROR)
+                return err;
+            slot->state = SLOT_SENT;
+            slot->seq   = seq;
+            slot->order = sent_order_++;
+            inflight_++;
+            return NO_ERROR;
+        }
+
+        error_t resend(slot_t& slot) {
+            if (!slot.request_size)
+                return ERROR_BUFFER;
+            slot.order = sent_order_++; // replies to requests sent before now do not count it missing
+            resent_++;
+            return proto_.writeEncodedFrame(slot.request, slot.request_size) ? NO_ERROR : ERROR_STREAM;
+        }
+
+        /** @brief a was last sent before b */
+        static bool before(const slot_t& a, const slot_t& b) {
+            return static_cast<int32_t>(a.order - b.order) < 0;
+        }
+
+        slot_t* freeSlot() {
+            for (size_t i = 0; i < MAX_WINDOW; i++) {
+                if (slots_[i].state == SLOT_FREE)
+                    return &slots_[i];
+            }
+            return nullptr;
+        }
+
+        const slot_t* freeSlot() const {
+            return const_cast<CommandPipeline*>(this)->freeSlot();
+        }
+
+        slot_t* find(uint8_t seq, slot_state_t state) {
+            for (size_t i = 0; i < MAX_WINDOW; i++) {
+                if (slots_[i].state == state && slots_[i].seq == seq)
+                    return &slots_[i];
+            }
+            return nullptr;
+        }
+
+        const slot_t* find(uint8_t seq, slot_state_t state) const {
+            return const_cast<CommandPipeline*>(this)->find(seq, state);
+        }
+
+        proto_t& proto_;
+        typename proto_t::decoder_t decoder_;
+        FrameWriter<typename D::framing_t> writer_; ///< encodes requests into their slots
+        slot_t slots_[MAX_WINDOW];
+        size_t window_;   ///< requests allowed in flight
+        size_t inflight_; ///< requests in SLOT_SENT
+        uint8_t next_seq_;
+        uint32_t sent_order_; ///< counts requests sent, again or not
+        uint32_t resent_;
+        uint8_t naks_; ///< bare NAKs since the last sequenced reply
+    };
+
+}; // namespace
+
+#endif // #ifndef __SLIPPIPELINE_H__
@@ -5,14 +5,42 @@
     #include <cassert>
     #include <cbor.h>
     #include <cctype>
+    #include <cstring>
     #include <compilersupport_p.h> // cbor_htons etc
 
+    #ifndef SLIP_TX_BUFFER_SIZE
+        #define SLIP_TX_BUFFER_SIZE 64 ///< internal frame encoding buffer. One USB full-speed packet.
+    #endif
+
+    // Fast scan for the END/ESC bytes. Define SLIP_SCALAR_SCAN to force the byte-at-a-time loop.
+    #if !defined(SLIP_SCALAR_SCAN) && defined(__GNUC__)
+        #if defined(__SSE2__)
+            #include <immintrin.h>
+            #define SLIP_SCAN_SSE2 1
+            #define SLIP_SCAN_NAME "sse2"
+        #elif defined(__ARM_NEON) && defined(__aarch64__)
+            #include <arm_neon.h>
+            #define SLIP_SCAN_NEON 1
+            #define SLIP_SCAN_NAME "neon"
+        #elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            #define SLIP_SCAN_SWAR 1
+            #define SLIP_SCAN_NAME "swar"
+        #endif
+    #endif
+    #ifndef SLIP_SCAN_NAME
+        #define SLIP_SCAN_NAME "scalar"
+    #endif
+
 /**
  * @page slipprot
  * SLIP encoded serial protocol
  * ============================
  *
- * Note 16-bit CRC is encoded in network byte order (big endian)
+ * Note 16-bit CRC is encoded in network byte order (big endian). The CRC covers every
+ * un-escaped byte of the frame before it, including the single letter code.
+ *
+ * END and ESC are the RFC 1055 bytes 0xC0 and 0xDB, escaped as ESC 0xDC and ESC 0xDD. A link
+ * can pick other bytes at compile time, see SlipFraming.
  *
  * Standard command/request format:
  * @code
@@ -67,20 +95,161 @@
  *	SLIP-escaped frame containing
  *		CBOR-encoded device version
  *		CBOR-encoded device description
+ *		CBOR-encoded USB serial number, if the device has one
  *		16-bit CRC CCITT/KERMIT format of non-escaped frame
  *	SLIP_END
  * @endcode
  *
+ * Sequenced (pipelined) frames
+ * @code
+ *	Single letter: @ for sequence
+ *	Sequence number, one raw byte
+ *	Any request frame above, or its reply, without its own SLIP_END
+ *	16-bit CRC CCITT/KERMIT format of non-escaped frame
+ *	SLIP_END
+ * @endcode
+ * |seq|number|request or reply|crc-16|end|
+ * |---|------|----------------|---|---|
+ * | @ |0-255 |! ? q r + - ... |HI LO|END|
+ *
+ * A request sent with a sequence number is answered with the same sequence number, so the
+ * host may keep several requests in flight and match replies in any order. Sequenced
+ * replies are always full frames, so even a bare ACK or NAK carries the CRC. A frame that
+ * fails its CRC cannot be trusted to name its sequence number and is answered with a bare
+ * NAK.
+ *
+ * Requests are answered in the order they arrive, so a lost frame costs only itself to
+ * repair. A bare NAK stands in for the reply to the oldest request still waiting, which the
+ * host sends again. A reply that overtakes an older request's means that request or its
+ * reply was lost, and the host sends it again too. The device keeps its last few sequenced
+ * replies: a request that arrives again with the same sequence number and CRC is answered
+ * with the same reply, and not run twice.
+ *
+ * Batched frames
+ * @code
+ *	Single letter: * for batch
+ *	CBOR sequence (RFC 8742) of commands, one CBOR array each
+ *	16-bit CRC CCITT/KERMIT format of non-escaped frame
+ *	SLIP_END
+ * @endcode
+ * |>batch|commands|crc-16|end|
+ * |------|--------|---|---|
+ * |  *   |[! / ?, id, params] ...|HI LO|END|
+ *
+ * Several commands share one type code, CRC, END and, usually, one USB packet. They are run
+ * in order and answered by a single ACK that holds the status of each (see @ref slipcommand).
+ * A batch may itself be sent with a sequence number.
+ *
+ * Bulk frames
+ * @code
+ *	Single letter: $ for bulk
+ *	Single letter subcode: o open, d data, c credit, r resend, x abort
+ *	CBOR-encoded fields, then the raw bytes of a data chunk
+ *	16-bit CRC CCITT/KERMIT format of non-escaped frame
+ *	SLIP_END
+ * @endcode
+ * |bulk|subcode|fields, chunk|crc-16|end|
+ * |----|-------|-------------|---|---|
+ * |  $ |o d c r x|transfer ... bytes|HI LO|END|
+ *
+ * Blobs too large for one frame go as numbered chunks under credit based flow control, and
+ * need no ACK each (see @ref slipbulk).
+ *
  */
 
 namespace sproto {
-    // for now, we are using human-readable escape and end characters rather than the SLIP default
-    // for debugging
-    constexpr uint8_t SLIP_END = '#';  //= 0300;   //** 0xC0   End of packet;
-    constexpr uint8_t SLIP_ESC = '\\'; // = 0333;     //** 0xDB   Escape character
+    /** @brief 256-entry lookup tables for one set of SLIP framing bytes */
+    struct slip_table_t {
+        uint8_t special[256];  ///< 1 for END and ESC, 0 for bytes sent as is
+        uint8_t escape[256];   ///< code sent after ESC in place of each special byte
+        int16_t unescape[256]; ///< byte that each code after ESC stands for, -1 if not a valid code
+    };
+
+    constexpr slip_table_t makeSlipTable(uint8_t end, uint8_t esc, uint8_t esc_end, uint8_t esc_esc) {
+        slip_table_t table{};
+        for (unsigned i = 0; i < 256; i++) {
+            table.special[i]  = (i == end || i == esc) ? 1 : 0;
+            table.escape[i]   = static_cast<uint8_t>(i);
+            table.unescape[i] = -1;
+        }
+        table.escape[end]       = esc_end;
+        table.escape[esc]       = esc_esc;
+        table.unescape[esc_end] = end;
+        table.unescape[esc_esc] = esc;
+        return table;
+    }
+
+    template <class F>
+    class SlipEncoder;
+
+    template <class F>
+    class BasicSlipDecoder;
+
+    /**
+     * @brief SLIP framing bytes, fixed at compile time.
+     *
+     * Passed as the F parameter of SlipProtocolBase, SlipDecoder, ProtoPacket and the escape
+     * helpers. Each framing builds its own lookup table at compile time, so testing a byte is
+     * one load instead of a compare per special byte. Both ends of a link must use the same one.
+     *
+     * A framing names the encoder and decoder SlipProtocolBase uses for whole frames, so other
+     * framings, such as CobsFraming, can take its place.
+     *
+     * @tparam END_     frame terminator
+     * @tparam ESC_     escape character
+     * @tparam ESC_END_ code following ESC that stands for END in the payload
+     * @tparam ESC_ESC_ code following ESC that stands for ESC in the payload
+     */
+    template <uint8_t END_, uint8_t ESC_, uint8_t ESC_END_, uint8_t ESC_ESC_>
+    struct SlipFraming {
+        static_assert(END_ != ESC_, "END and ESC must differ");
+        static_assert(ESC_END_ != ESC_ESC_ && ESC_END_ != END_ && ESC_ESC_ != END_, "escape codes must differ from each other and END");
+
+        static constexpr uint8_t END        = END_;
+        static constexpr uint8_t ESC        = ESC_;
+        static constexpr uint8_t ESC_END    = ESC_END_;
+        static constexpr uint8_t ESC_ESC    = ESC_ESC_;
+        static constexpr slip_table_t table = makeSlipTable(END_, ESC_, ESC_END_, ESC_ESC_);
+
+        typedef SlipEncoder<SlipFraming> encoder_t;      ///< writes a frame
+        typedef BasicSlipDecoder<SlipFraming> decoder_t; ///< reads frames
+
+        /** @brief c is END or ESC and must be escaped in a payload */
+        static bool special(uint8_t c) { return table.special[c]; }
+
+        /** @brief Longest frame for n payload bytes: every byte escaped, plus CRC and END */
+        static constexpr size_t maxFrameSize(size_t n) { return 2 * (n + 2) + 1; }
+    };
 
-    constexpr uint8_t SLIP_ESC_END[]{SLIP_ESC, 'X'};
-    constexpr uint8_t SLIP_ESC_ESC[]{SLIP_ESC, 'E'};
+    template <uint8_t END_, uint8_t ESC_, uint8_t ESC_END_, uint8_t ESC_ESC_>
+    constexpr uint8_t SlipFraming<END_, ESC_, ESC_END_, ESC_ESC_>::END;
+    template <uint8_t END_, uint8_t ESC_, uint8_t ESC_END_, uint8_t ESC_ESC_>
+    constexpr uint8_t SlipFraming<END_, ESC_, ESC_END_, ESC_ESC_>::ESC;
+    template <uint8_t END_, uint8_t ESC_, uint8_t ESC_END_, uint8_t ESC_ESC_>
+    constexpr uint8_t SlipFraming<END_, ESC_, ESC_END_, ESC_ESC_>::ESC_END;
+    template <uint8_t END_, uint8_t ESC_, uint8_t ESC_END_, uint8_t ESC_ESC_>
+    constexpr uint8_t SlipFraming<END_, ESC_, ESC_END_, ESC_ESC_>::ESC_ESC;
+    template <uint8_t END_, uint8_t ESC_, uint8_t ESC_END_, uint8_t ESC_ESC_>
+    constexpr slip_table_t SlipFraming<END_, ESC_, ESC_END_, ESC_ESC_>::table;
+
+    /** @brief Standard RFC 1055 bytes: END 0xC0, ESC 0xDB, ESC_END 0xDC, ESC_ESC 0xDD */
+    typedef SlipFraming<0xC0, 0xDB, 0xDC, 0xDD> SlipRfc1055;
+
+    /**
+     * @brief Printable bytes for reading a link in a terminal: END '#', ESC '\\', ESC_END 'X',
+     * ESC_ESC 'E'. Both are common in text and CBOR strings, so escaping costs more.
+     */
+    typedef SlipFraming<'#', '\\', 'X', 'E'> SlipDebugFraming;
+
+    // framing used when none is named. Define SLIP_DEBUG_FRAMING on both ends of the link.
+    #ifdef SLIP_DEBUG_FRAMING
+    typedef SlipDebugFraming SlipDefaultFraming;
+    #else
+    typedef SlipRfc1055 SlipDefaultFraming;
+    #endif
+
+    constexpr uint8_t SLIP_END = SlipDefaultFraming::END; ///< END of the default framing
+    constexpr uint8_t SLIP_ESC = SlipDefaultFraming::ESC; ///< ESC of the default framing
 
     constexpr uint8_t PROTO_SET   = '!';
     constexpr uint8_t PROTO_GET   = '?';
@@ -88,14 +257,548 @@ namespace sproto {
     constexpr uint8_t PROTO_NAK   = '-';
     constexpr uint8_t PROTO_QUERY = 'q';
     constexpr uint8_t PROTO_RESET = 'r';
+    constexpr uint8_t PROTO_SEQ   = '@';
+    constexpr uint8_t PROTO_BATCH = '*';
+    constexpr uint8_t PROTO_BULK  = '$';
 
     typedef int error_t;
 
-    constexpr error_t NO_ERROR       = 0;  ///< no error
-    constexpr error_t ERROR_TIMEOUT  = -1; ///< stream timeout error
-    constexpr error_t ERROR_BUFFER   = -2; ///< stream buffer error
-    constexpr error_t ERROR_STREAM   = -3; ///< stream not ready error
-    constexpr error_t ERROR_ENCODING = -4; ///< Protocol misread/miswrite error
+    constexpr error_t NO_ERROR         = 0;  ///< no error
+    constexpr error_t ERROR_TIMEOUT    = -1; ///< stream timeout error
+    constexpr error_t ERROR_BUFFER     = -2; ///< stream buffer error
+    constexpr error_t ERROR_STREAM     = -3; ///< stream not ready error
+    constexpr error_t ERROR_ENCODING   = -4; ///< Protocol misread/miswrite error
+    constexpr error_t ERROR_INCOMPLETE = -5; ///< frame not yet complete, call again with more input
+
+    /**
+     * @brief When should the protocol call writeNow() on its own?
+     */
+    enum flush_policy_t {
+        FLUSH_NONE,   ///< never. Caller decides when to call writeNow()
+        FLUSH_FRAME,  ///< after every complete frame
+        FLUSH_ALWAYS, ///< after every write to the stream
+    };
+
+    /**
+     * @brief Piece of a frame for gathered writes
+     */
+    struct slice_t {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    /**
+     * @brief Reference byte-at-a-time scan for the next END or ESC of framing F.
+     */
+    template <class F = SlipDefaultFraming>
+    inline const uint8_t* slipFindSpecialScalar(const uint8_t* p, const uint8_t* end) {
+        while (p < end && !F::special(*p))
+            p++;
+        return p;
+    }
+
+    /**
+     * @brief Find the next END or ESC of framing F, testing several bytes at once.
+     *
+     * Most payloads contain no bytes that need escaping, so the escaper and decoder jump
+     * straight from one special byte to the next and move the plain runs in between as a
+     * block. Uses AVX2/SSE2 or NEON on the host and 32-bit SWAR words on the Cortex-M7.
+     * The tail, and any build with SLIP_SCALAR_SCAN, falls back to the scalar loop.
+     *
+     * @return pointer to the first special byte, or end if there is none
+     */
+    template <class F = SlipDefaultFraming>
+    inline const uint8_t* slipFindSpecial(const uint8_t* p, const uint8_t* end) {
+        // back to back escapes are common in binary data. Don't pay for a vector load.
+        if (p < end && F::special(*p))
+            return p;
+    #if defined(SLIP_SCAN_SSE2)
+        #if defined(__AVX2__)
+        const __m256i vend32 = _mm256_set1_epi8(static_cast<char>(F::END));
+        const __m256i vesc32 = _mm256_set1_epi8(static_cast<char>(F::ESC));
+        while (end - p >= 32) {
+            __m256i v     = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, vend32), _mm256_cmpeq_epi8(v, vesc32))));
+            if (mask)
+                return p + __builtin_ctz(mask);
+            p += 32;
+        }
+        #endif
+        const __m128i vend = _mm_set1_epi8(static_cast<char>(F::END));
+        const __m128i vesc = _mm_set1_epi8(static_cast<char>(F::ESC));
+        while (end - p >= 16) {
+            __m128i v     = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_or_si128(_mm_cmpeq_epi8(v, vend), _mm_cmpeq_epi8(v, vesc))));
+            if (mask)
+                return p + __builtin_ctz(mask);
+            p += 16;
+        }
+    #elif defined(SLIP_SCAN_NEON)
+        const uint8x16_t vend = vdupq_n_u8(F::END);
+        const uint8x16_t vesc = vdupq_n_u8(F::ESC);
+        while (end - p >= 16) {
+            uint8x16_t v = vld1q_u8(p);
+            uint8x16_t m = vorrq_u8(vceqq_u8(v, vend), vceqq_u8(v, vesc));
+            // narrow each byte flag to a nibble so the mask fits in 64 bits
+            uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+            if (bits)
+                return p + (__builtin_ctzll(bits) >> 2);
+            p += 16;
+        }
+    #elif defined(SLIP_SCAN_SWAR)
+        typedef uintptr_t word_t; // 4 bytes on the Cortex-M7, 8 on 64-bit hosts
+        const word_t ones  = ~static_cast<word_t>(0) / 0xff;
+        const word_t highs = ones * 0x80;
+        const word_t wend  = ones * F::END;
+        const word_t wesc  = ones * F::ESC;
+        while (static_cast<size_t>(end - p) >= sizeof(word_t)) {
+            word_t w;
+            ::memcpy(&w, p, sizeof(word_t)); // unaligned load
+            word_t a = w ^ wend;
+            word_t b = w ^ wesc;
+            // high bit set in each zero byte. Borrows can only flag bytes above a real
+            // match, so the lowest flagged byte is always exact.
+            word_t hit = (((a - ones) & ~a) | ((b - ones) & ~b)) & highs;
+            if (hit)
+                return p + (__builtin_ctzll(static_cast<unsigned long long>(hit)) >> 3);
+            p += sizeof(word_t);
+        }
+    #endif
+        return slipFindSpecialScalar<F>(p, end);
+    }
+
+    /**
+     * @brief SLIP escape as much of a source buffer as fits in a destination buffer.
+     * An escape pair is never split across calls.
+     *
+     * @param[in,out] src   start of bytes to escape. Advanced past the bytes consumed.
+     * @param src_end       end of bytes to escape
+     * @param dst           destination for escaped bytes
+     * @param dst_size      room in destination
+     * @return number of escaped bytes written to dst
+     */
+    template <class F = SlipDefaultFraming>
+    inline size_t slipEscape(const uint8_t*& src, const uint8_t* src_end, uint8_t* dst, size_t dst_size) {
+        uint8_t* out           = dst;
+        const uint8_t* out_end = dst + dst_size;
+        const uint8_t* p       = src;
+        while (p < src_end && out < out_end) {
+            // copy the plain run up to the next special byte. Never scan past what fits.
+            size_t room            = out_end - out;
+            const uint8_t* limit   = (static_cast<size_t>(src_end - p) > room) ? p + room : src_end;
+            const uint8_t* special = slipFindSpecial<F>(p, limit);
+            size_t run             = special - p;
+            ::memcpy(out, p, run);
+            out += run;
+            p += run;
+            if (p == limit)
+                continue;
+            if (out_end - out < 2)
+                break;
+            out[0] = F::ESC;
+            out[1] = F::table.escape[*p];
+            out += 2;
+            p++;
+        }
+        src = p;
+        return out - dst;
+    }
+
+    /** @brief 256-entry lookup table for the reflected CRC16/KERMIT polynomial 0x8408 */
+    struct crc_kermit_table_t {
+        uint16_t entry[256];
+    };
+
+    constexpr crc_kermit_table_t makeCrcKermitTable() {
+        crc_kermit_table_t table{};
+        for (unsigned i = 0; i < 256; i++) {
+            uint16_t crc = static_cast<uint16_t>(i);
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 1) ? static_cast<uint16_t>((crc >> 1) ^ 0x8408) : static_cast<uint16_t>(crc >> 1);
+            table.entry[i] = crc;
+        }
+        return table;
+    }
+
+    /** @brief Holder so the table can be defined in a header. Built at compile time. */
+    template <class T = void>
+    struct CrcKermit {
+        static constexpr crc_kermit_table_t table = makeCrcKermitTable();
+
+        /** @brief Add one byte to a running KERMIT CRC. Same result as FastCRC16::kermit_upd. */
+        static uint16_t update(uint16_t crc, uint8_t c) {
+            return (crc >> 8) ^ table.entry[(crc ^ c) & 0xff];
+        }
+    };
+
+    template <class T>
+    constexpr crc_kermit_table_t CrcKermit<T>::table;
+
+    /**
+     * @brief Fused SLIP escape and CRC16/KERMIT update. Same as slipEscape, but every source
+     * byte consumed is also added to the running CRC in the same loop, so the payload is
+     * only read once.
+     *
+     * @param[in,out] src   start of bytes to escape. Advanced past the bytes consumed.
+     * @param src_end       end of bytes to escape
+     * @param dst           destination for escaped bytes
+     * @param dst_size      room in destination
+     * @param[in,out] crc   running KERMIT CRC. Start a new frame with 0.
+     * @return number of escaped bytes written to dst
+     */
+    template <class F = SlipDefaultFraming>
+    inline size_t slipEscapeKermit(const uint8_t*& src, const uint8_t* src_end, uint8_t* dst, size_t dst_size, uint16_t& crc) {
+        uint8_t* out           = dst;
+        const uint8_t* out_end = dst + dst_size;
+        const uint8_t* p       = src;
+        uint16_t c16           = crc;
+        while (p < src_end && out < out_end) {
+            size_t room            = out_end - out;
+            const uint8_t* limit   = (static_cast<size_t>(src_end - p) > room) ? p + room : src_end;
+            const uint8_t* special = slipFindSpecial<F>(p, limit);
+            // copy and CRC the plain run in one loop
+            while (p < special) {
+                uint8_t c = *p++;
+                *out++    = c;
+                c16       = CrcKermit<>::update(c16, c);
+            }
+            if (p == limit)
+                continue;
+            if (out_end - out < 2)
+                break;
+            uint8_t c = *p++;
+            out[0]    = F::ESC;
+            out[1]    = F::table.escape[c];
+            out += 2;
+            c16 = CrcKermit<>::update(c16, c);
+        }
+        crc = c16;
+        src = p;
+        return out - dst;
+    }
+
+    /**
+     * @brief Writes the SLIP frame of a gathered payload a piece at a time: escaped payload,
+     * escaped CRC and END. Lets a frame of any size go out through a small scratch buffer.
+     *
+     * @tparam F SLIP framing bytes
+     */
+    template <class F>
+    class SlipEncoder {
+     public:
+        /**
+         * @param parts     payload pieces, sent back to back as one frame
+         * @param nparts    number of payload pieces
+         * @param use_crc   append the KERMIT CRC of the payload
+         */
+        SlipEncoder(const slice_t* parts, size_t nparts, bool use_crc)
+            : parts_(parts), nparts_(nparts), part_(0), src_(nparts ? parts[0].data : nullptr),
+              crc_(0), ntrailer_(0), sent_(0), use_crc_(use_crc) {}
+
+        /**
+         * @brief Encode as much of the rest of the frame as fits. Escape pairs in the payload
+         * are never split, so at least 2 bytes of room are needed to make progress.
+         *
+         * @return number of bytes written to dst
+         */
+        size_t encode(uint8_t* dst, size_t size) {
+            uint8_t* out           = dst;
+            const uint8_t* out_end = dst + size;
+            while (part_ < nparts_) {
+                const uint8_t* src_end = parts_[part_].data + parts_[part_].size;
+                if (use_crc_)
+                    out += slipEscapeKermit<F>(src_, src_end, out, out_end - out, crc_);
+                else
+                    out += slipEscape<F>(src_, src_end, out, out_end - out);
+                if (src_ < src_end)
+                    return out - dst; // out of room
+                if (++part_ < nparts_)
+                    src_ = parts_[part_].data;
+            }
+            if (ntrailer_ == 0)
+                makeTrailer();
+            while (sent_ < ntrailer_ && out < out_end)
+                *out++ = trailer_[sent_++];
+            return out - dst;
+        }
+
+        /** @brief The whole frame, END included, has been encoded */
+        bool done() const { return ntrailer_ > 0 && sent_ == ntrailer_; }
+
+     protected:
+        void makeTrailer() {
+            if (use_crc_) {
+                uint8_t crcbytes[2]{static_cast<uint8_t>(crc_ >> 8), static_cast<uint8_t>(crc_ & 0xff)};
+                const uint8_t* src = crcbytes;
+                ntrailer_          = slipEscape<F>(src, crcbytes + 2, trailer_, 4);
+            }
+            trailer_[ntrailer_++] = F::END;
+        }
+
+        const slice_t* parts_;
+        size_t nparts_;
+        size_t part_;        ///< piece being encoded
+        const uint8_t* src_; ///< next byte of that piece
+        uint16_t crc_;       ///< running KERMIT CRC of the payload
+        uint8_t trailer_[5]; ///< escaped CRC and END
+        size_t ntrailer_;    ///< trailer size, 0 until the payload is done
+        size_t sent_;        ///< trailer bytes already encoded
+        bool use_crc_;
+    };
+
+    /**
+     * @brief Resumable, non-blocking frame decoder. Framing specific decoders derive from it.
+     *
+     * Decodes raw stream bytes into a caller supplied frame buffer a chunk at a time. Framing
+     * state is kept between calls, so a frame may be split anywhere, even inside an escape
+     * sequence.
+     *
+     * Raw bytes can be fed two ways:
+     * - @ref decode copies from an external chunk (ring buffer, USB packet, etc.)
+     * - @ref rxbegin / @ref commit decode in place. The caller reads raw bytes straight into the
+     *   free space at the end of the frame buffer. Decoding never outgrows its input, so the
+     *   frame is decoded on top of the raw bytes without a second buffer.
+     *
+     * After a complete frame is reported, @ref frame and @ref frameSize describe it until the next
+     * call. Raw bytes that followed the END are carried over to the next frame. Frames must be
+     * shorter than the buffer, leaving room for at least one raw byte.
+     *
+     * The KERMIT CRC is checked while decoding. Each decoded byte enters a two byte delay line
+     * and only reaches the CRC once two more bytes follow it, so when END arrives the delay
+     * line holds the big endian CRC trailer and the running CRC covers everything before it.
+     * Frames without a CRC (bare ACK/NAK) simply ignore @ref crcOk.
+     *
+     * @tparam D Derived decoder, implementing decodeRun_impl() and clearState_impl()
+     */
+    template <class D>
+    class FrameDecoder {
+        D& derived() { return *static_cast<D*>(this); }
+
+     public:
+        FrameDecoder(uint8_t* buffer, size_t size)
+            : head_(buffer), tail_(buffer), end_(buffer + size), raw_(buffer), nraw_(0),
+              crc_(0), trailer_(0), overflow_(false), misread_(false), done_(false) {}
+
+        /**
+         * @brief Decode a chunk of raw bytes. Stops after the first complete frame.
+         *
+         * @param src       raw encoded bytes
+         * @param size      number of raw bytes
+         * @param[out] nused number of raw bytes consumed. Less than size if a frame completed early.
+         * @return
+         *  - ERROR_INCOMPLETE all bytes consumed, no END yet
+         *  - ERROR_BUFFER  frame was larger than the buffer and was dropped
+         *  - ERROR_ENCODING stream was improperly encoded
+         *  - NO_ERROR      frame complete
+         */
+        error_t decode(const uint8_t* src, size_t size, size_t& nused) {
+            restart();
+            return derived().decodeRun_impl(src, size, nused);
+        }
+
+        /**
+         * @brief Free space for reading raw bytes in place. Starts a new frame if the
+         * previous one was already reported.
+         */
+        uint8_t* rxbegin() {
+            restart();
+            if (nraw_ == 0)
+                raw_ = tail_; // everything past the decoded bytes is free
+            return raw_ + nraw_;
+        }
+
+        /** @brief Size of the free space at @ref rxbegin */
+        size_t rxsize() {
+            return end_ - rxbegin();
+        }
+
+        /**
+         * @brief Decode raw bytes that were placed at @ref rxbegin, along with any bytes
+         * carried over from the last frame. Call with nraw = 0 to drain carried bytes.
+         *
+         * @return same as @ref decode
+         */
+        error_t commit(size_t nraw) {
+            restart();
+            nraw_ += nraw;
+            size_t nused = 0;
+            error_t err  = derived().decodeRun_impl(raw_, nraw_, nused);
+            raw_ += nused;
+            nraw_ -= nused;
+            if (err == ERROR_INCOMPLETE && tail_ == end_) {
+                // no room left to receive the terminator
+                overflow_ = true;
+                tail_     = head_;
+            }
+            return err;
+        }
+
+        /** @brief Raw bytes are buffered past the last reported frame */
+        bool pending() const { return nraw_ > 0; }
+
+        uint8_t* frame() const { return head_; }
+        size_t frameSize() const { return tail_ - head_; }
+
+        /** @brief Size of the frame without its CRC16 trailer */
+        size_t payloadSize() const { return frameSize() < 2 ? 0 : frameSize() - 2; }
+
+        /** @brief The last two bytes of the frame are a valid KERMIT CRC of the payload */
+        bool crcOk() const { return frameSize() >= 2 && crc_ == trailer_; }
+
+        /** @brief Drop any partial frame and carried bytes */
+        void reset() {
+            tail_ = raw_ = head_;
+            nraw_        = 0;
+            crc_ = trailer_ = 0;
+            overflow_ = misread_ = done_ = false;
+            derived().clearState_impl();
+        }
+
+     protected:
+        void restart() {
+            if (!done_)
+                return;
+            tail_ = head_;
+            crc_ = trailer_ = 0;
+            overflow_ = misread_ = done_ = false;
+            derived().clearState_impl();
+            if (nraw_ > 0 && raw_ != head_)
+                ::memmove(head_, raw_, nraw_);
+            raw_ = head_;
+        }
+
+        void put(uint8_t c) {
+            if (tail_ == end_) {
+                overflow_ = true;
+                tail_     = head_;
+            }
+            if (overflow_)
+                return;
+            if (tail_ - head_ >= 2)
+                crc_ = CrcKermit<>::update(crc_, static_cast<uint8_t>(trailer_ >> 8));
+            trailer_ = static_cast<uint16_t>((trailer_ << 8) | c);
+            *tail_++ = c;
+        }
+
+        /** @brief append a run of plain bytes. The run may overlap the free space (in place mode). */
+        void putRun(const uint8_t* run, size_t n) {
+            if (overflow_ || n == 0)
+                return;
+            if (n > static_cast<size_t>(end_ - tail_)) {
+                overflow_ = true;
+                tail_     = head_;
+                return;
+            }
+            uint8_t* start = tail_;
+            if (start != run)
+                ::memmove(start, run, n);
+            tail_ += n;
+            // bytes pushed out of the two byte delay line enter the CRC
+            const uint8_t* q    = (start - head_ >= 2) ? start - 2 : head_;
+            const uint8_t* qend = (tail_ - head_ >= 2) ? tail_ - 2 : head_;
+            uint16_t c16        = crc_;
+            while (q < qend)
+                c16 = CrcKermit<>::update(c16, *q++);
+            crc_     = c16;
+            trailer_ = (tail_ - head_ >= 2) ? static_cast<uint16_t>((tail_[-2] << 8) | tail_[-1])
+                                            : static_cast<uint16_t>((trailer_ << 8) | tail_[-1]);
+        }
+
+        /**
+         * @brief END seen. Report the frame, or skip it if empty.
+         *
+         * @return true if a frame was reported, with its result in err
+         */
+        bool finish(error_t& err) {
+            if (tail_ == head_ && !overflow_ && !misread_)
+                return false; // skip empty frames between back to back ENDs
+            done_ = true;
+            if (overflow_) {
+                tail_ = head_;
+                err   = ERROR_BUFFER;
+            } else {
+                err = misread_ ? ERROR_ENCODING : NO_ERROR;
+            }
+            return true;
+        }
+
+        uint8_t* head_;       ///< absolute start of frame buffer
+        uint8_t* tail_;       ///< next decoded byte goes here
+        uint8_t* end_;        ///< absolute end of frame buffer
+        uint8_t* raw_;        ///< first raw byte not yet decoded (in place mode)
+        size_t nraw_;         ///< number of raw bytes not yet decoded (in place mode)
+        uint16_t crc_;        ///< running KERMIT CRC of all but the last two decoded bytes
+        uint16_t trailer_;    ///< last two decoded bytes, big endian
+        bool overflow_;       ///< frame outgrew the buffer, discarding until END
+        bool misread_;        ///< bad encoding seen in this frame
+        bool done_;           ///< frame reported, restart on next call
+    };
+
+    /**
+     * @brief Resumable, non-blocking SLIP decoder. Every raw byte is examined exactly once.
+     * See FrameDecoder for how to feed it.
+     *
+     * @tparam F SLIP framing bytes, e.g. SlipRfc1055
+     */
+    template <class F = SlipDefaultFraming>
+    class BasicSlipDecoder : public FrameDecoder<BasicSlipDecoder<F>> {
+        typedef FrameDecoder<BasicSlipDecoder<F>> base_t;
+        friend base_t;
+
+     public:
+        BasicSlipDecoder(uint8_t* buffer, size_t size)
+            : base_t(buffer, size), escaped_(false) {}
+
+     protected:
+        void clearState_impl() { escaped_ = false; }
+
+        error_t decodeRun_impl(const uint8_t* src, size_t size, size_t& nused) {
+            const uint8_t* p    = src;
+            const uint8_t* pend = src + size;
+            while (p < pend) {
+                if (!escaped_) {
+                    const uint8_t* special = slipFindSpecial<F>(p, pend);
+                    if (special != p) {
+                        this->putRun(p, special - p);
+                        p = special;
+                        if (p == pend)
+                            break;
+                    }
+                }
+                uint8_t c = *p++;
+                if (escaped_) {
+                    escaped_         = false;
+                    int16_t unescape = F::table.unescape[c];
+                    if (unescape >= 0) {
+                        this->put(static_cast<uint8_t>(unescape));
+                        continue;
+                    }
+                    this->misread_ = true;
+                    this->put(F::ESC);
+                }
+                if (c == F::END) {
+                    error_t err;
+                    if (!this->finish(err))
+                        continue;
+                    nused = p - src;
+                    return err;
+                } else if (c == F::ESC) {
+                    escaped_ = true;
+                } else {
+                    this->put(c);
+                }
+            }
+            nused = size;
+            return ERROR_INCOMPLETE;
+        }
+
+        bool escaped_; ///< last raw byte was ESC
+    };
+
+    /** @brief Decoder for the default framing */
+    typedef BasicSlipDecoder<> SlipDecoder;
 
     /**
      * @brief Holds a structured protocol packet and maintains SLIP+CRC encoding
@@ -107,55 +810,234 @@ namespace sproto {
      * |---------:|-----------|--------|
      * |...SLIP encoded...   [tail]| 2-4 bytes | 1 byte |
      *
-     * During creation, the buffer always maintains slip encoding with an escaped 16-bit CRC and SLIP_END.
+     * During creation, the buffer always maintains slip encoding with an escaped 16-bit CRC and END.
      * The CCITT (kermit) 16bit CRC is stored in network (big endian) byte order. The two CRC bytes are
-     * also SLIP encoded in case they contain the END or ESC characters. With the SLIP_END character,
+     * also SLIP encoded in case they contain the END or ESC characters. With the END character,
      * the terminator can be 3, 4, or 5 bytes long.
      *
      * The tail_ pointer points to the beginning of the CRC. New data will be slip encoded and amended
      * to the tail_. Followed by the running CRC and END terminator.
      *
+     * Appending escapes and CRCs the new bytes in a single pass (slipEscapeKermit) and rewrites only
+     * the trailer, so the packet can be handed to the stream at any moment without re-encoding.
+     * The buffer is fixed size and never allocates. Room for the longest trailer is always reserved.
      *
+     * @tparam F framing bytes, e.g. SlipRfc1055
      */
+    template <class F = SlipDefaultFraming>
+    class BasicProtoPacket {
+     public:
+        static constexpr size_t MAX_TRAILER = 5; ///< escaped CRC (2-4) and END (1)
+
+        BasicProtoPacket(uint8_t* buffer, size_t size, bool use_crc = true)
+            : BasicProtoPacket(buffer, buffer + size, use_crc) {}
+
+        BasicProtoPacket(uint8_t* begin, uint8_t* end, bool use_crc = true)
+            : head_(begin), tail_(begin), end_(end), trailer_end_(begin), length_(0), current_crc_(0), use_crc_(use_crc) {
+            assert(end - begin >= static_cast<ptrdiff_t>(MAX_TRAILER));
+            writeTrailer();
+        }
 
-    // class ProtoPacket {
-    //  public:
-    //     ProtoPacket(uint8_t* buffer, size_t size)
-    //         : ProtoPacket(buffer, buffer + size) {}
+        /** @brief Remove all payload. Leaves a valid, empty frame. */
+        void clear() {
+            tail_        = head_;
+            length_      = 0;
+            current_crc_ = 0;
+            writeTrailer();
+        }
+
+        /**
+         * @brief Escape and append bytes to the payload.
+         *
+         * @param src   bytes to append
+         * @param size  number of bytes to append
+         * @return number of bytes appended. Less than size if the packet is full.
+         */
+        size_t append(const uint8_t* src, size_t size) {
+            const uint8_t* p  = src;
+            uint8_t* room_end = end_ - MAX_TRAILER;
+            if (use_crc_)
+                tail_ += slipEscapeKermit<F>(p, src + size, tail_, room_end - tail_, current_crc_);
+            else
+                tail_ += slipEscape<F>(p, src + size, tail_, room_end - tail_);
+            size_t n = p - src;
+            length_ += n;
+            writeTrailer();
+            return n;
+        }
+
+        /** @brief UTF8 character version */
+        size_t append(const char* src, size_t size) {
+            return append(reinterpret_cast<const uint8_t*>(src), size);
+        }
 
-    //     ProtoPacket(uint8_t* begin, uint8_t* end)
-    //         : head_(begin), tail_(begin), end_(end), current_crc_(0) {}
+        /** @brief append a single byte */
+        size_t append(uint8_t c) {
+            return append(&c, 1);
+        }
 
-    //     size_t Encode(uint8_t* buffer, size_t size) {
-    //         Encode(buffer, buffer+size);
-    //     }
-    //     size_t Encode(uint8_t* begin, uint8_t* end) {
+        /** @brief encoded frame, ready to send */
+        const uint8_t* data() const { return head_; }
+        /** @brief size of encoded frame including CRC and END */
+        size_t size() const { return trailer_end_ - head_; }
+        /** @brief number of un-escaped payload bytes */
+        size_t length() const { return length_; }
+        /** @brief escaped bytes still free for payload. Worst case half as many raw bytes fit. */
+        size_t available() const { return (end_ - MAX_TRAILER) - tail_; }
+        /** @brief KERMIT CRC of the payload so far */
+        uint16_t crc() const { return current_crc_; }
 
-    //     }
+     protected:
+        void writeTrailer() {
+            uint8_t* out = tail_;
+            if (use_crc_) {
+                uint8_t crcbytes[2]{static_cast<uint8_t>(current_crc_ >> 8), static_cast<uint8_t>(current_crc_ & 0xff)};
+                const uint8_t* src = crcbytes;
+                out += slipEscape<F>(src, crcbytes + 2, out, MAX_TRAILER - 1);
+            }
+            *out++       = F::END;
+            trailer_end_ = out;
+        }
 
-    //  protected:
-    //     uint8_t* head_; ///< absolute start of buffer
-    //     uint8_t* tail_; ///< start of next free space, points to CRC in network order
-    //     uint8_t* end_; ///< absolute end of buffer
-    //     uint16_t current_crc_;
-    //     CRC crc_;
-    // };
+        uint8_t* head_;        ///< absolute start of buffer
+        uint8_t* tail_;        ///< start of next free space, points to CRC in network order
+        uint8_t* end_;         ///< absolute end of buffer
+        uint8_t* trailer_end_; ///< one past END
+        size_t length_;        ///< un-escaped payload bytes
+        uint16_t current_crc_;
+        bool use_crc_;
+    };
+
+    /** @brief Packet for the default framing */
+    typedef BasicProtoPacket<> ProtoPacket;
+
+    /**
+     * @brief ProtoPacket with its own fixed size storage
+     *
+     * @tparam N total buffer size, including MAX_TRAILER bytes
+     * @tparam F framing bytes
+     */
+    template <size_t N, class F = SlipDefaultFraming>
+    class StaticProtoPacket : public BasicProtoPacket<F> {
+        static_assert(N >= BasicProtoPacket<F>::MAX_TRAILER, "packet too small for trailer");
+
+     public:
+        StaticProtoPacket(bool use_crc = true)
+            : BasicProtoPacket<F>(storage_, N, use_crc) {}
+
+     protected:
+        uint8_t storage_[N];
+    };
 
     /**
      * @brief Base class for SLIP + CRC protocol communications
      *
+     * The frame level calls (writeSlipFrame, writeBareFrame, readSlipFrame) work with any
+     * framing. ProtoPacket, writeSlipEscaped, writeSlipEnd(uint16_t) and readSlipEscaped are
+     * SLIP only.
+     *
      * @tparam D Derived class used for CRTP implementation of static polymorphism
+     * @tparam F framing, e.g. SlipRfc1055 or CobsFraming. Must match the other end of the link.
      */
-    template <class D> // D is the derived type
+    template <class D, class F = SlipDefaultFraming> // D is the derived type
     class SlipProtocolBase {
         D& derived() { return *static_cast<D*>(this); }
         D const& derived() const { return *static_cast<D const*>(this); }
 
      public:
+        typedef F framing_t;
+        typedef typename F::decoder_t decoder_t; ///< decoder for frames read from this protocol
+        typedef BasicProtoPacket<F> packet_t;    ///< packet that can be handed to @ref writePacket
+
         SlipProtocolBase(bool use_crc)
-            : use_crc_(use_crc) {
+            : use_crc_(use_crc), flush_policy_(FLUSH_FRAME) {
+        }
+
+        /**
+         * @brief Write a complete frame: encoded payload, CRC (if use_crc_) and END.
+         *
+         * The frame is assembled in a scratch buffer and handed to the stream in as few writes
+         * as possible. A frame that fits in the scratch buffer takes exactly one write.
+         *
+         * @param parts         payload pieces, sent back to back as one frame
+         * @param nparts        number of payload pieces
+         * @param scratch       encoding buffer, at least 2 bytes
+         * @param scratch_size  size of encoding buffer
+         * @return size_t   number of original un-escaped payload bytes written, or 0 if the
+         *  stream did not accept the entire frame
+         */
+        size_t writeSlipFrame(const slice_t* parts, size_t nparts, uint8_t* scratch, size_t scratch_size) {
+            if (!isStreamReady() || scratch_size < 2)
+                return 0;
+            typename F::encoder_t encoder(parts, nparts, use_crc_);
+            bool ok    = true;
+            size_t ntx = 0;
+            for (size_t i = 0; i < nparts; i++)
+                ntx += parts[i].size;
+            while (!encoder.done())
+                ok &= spill(scratch, scratch + encoder.encode(scratch, scratch_size));
+            if (flush_policy_ == FLUSH_FRAME)
+                writeNow();
+            return ok ? ntx : 0;
+        }
+
+        /**
+         * @brief Write a complete frame from one payload buffer.
+         * @see writeSlipFrame(const slice_t*, size_t, uint8_t*, size_t)
+         */
+        size_t writeSlipFrame(const uint8_t* src, size_t src_size, uint8_t* scratch, size_t scratch_size) {
+            slice_t part{src, src_size};
+            return writeSlipFrame(&part, 1, scratch, scratch_size);
+        }
+
+        /**
+         * @brief Write a gathered frame using the internal SLIP_TX_BUFFER_SIZE encoding buffer.
+         * @see writeSlipFrame(const slice_t*, size_t, uint8_t*, size_t)
+         */
+        size_t writeSlipFrame(const slice_t* parts, size_t nparts) {
+            return writeSlipFrame(parts, nparts, txbuffer_, SLIP_TX_BUFFER_SIZE);
+        }
+
+        /**
+         * @brief Write a complete frame using the internal SLIP_TX_BUFFER_SIZE encoding buffer.
+         * @see writeSlipFrame(const slice_t*, size_t, uint8_t*, size_t)
+         */
+        size_t writeSlipFrame(const uint8_t* src, size_t src_size) {
+            return writeSlipFrame(src, src_size, txbuffer_, SLIP_TX_BUFFER_SIZE);
+        }
+
+        /** @brief UTF8 character version */
+        size_t writeSlipFrame(const char* src, size_t src_size) {
+            return writeSlipFrame(reinterpret_cast<const uint8_t*>(src), src_size);
         }
 
+        /**
+         * @brief Write an already encoded packet in a single stream write.
+         *
+         * @return number of encoded bytes written, or 0 if the stream did not accept all of it
+         */
+        size_t writePacket(const packet_t& packet) {
+            return writeEncodedFrame(packet.data(), packet.size());
+        }
+
+        /**
+         * @brief Write a frame already encoded for this framing, e.g. by a FrameWriter, in a
+         * single stream write.
+         *
+         * @return size, or 0 if the stream did not accept all of it
+         */
+        size_t writeEncodedFrame(const uint8_t* frame, size_t size) {
+            if (!isStreamReady())
+                return 0;
+            size_t n = writeBytes(frame, size);
+            if (flush_policy_ == FLUSH_FRAME)
+                writeNow();
+            return n == size ? n : 0;
+        }
+
+        flush_policy_t flushPolicy() const { return flush_policy_; }
+        void setFlushPolicy(flush_policy_t policy) { flush_policy_ = policy; }
+
         /**
          * @brief Write SLIP escaped buffer.
          *
@@ -170,30 +1052,19 @@ namespace sproto {
             size_t ntx         = 0; // total src buffer characters processed (NOT chars transmitted)
 
             while (src_size--) {
-                switch (end[0]) {
-                    case SLIP_END:
-                        if (0 < end - src) {
-                            ntx += writeBytes(src, end - src);
-                        }
-                        if (writeBytes(SLIP_ESC_END, 2) == 2) {
-                            ntx++; // processed one escape character
-                        }
-                        end++; // skip escaped char
-                        src = end;
-                        break;
-                    case SLIP_ESC:
-                        if (0 < end - src) {
-                            ntx += writeBytes(src, end - src);
-                        }
-                        if (writeBytes(SLIP_ESC_ESC, 2) == 2) {
-                            ntx++; // processed one escape character
-                        }
-                        end++; // skip escaped char
-                        src = end;
-                        break;
-                    default:
-                        end++;
+                if (!F::special(end[0])) {
+                    end++;
+                    continue;
+                }
+                if (0 < end - src) {
+                    ntx += writeBytes(src, end - src);
+                }
+                const uint8_t pair[]{F::ESC, F::table.escape[end[0]]};
+                if (writeBytes(pair, 2) == 2) {
+                    ntx++; // processed one escape character
                 }
+                end++; // skip escaped char
+                src = end;
             }
             // write any remaining characters
             if (0 < end - src) {
@@ -209,20 +1080,43 @@ namespace sproto {
             return writeSlipEscaped(reinterpret_cast<const uint8_t*>(src), src_size);
         }
 
+        /**
+         * @brief Write a one byte frame without a CRC, such as a bare ACK or NAK.
+         *
+         * @return 1, or 0 if the stream did not accept the entire frame
+         */
+        size_t writeBareFrame(uint8_t code) {
+            if (!isStreamReady())
+                return 0;
+            slice_t part{&code, 1};
+            typename F::encoder_t encoder(&part, 1, false);
+            uint8_t frame[4]; // code or escape pair, and END
+            size_t n = encoder.encode(frame, sizeof(frame));
+            bool ok  = writeBytes(frame, n) == n;
+            if (flush_policy_ == FLUSH_FRAME)
+                writeNow();
+            return ok ? 1 : 0;
+        }
+
         size_t writeSlipEnd() {
-            return writeBytes(&SLIP_END, 1);
+            const uint8_t end = F::END;
+            return writeBytes(&end, 1);
         }
 
         size_t writeSlipEnd(uint16_t crc) {
-            crc      = cbor_htons(crc);
-            size_t n = writeSlipEscaped(reinterpret_cast<const uint8_t*>(&crc), sizeof(uint16_t));
-            return n + writeSlipEnd();
+            // escaped CRC and END in a single write
+            crc                = cbor_htons(crc);
+            const uint8_t* src = reinterpret_cast<const uint8_t*>(&crc);
+            uint8_t trailer[5];
+            size_t n     = slipEscape<F>(src, src + sizeof(uint16_t), trailer, 4);
+            trailer[n++] = F::END;
+            return writeBytes(trailer, n) == n ? sizeof(uint16_t) + 1 : 0;
         }
 
         /**
          * @brief Read SLIP escaped sequence from stream into buffer and remove escapes.
          *
-         * Looks for standard SLIP END character.
+         * Looks for the END character of framing F.
          *
          * @param dest      destination buffer to fill
          * @param dest_size size of destination buffer (should be large enough to read escaped stream)
@@ -236,8 +1130,8 @@ namespace sproto {
         error_t readSlipEscaped(uint8_t* dest, size_t dest_size, size_t& nread) {
             if (!isStreamReady())
                 return ERROR_STREAM;
-            // leave room for SLIP_END at end of buffer
-            error_t err = readBytesUntil(dest, dest_size - 1, SLIP_END, nread);
+            // leave room for END at end of buffer
+            error_t err = readBytesUntil(dest, dest_size - 1, F::END, nread);
             if (err != NO_ERROR) {
                 return err;
             }
@@ -249,15 +1143,14 @@ namespace sproto {
             size_t nrx       = 0;
             bool misread     = false;
             while (remaining--) {
-                if (src[0] == SLIP_ESC) {
-                    if (remaining > 0 && src[1] == SLIP_ESC_END[1]) {
-                        dest[0] = SLIP_END;
-                        src++;
-                    } else if (remaining > 0 && src[1] == SLIP_ESC_ESC[1]) {
-                        dest[0] = SLIP_ESC;
+                if (src[0] == F::ESC) {
+                    int16_t unescape = remaining > 0 ? F::table.unescape[src[1]] : -1;
+                    if (unescape >= 0) {
+                        dest[0] = static_cast<uint8_t>(unescape);
                         src++;
+                        remaining--;
                     } else {
-                        dest[0] = SLIP_ESC;
+                        dest[0] = F::ESC;
                         misread = true;
                     }
                 } else {
@@ -279,6 +1172,36 @@ namespace sproto {
             return readSlipEscaped(reinterpret_cast<uint8_t*>(dest), dest_size, nread);
         }
 
+        /**
+         * @brief Non-blocking frame read. Moves whatever the stream has available into the
+         * decoder and decodes it in place. Never waits for more input.
+         *
+         * Call repeatedly from the main loop. On NO_ERROR, the frame is available from
+         * decoder.frame() and decoder.frameSize() until the next call.
+         *
+         * @param decoder   decoder holding the frame buffer and escape state
+         * @return
+         *  - ERROR_STREAM  stream not ready
+         *  - ERROR_INCOMPLETE no complete frame yet
+         *  - ERROR_BUFFER  frame was larger than the decoder buffer and was dropped
+         *  - ERROR_ENCODING slip stream was improperly encoded
+         *  - NO_ERROR      frame complete
+         */
+        error_t readSlipFrame(decoder_t& decoder) {
+            if (!isStreamReady())
+                return ERROR_STREAM;
+            if (decoder.pending()) {
+                // another frame may already be buffered behind the last one
+                error_t err = decoder.commit(0);
+                if (err != ERROR_INCOMPLETE)
+                    return err;
+            }
+            size_t n = readBytes(decoder.rxbegin(), decoder.rxsize());
+            if (n == 0)
+                return ERROR_INCOMPLETE;
+            return decoder.commit(n);
+        }
+
         /**
          * @brief Writes characters contained in buffer to stream.
          *
@@ -288,7 +1211,10 @@ namespace sproto {
          */
         size_t writeBytes(const uint8_t* buffer, size_t size) {
             // return static_cast<D*>(this)->writeBytes_impl(buffer, size);
-            return derived().writeBytes_impl(buffer, size);
+            size_t n = derived().writeBytes_impl(buffer, size);
+            if (flush_policy_ == FLUSH_ALWAYS)
+                writeNow();
+            return n;
         }
 
         /**
@@ -309,6 +1235,17 @@ namespace sproto {
             return derived().readBytesUntil_impl(buffer, size, terminator, nread);
         }
 
+        /**
+         * @brief Read bytes already waiting in the receive buffer without blocking.
+         *
+         * @param buffer    buffer to read
+         * @param size      maximum number of bytes to read
+         * @returns number of characters read, 0 if none are waiting
+         */
+        size_t readBytes(uint8_t* buffer, size_t size) {
+            return derived().readBytes_impl(buffer, size);
+        }
+
         /**
          * @brief Does the stream have bytes in the receive buffer?
          *
@@ -372,6 +1309,60 @@ namespace sproto {
         }
 
         bool use_crc_;
+
+     protected:
+        /** @brief hand [begin,end) of the scratch buffer to the stream */
+        bool spill(const uint8_t* begin, const uint8_t* end) {
+            size_t n = end - begin;
+            return n == 0 || writeBytes(begin, n) == n;
+        }
+
+        flush_policy_t flush_policy_;
+        uint8_t txbuffer_[SLIP_TX_BUFFER_SIZE];
+    };
+
+    /**
+     * @brief Protocol that writes encoded frames into a caller supplied buffer instead of a
+     * stream. Lets a CommandServer produce its replies on one thread for another to send, and a
+     * CommandPipeline keep the frames of requests it may have to send again.
+     *
+     * @tparam F framing bytes of the stream the frames are meant for
+     */
+    template <class F = SlipDefaultFraming>
+    class FrameWriter : public SlipProtocolBase<FrameWriter<F>, F> {
+        typedef SlipProtocolBase<FrameWriter<F>, F> base_t;
+        friend base_t;
+
+     public:
+        explicit FrameWriter(bool use_crc = true) : base_t(use_crc), pos_(nullptr), end_(nullptr), size_(0) {}
+
+        /** @brief Write the next frames to buffer */
+        void begin(uint8_t* buffer, size_t size) {
+            pos_  = buffer;
+            end_  = buffer + size;
+            size_ = 0;
+        }
+
+        /** @brief Bytes written since @ref begin */
+        size_t size() const { return size_; }
+
+     protected:
+        size_t writeBytes_impl(const uint8_t* buffer, size_t size) {
+            if (size > static_cast<size_t>(end_ - pos_))
+                return 0;
+            memcpy(pos_, buffer, size);
+            pos_ += size;
+            size_ += size;
+            return size;
+        }
+
+        void writeNow_impl() {}
+
+        bool isStreamReady_impl() { return pos_ != nullptr; }
+
+        uint8_t* pos_;
+        uint8_t* end_;
+        size_t size_;
     };
 
 }; // namespace sproto
@@ -0,0 +1,338 @@
+#pragma once
+
+#ifndef __SLIPTHREADS_H__
+    #define __SLIPTHREADS_H__
+
+    #include "slipcommand.h"
+    #include "spscring.h"
+    #ifdef TEENSYDUINO
+        #include <TeensyThreads.h>
+    #else
+        #include <chrono>
+        #include <condition_variable>
+        #include <mutex>
+        #include <thread>
+    #endif
+
+namespace sproto {
+
+    /**
+     * @brief Stack and scheduling of one server thread
+     */
+    struct thread_config_t {
+        size_t stack_size;   ///< bytes, 0 for the default
+        unsigned time_slice; ///< scheduler ticks per turn, 0 for the default
+        int priority;        ///< higher runs first, 0 for the default (lowest)
+    };
+
+    #ifdef TEENSYDUINO
+    /**
+     * @brief Thread shim over lib/TeensyThreads
+     */
+    struct TeensyThreadShim {
+        typedef void (*thread_fn)(void*);
+        typedef int thread_id_t;
+
+        static bool start(thread_fn fn, void* arg, const thread_config_t& config) {
+            int id = threads.addThread(fn, arg, config.stack_size ? (int)config.stack_size : -1);
+            if (id <= 0)
+                return false;
+            if (config.time_slice)
+                threads.setTimeSlice(id, config.time_slice);
+            threads.setPriority(id, config.priority);
+            return true;
+        }
+
+        static void yield() { threads.yield(); }
+
+        static thread_id_t self() { return threads.id(); }
+
+        /** @brief Wake thread id from @ref idle. Safe to call from an ISR. */
+        static void notify(thread_id_t id) { threads.notify(id); }
+
+        /** @brief Sleep until @ref notify or timeout_ms */
+        static void idle(unsigned timeout_ms) { threads.waitNotify(timeout_ms); }
+
+        /** @brief Counting semaphore whose waiters are suspended until a release */
+        typedef Threads::Semaphore semaphore_t;
+    };
+    #else
+    /**
+     * @brief Thread shim over std::thread, to run the server on a host. Stack sizes, time
+     * slices and priorities are left to the OS.
+     */
+    struct StdThreadShim {
+        typedef void (*thread_fn)(void*);
+        typedef int thread_id_t;
+
+        static bool start(thread_fn fn, void* arg, const thread_config_t&) {
+            std::thread(fn, arg).detach();
+            return true;
+        }
+
+        static void yield() { std::this_thread::yield(); }
+
+        static thread_id_t self() { return 0; }
+
+        // host streams are polled, nothing notifies
+        static void notify(thread_id_t) {}
+
+        static void idle(unsigned) { std::this_thread::yield(); }
+
+        /**
+         * @brief Counting semaphore with the Threads::Semaphore calls the server uses. The
+         * count is atomic, the mutex is only taken to sleep or to wake a sleeper, and acquire
+         * yields a few times before it sleeps.
+         */
+        class semaphore_t {
+         public:
+            semaphore_t() : count_(0), sleepers_(0) {}
+
+            int acquire(unsigned timeout_ms) {
+                for (int spin = 0; spin < SPIN_YIELDS; spin++) {
+                    if (try_acquire())
+                        return 1;
+                    std::this_thread::yield();
+                }
+                std::unique_lock<std::mutex> lock(mutex_);
+                sleepers_++;
+                bool taken = cv_.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] { return try_acquire() != 0; });
+                sleepers_--;
+                return taken;
+            }
+
+            int try_acquire() {
+                int count = count_.load();
+                while (count > 0) {
+                    if (count_.compare_exchange_weak(count, count - 1))
+                        return 1;
+                }
+                return 0;
+            }
+
+            void release() {
+                count_++;
+                if (sleepers_ > 0) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    cv_.notify_one();
+                }
+            }
+
+         private:
+            // a futex sleep and wake costs more than a few yields when the count is about to come
+            static constexpr int SPIN_YIELDS = 16;
+
+            std::atomic<int> count_;
+            std::atomic<int> sleepers_;
+            std::mutex mutex_;
+            std::condition_variable cv_;
+        };
+    };
+    #endif
+
+    /**
+     * @brief Command server split over three threads joined by bounded queues.
+     *
+     * - RX reads and decodes frames and queues them for dispatch.
+     * - Dispatch runs the command handlers and encodes each reply into a TX slot.
+     * - TX writes the replies to the stream and flushes once the queue runs dry.
+     *
+     * A slow handler only holds up dispatch: RX keeps parsing until DEPTH frames are waiting,
+     * and TX keeps draining replies already made. When a queue is full, its producer yields
+     * until a slot frees, so a backlog ends up in the stream's own buffers and nothing is
+     * dropped.
+     *
+     * RX only reads from the protocol and TX only writes to it, and each queue has exactly one
+     * producer and one consumer, so the queues take no locks. Each queue is paired with a
+     * semaphore counting its entries: an idle dispatch or TX thread sleeps on it instead of
+     * spending time slices polling. Once RX has read all there is, it sleeps in TH::idle()
+     * until @ref notifyRx, which the stream's receive interrupt should call, or for at most
+     * STOP_POLL_MS.
+     *
+     * @tparam D            Derived protocol class, e.g. ArduinoSlipProtocol<usb_serial_class>
+     * @tparam TH           thread shim, e.g. TeensyThreadShim, with a semaphore_t
+     * @tparam FRAME_SIZE   largest request frame, decoded
+     * @tparam REPLY_SIZE   largest reply payload
+     * @tparam DEPTH        slots per queue, a power of two
+     * @tparam RETAIN       sequenced replies kept for requests the host sends again, see
+     *                      CommandServer::setRetainBuffer
+     */
+    template <class D, class TH, size_t FRAME_SIZE = 128, size_t REPLY_SIZE = 128, size_t DEPTH = 4, size_t RETAIN = 8>
+    class ThreadedCommandServer {
+     public:
+        typedef SlipProtocolBase<D, typename D::framing_t> proto_t;
+        typedef FrameWriter<typename D::framing_t> writer_t;
+
+        /**
+         * @param proto         protocol to serve
+         * @param commands      command table
+         * @param version       device version returned by `q`
+         * @param description   device description returned by `q`
+         */
+        ThreadedCommandServer(proto_t& proto, CommandTable commands, uint32_t version, const char* description)
+            : proto_(proto), decoder_(rxbuffer_, FRAME_SIZE), writer_(proto.use_crc_),
+              server_(writer_, commands, nullptr, 0, txbuffer_, REPLY_SIZE, version, description),
+              stop_(false), running_(0), received_(0), rx_thread_(-1) {
+            server_.setRetainBuffer(retainbuffer_, sizeof(retainbuffer_), RETAIN);
+        }
+
+        /** @copydoc CommandServer::onReset */
+        void onReset(void (*fn)()) { server_.onReset(fn); }
+
+        /** @copydoc CommandServer::setSerialNumber */
+        void setSerialNumber(uint32_t serial_number) { server_.setSerialNumber(serial_number); }
+
+        /** @copydoc CommandServer::setFrameHandler */
+        void setFrameHandler(uint8_t code, frame_fn fn, void* context) { server_.setFrameHandler(code, fn, context); }
+
+        /**
+         * @brief Start the three threads.
+         *
+         * @return false if a thread could not be created. Threads already started keep running.
+         */
+        bool start(const thread_config_t& rx, const thread_config_t& dispatch, const thread_config_t& tx) {
+            stop_ = false;
+            return startThread(rxMain, rx) && startThread(dispatchMain, dispatch) && startThread(txMain, tx);
+        }
+
+        /** @brief Ask the threads to exit and wait until they have */
+        void stop() {
+            stop_ = true;
+            while (running_ != 0)
+                TH::yield();
+        }
+
+        /**
+         * @brief Wake the RX thread because the stream has data. Safe to call from an ISR;
+         * without it RX only looks every STOP_POLL_MS while idle.
+         */
+        void notifyRx() {
+            typename TH::thread_id_t id = rx_thread_;
+            if (id >= 0)
+                TH::notify(id);
+        }
+
+        /** @brief Frames read so far, including ones still waiting for dispatch */
+        uint32_t received() const { return received_; }
+
+     protected:
+        struct request_t {
+            error_t error; ///< read error to NAK, or NO_ERROR
+            bool crc_ok;
+            size_t size;
+            uint8_t frame[FRAME_SIZE];
+        };
+
+        // longest sleep on an empty queue or an idle stream before checking for stop()
+        static constexpr unsigned STOP_POLL_MS = 10;
+
+        // worst case encoded frame of sequence head, payload, CRC and END
+        static constexpr size_t REPLY_FRAME_SIZE = D::framing_t::maxFrameSize(3 + REPLY_SIZE);
+
+        struct reply_t {
+            size_t size;
+            uint8_t frame[REPLY_FRAME_SIZE];
+        };
+
+        bool startThread(typename TH::thread_fn fn, const thread_config_t& config) {
+            running_++;
+            if (TH::start(fn, this, config))
+                return true;
+            running_--;
+            return false;
+        }
+
+        static void rxMain(void* arg) {
+            ThreadedCommandServer& self = *static_cast<ThreadedCommandServer*>(arg);
+            self.rx_thread_ = TH::self();
+            while (!self.stop_) {
+                request_t* req = self.requests_.pushSlot();
+                error_t err    = req ? self.proto_.readSlipFrame(self.decoder_) : ERROR_INCOMPLETE;
+                if (err == ERROR_INCOMPLETE) {
+                    if (req)
+                        TH::idle(STOP_POLL_MS); // read everything there was
+                    else
+                        TH::yield();
+                    continue;
+                }
+                req->error = err;
+                req->size  = 0;
+                if (err == NO_ERROR) {
+                    req->crc_ok = self.decoder_.crcOk();
+                    req->size   = self.decoder_.frameSize();
+                    memcpy(req->frame, self.decoder_.frame(), req->size);
+                }
+                self.requests_.pushCommit();
+                self.requests_ready_.release();
+                self.received_++;
+            }
+            self.rx_thread_ = -1;
+            self.running_--;
+        }
+
+        static void dispatchMain(void* arg) {
+            ThreadedCommandServer& self = *static_cast<ThreadedCommandServer*>(arg);
+            while (!self.stop_) {
+                if (!self.requests_ready_.acquire(STOP_POLL_MS))
+                    continue;
+                request_t* req = self.requests_.front(); // one count per queued request
+                reply_t* reply;
+                while (!(reply = self.replies_.pushSlot()) && !self.stop_)
+                    TH::yield();
+                if (!reply)
+                    break;
+                self.writer_.begin(reply->frame, sizeof(reply->frame));
+                if (req->error != NO_ERROR)
+                    self.server_.reject(req->error);
+                else
+                    self.server_.dispatch(req->frame, req->size, req->crc_ok);
+                self.requests_.popCommit();
+                reply->size = self.writer_.size();
+                if (reply->size) {
+                    self.replies_.pushCommit();
+                    self.replies_ready_.release();
+                }
+            }
+            self.running_--;
+        }
+
+        static void txMain(void* arg) {
+            ThreadedCommandServer& self = *static_cast<ThreadedCommandServer*>(arg);
+            bool unflushed = false;
+            while (!self.stop_) {
+                if (!self.replies_ready_.try_acquire()) {
+                    if (unflushed) {
+                        self.proto_.writeNow();
+                        unflushed = false;
+                    }
+                    if (!self.replies_ready_.acquire(STOP_POLL_MS))
+                        continue;
+                }
+                reply_t* reply = self.replies_.front(); // one count per queued reply
+                self.proto_.writeBytes(reply->frame, reply->size);
+                self.replies_.popCommit();
+                unflushed = true;
+            }
+            self.running_--;
+        }
+
+        proto_t& proto_;
+        uint8_t rxbuffer_[FRAME_SIZE];
+        typename proto_t::decoder_t decoder_; ///< RX thread only
+        uint8_t txbuffer_[REPLY_SIZE];
+        writer_t writer_;                ///< dispatch thread only
+        CommandServer<writer_t> server_; ///< dispatch thread only, fed by dispatch() and reject()
+        uint8_t retainbuffer_[RETAIN ? RETAIN * (CommandServer<writer_t>::RETAIN_HEAD + 3 + REPLY_SIZE) : 1];
+        SpscQueue<request_t, DEPTH> requests_;
+        SpscQueue<reply_t, DEPTH> replies_;
+        typename TH::semaphore_t requests_ready_; ///< released by RX, taken by dispatch
+        typename TH::semaphore_t replies_ready_;  ///< released by dispatch, taken by TX
+        std::atomic<bool> stop_;
+        std::atomic<int> running_;
+        std::atomic<uint32_t> received_;
+        std::atomic<typename TH::thread_id_t> rx_thread_; ///< for notifyRx, -1 while not running
+    };
+
+}; // namespace
+
+#endif // #ifndef __SLIPTHREADS_H__
@@ -0,0 +1,247 @@
+#pragma once
+
+#ifndef __SPSCRING_H__
+    #define __SPSCRING_H__
+
+    #include <atomic>
+    #include <cstddef>
+    #include <cstdint>
+    #include <cstring>
+
+namespace sproto {
+
+    #if defined(__IMXRT1062__)
+    constexpr size_t SPSC_CACHE_LINE = 32; ///< Cortex-M7 D-cache line
+    #else
+    constexpr size_t SPSC_CACHE_LINE = 64;
+    #endif
+
+    /**
+     * @brief Lock-free single producer, single consumer byte ring.
+     *
+     * One context (an ISR, an RX thread or a stream callback) pushes and one other context
+     * pops. Neither ever waits for the other: push is wait-free and fails when the ring is full,
+     * pop returns what is there.
+     *
+     * Head and tail are free-running counters, masked on access, so all SIZE bytes are usable.
+     * Each side owns one counter on its own cache line, next to a private copy of the other side's
+     * counter. The shared counter is only re-read when the copy says the ring is full (or empty),
+     * so in steady state the two sides do not pull each other's cache line on every byte.
+     *
+     * The span calls give zero-copy access: read straight from a stream into @ref pushSpan, or
+     * decode straight out of @ref popSpan, then commit what was used.
+     *
+     * @tparam SIZE     capacity in bytes, a power of two
+     */
+    template <size_t SIZE>
+    class SpscRing {
+        static_assert(SIZE >= 2 && (SIZE & (SIZE - 1)) == 0, "SpscRing size must be a power of two");
+        static constexpr size_t MASK = SIZE - 1;
+
+     public:
+        SpscRing() : head_(0), tail_cache_(0), tail_(0), head_cache_(0) {}
+
+        /** @brief Capacity in bytes */
+        static constexpr size_t capacity() { return SIZE; }
+
+        // -------------------------------------------------------------------------------------
+        // producer side
+
+        /**
+         * @brief Append one byte. Wait-free.
+         * @return false if the ring is full
+         */
+        bool push(uint8_t value) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head - tail_cache_ == SIZE) {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if (head - tail_cache_ == SIZE)
+                    return false;
+            }
+            buffer_[head & MASK] = value;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * @brief Append as much of src as fits. Wait-free.
+         * @return bytes appended
+         */
+        size_t push(const uint8_t* src, size_t size) {
+            size_t done = 0;
+            while (done < size) {
+                uint8_t* dst;
+                size_t n = pushSpan(dst);
+                if (n == 0)
+                    break;
+                if (n > size - done)
+                    n = size - done;
+                memcpy(dst, src + done, n);
+                pushCommit(n);
+                done += n;
+            }
+            return done;
+        }
+
+        /**
+         * @brief Contiguous free space at the head. Fill it, then @ref pushCommit.
+         * @return size of the span, 0 if the ring is full
+         */
+        size_t pushSpan(uint8_t*& dst) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            size_t used = head - tail_cache_;
+            if (used == SIZE) {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                used        = head - tail_cache_;
+            }
+            size_t at = head & MASK;
+            dst       = buffer_ + at;
+            size_t n  = SIZE - used;
+            return n < SIZE - at ? n : SIZE - at;
+        }
+
+        /** @brief Publish n bytes written to the last @ref pushSpan */
+        void pushCommit(size_t n) {
+            head_.store(head_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        }
+
+        /** @brief Free space as seen by the producer */
+        size_t space() {
+            tail_cache_ = tail_.load(std::memory_order_acquire);
+            return SIZE - (head_.load(std::memory_order_relaxed) - tail_cache_);
+        }
+
+        // -------------------------------------------------------------------------------------
+        // consumer side
+
+        /**
+         * @brief Remove up to size bytes into dst.
+         * @return bytes removed, 0 if the ring is empty
+         */
+        size_t pop(uint8_t* dst, size_t size) {
+            size_t done = 0;
+            while (done < size) {
+                const uint8_t* src;
+                size_t n = popSpan(src);
+                if (n == 0)
+                    break;
+                if (n > size - done)
+                    n = size - done;
+                memcpy(dst + done, src, n);
+                popCommit(n);
+                done += n;
+            }
+            return done;
+        }
+
+        /**
+         * @brief Contiguous bytes at the tail. Use them, then @ref popCommit.
+         * @return size of the span, 0 if the ring is empty
+         */
+        size_t popSpan(const uint8_t*& src) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t used = head_cache_ - tail;
+            if (used == 0) {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                used        = head_cache_ - tail;
+            }
+            size_t at = tail & MASK;
+            src       = buffer_ + at;
+            return used < SIZE - at ? used : SIZE - at;
+        }
+
+        /** @brief Release n bytes taken from the last @ref popSpan */
+        void popCommit(size_t n) {
+            tail_.store(tail_.load(std::memory_order_relaxed) + n, std::memory_order_release);
+        }
+
+        /** @brief Bytes waiting, as seen by the consumer */
+        size_t available() {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            return head_cache_ - tail_.load(std::memory_order_relaxed);
+        }
+
+        bool empty() { return available() == 0; }
+
+        /** @brief Drop everything waiting. Consumer side. */
+        void clear() {
+            popCommit(available());
+        }
+
+     protected:
+        // producer line: written by the producer, read by the consumer when it runs dry
+        alignas(SPSC_CACHE_LINE) std::atomic<size_t> head_;
+        size_t tail_cache_; ///< producer's last view of tail_
+        // consumer line
+        alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail_;
+        size_t head_cache_; ///< consumer's last view of head_
+        alignas(SPSC_CACHE_LINE) uint8_t buffer_[SIZE];
+    };
+
+    /**
+     * @brief Lock-free single producer, single consumer queue of fixed size slots.
+     *
+     * Same layout as SpscRing, but the unit is a T. Slots are filled and drained in place: the
+     * producer writes into @ref pushSlot and publishes it with @ref pushCommit, the consumer reads
+     * @ref front and frees it with @ref popCommit. Large frames are never copied in and out.
+     *
+     * @tparam T        slot type
+     * @tparam SIZE     number of slots, a power of two
+     */
+    template <class T, size_t SIZE>
+    class SpscQueue {
+        static_assert(SIZE >= 1 && (SIZE & (SIZE - 1)) == 0, "SpscQueue size must be a power of two");
+        static constexpr size_t MASK = SIZE - 1;
+
+     public:
+        SpscQueue() : head_(0), tail_cache_(0), tail_(0), head_cache_(0) {}
+
+        /** @brief Free slot to fill, nullptr if the queue is full. Producer side. */
+        T* pushSlot() {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head - tail_cache_ == SIZE) {
+                tail_cache_ = tail_.load(std::memory_order_acquire);
+                if (head - tail_cache_ == SIZE)
+                    return nullptr;
+            }
+            return &slots_[head & MASK];
+        }
+
+        /** @brief Publish the slot from @ref pushSlot */
+        void pushCommit() {
+            head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /** @brief Oldest slot, nullptr if the queue is empty. Consumer side. */
+        T* front() {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            if (head_cache_ == tail) {
+                head_cache_ = head_.load(std::memory_order_acquire);
+                if (head_cache_ == tail)
+                    return nullptr;
+            }
+            return &slots_[tail & MASK];
+        }
+
+        /** @brief Free the slot from @ref front */
+        void popCommit() {
+            tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+        /** @brief Slots waiting, as seen by the consumer */
+        size_t available() {
+            head_cache_ = head_.load(std::memory_order_acquire);
+            return head_cache_ - tail_.load(std::memory_order_relaxed);
+        }
+
+     protected:
+        alignas(SPSC_CACHE_LINE) std::atomic<size_t> head_;
+        size_t tail_cache_;
+        alignas(SPSC_CACHE_LINE) std::atomic<size_t> tail_;
+        size_t head_cache_;
+        alignas(SPSC_CACHE_LINE) T slots_[SIZE];
+    };
+
+}; // namespace
+
+#endif // #ifndef __SPSCRING_H__
@@ -0,0 +1,154 @@
+// Host check and benchmark of the TeensyThreads RunQueue, the scheduling decision taken by
+// Threads::getNextThread() on every context switch. Checks round robin, priorities and lazy
+// removal against a reference model, then times a switch against the old linear scan of
+// threadp[] for growing thread counts.
+//
+// g++ -std=gnu++14 -O2 -I../lib/TeensyThreads runqueue.cpp -o runqueue
+
+#include "RunQueue.h"
+#include <chrono>
+#include <cstdio>
+
+static bool check(bool ok, const char* what) {
+    printf("%-44s %s\n", what, ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+template <int N>
+struct Sim {
+    RunQueue<N, 8> runq;
+    bool running[N] = {};
+    int current     = 0;
+
+    void ready(int id) {
+        running[id] = true;
+        runq.insert(id);
+    }
+
+    int next() {
+        int id  = runq.next(current, [this](int i) { return running[i]; });
+        current = id >= 0 ? id : 0;
+        return id;
+    }
+};
+
+static bool checkRoundRobin() {
+    Sim<16> sim;
+    for (int id = 0; id < 4; id++)
+        sim.ready(id);
+    bool ok = true;
+    for (int i = 0; i < 12; i++)
+        ok &= sim.next() == (i + 1) % 4;
+    return check(ok, "round robin within a level");
+}
+
+static bool checkPriority() {
+    Sim<16> sim;
+    for (int id = 0; id < 4; id++)
+        sim.ready(id);
+    sim.runq.setPriority(3, 2);
+    bool ok = true;
+    for (int i = 0; i < 4; i++)
+        ok &= sim.next() == 3; // always outranks the others
+    sim.running[3] = false;    // suspended: dropped when it reaches the head
+    ok &= sim.next() == 1 && !sim.runq.contains(3); // 0 went behind on the first switch
+    ok &= sim.next() == 2 && sim.next() == 0;
+    sim.ready(3); // restarted
+    ok &= sim.next() == 3;
+    sim.runq.setPriority(3, 0); // back of level 0
+    ok &= sim.next() == 1 && sim.next() == 2 && sim.next() == 0 && sim.next() == 3;
+    for (int id = 0; id < 4; id++)
+        sim.running[id] = false;
+    ok &= sim.next() == -1 && sim.runq.top() == -1;
+    return check(ok, "priorities, suspend and restart");
+}
+
+// random suspends, restarts and priority changes: every pick must be a running thread of
+// the highest running priority, and equals must each get a turn
+static bool checkRandom() {
+    const int N = 16;
+    Sim<N> sim;
+    for (int id = 0; id < N; id++)
+        sim.ready(id);
+    uint32_t rnd = 12345;
+    bool ok      = true;
+    for (int step = 0; step < 200000 && ok; step++) {
+        rnd    = rnd * 1103515245 + 12345;
+        int id = (rnd >> 8) % N;
+        switch ((rnd >> 16) % 4) {
+            case 0: sim.running[id] = false; break;
+            case 1: sim.ready(id); break;
+            case 2: sim.runq.setPriority(id, (rnd >> 20) % 8); break;
+        }
+        int top = -1;
+        for (int i = 0; i < N; i++) {
+            if (sim.running[i] && (top < 0 || sim.runq.priority(i) > sim.runq.priority(top)))
+                top = i;
+        }
+        int picked = sim.next();
+        if (top < 0) {
+            ok &= picked == -1;
+            continue;
+        }
+        ok &= picked >= 0 && sim.running[picked] && sim.runq.priority(picked) == sim.runq.priority(top);
+        // with nothing changing, every thread of that level runs once in as many switches
+        int level = sim.runq.priority(top), count = 0;
+        bool seen[N] = {};
+        for (int i = 0; i < N; i++)
+            count += sim.running[i] && sim.runq.priority(i) == level;
+        for (int i = 0; i < count; i++) {
+            seen[picked] = true;
+            picked       = sim.next();
+        }
+        for (int i = 0; i < N; i++)
+            ok &= seen[i] == (sim.running[i] && sim.runq.priority(i) == level);
+    }
+    return check(ok, "random operations against reference");
+}
+
+// the scheduler before RunQueue: scan threadp[] from current+1, thread 0 always runs
+template <int N>
+static int linearNext(const bool* running, int current) {
+    while (1) {
+        if (++current >= N)
+            return 0;
+        if (running[current])
+            return current;
+    }
+}
+
+template <int N>
+static void benchSwitch() {
+    const int switches = 10000000;
+    // every slot holds a thread but most are blocked, as in a server waiting for I/O
+    Sim<N> sim;
+    sim.ready(0);
+    sim.ready(N / 2);
+    sim.ready(N - 1);
+    volatile int sink = 0;
+
+    auto start = std::chrono::steady_clock::now();
+    int current = 0;
+    for (int i = 0; i < switches; i++)
+        sink = current = linearNext<N>(sim.running, current);
+    double linear = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / switches;
+
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < switches; i++)
+        sink = sim.next();
+    double queued = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / switches;
+    (void)sink;
+    printf("%3d threads: linear scan %6.2f ns, run queue %6.2f ns per switch\n", N, linear, queued);
+}
+
+int main() {
+    bool ok = true;
+    ok &= checkRoundRobin();
+    ok &= checkPriority();
+    ok &= checkRandom();
+    benchSwitch<16>();
+    benchSwitch<32>();
+    benchSwitch<64>();
+    benchSwitch<127>();
+    return ok ? 0 : 1;
+}
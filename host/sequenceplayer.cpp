@@ -0,0 +1,198 @@
+// Host check of SequencePlayer against a fake double buffered timer. Plays sequences in
+// simulated time and checks when each pattern is output, the periods the timer is given,
+// splitting of long steps, the remainder fix-up, zero length steps and repeat counting.
+// Then steps a TriggeredSequence loaded the way the adapter encodes it, and checks that
+// DigitalOutputs hands the outputs over between writes and both sequences.
+//
+// g++ -std=gnu++14 -O2 -I../firmware -I../lib/tinycbor/src sequenceplayer.cpp
+//     ../lib/tinycbor/src/cborencoder.c ../lib/tinycbor/src/cborparser.c -o sequenceplayer
+
+#include "sequenceplayer.h"
+#include <cstdio>
+#include <vector>
+
+using namespace sproto;
+
+static bool check(bool ok, const char* what) {
+    printf("%-44s %s\n", what, ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+// Like Timer1: a period set while one runs is loaded when it ends, then the interrupt fires.
+struct FakeTimer {
+    static constexpr uint32_t MIN_PERIOD_US = 10;
+    static constexpr uint32_t MAX_PERIOD_US = 1000; // small, so steps split often
+
+    static bool running;
+    static uint32_t period_us; ///< running period
+    static uint32_t next_us;   ///< loaded at the next reload
+    static std::vector<uint32_t> periods;
+
+    static void start(uint32_t p) {
+        running   = true;
+        period_us = next_us = p;
+    }
+    static void setNextPeriod(uint32_t p) { next_us = p; }
+    static void stop() { running = false; }
+};
+
+bool FakeTimer::running       = false;
+uint32_t FakeTimer::period_us = 0;
+uint32_t FakeTimer::next_us   = 0;
+std::vector<uint32_t> FakeTimer::periods;
+
+struct output_t {
+    uint64_t time_us;
+    uint32_t state;
+    bool operator==(const output_t& o) const { return time_us == o.time_us && state == o.state; }
+};
+
+static uint64_t now_us = 0;
+static std::vector<output_t> outputs;
+
+static void record(uint32_t state) {
+    outputs.push_back({now_us, state});
+}
+
+typedef SequencePlayer<FakeTimer, 16> Player;
+static Player player(record);
+
+// load `[state, duration_us]` steps the way they arrive in a SEQUENCE command
+static error_t load(const std::vector<sequence_step_t>& steps, Player& to = player) {
+    uint8_t buffer[256];
+    CborEncoder enc, array, pair;
+    cbor_encoder_init(&enc, buffer, sizeof(buffer), 0);
+    cbor_encoder_create_array(&enc, &array, steps.size());
+    for (const sequence_step_t& step : steps) {
+        cbor_encoder_create_array(&array, &pair, 2);
+        cbor_encode_uint(&pair, step.state);
+        cbor_encode_uint(&pair, step.duration_us);
+        cbor_encoder_close_container(&array, &pair);
+    }
+    cbor_encoder_close_container(&enc, &array);
+    CborParser parser;
+    CborValue it, params;
+    cbor_parser_init(buffer, cbor_encoder_get_buffer_size(&enc, buffer), 0, &parser, &it);
+    cbor_value_enter_container(&it, &params);
+    return to.load(params);
+}
+
+typedef DigitalOutputs<FakeTimer, 16> Outputs;
+static Outputs board(record);
+
+// load patterns the way the adapter sends a TRIGGERED command
+static error_t loadTriggered(const std::vector<uint32_t>& states) {
+    uint8_t buffer[64];
+    size_t size = encodeTriggered(buffer, sizeof(buffer), states.data(), states.size());
+    CborParser parser;
+    CborValue it, params;
+    cbor_parser_init(buffer, size, 0, &parser, &it);
+    cbor_value_enter_container(&it, &params);
+    return board.triggered().load(params);
+}
+
+// patterns output by n triggers
+static std::vector<uint32_t> trigger(size_t n) {
+    outputs.clear();
+    for (size_t i = 0; i < n; i++)
+        board.triggered().trigger();
+    std::vector<uint32_t> states;
+    for (const output_t& o : outputs)
+        states.push_back(o.state);
+    return states;
+}
+
+// Play until the player stops or max_ticks periods have run. Returns when it stopped.
+static uint64_t play(uint32_t repeats, size_t max_ticks = 1000) {
+    now_us = 0;
+    outputs.clear();
+    FakeTimer::periods.clear();
+    player.start(repeats);
+    for (size_t i = 0; i < max_ticks && FakeTimer::running; i++) {
+        FakeTimer::periods.push_back(FakeTimer::period_us);
+        now_us += FakeTimer::period_us;
+        FakeTimer::period_us = FakeTimer::next_us;
+        player.tick();
+    }
+    return now_us;
+}
+
+static bool periodsInRange() {
+    for (uint32_t p : FakeTimer::periods) {
+        if (p < FakeTimer::MIN_PERIOD_US || p > FakeTimer::MAX_PERIOD_US)
+            return false;
+    }
+    return true;
+}
+
+int main() {
+    bool ok = true;
+
+    ok &= check(load({{1, 2500}, {2, 30}}) == NO_ERROR && player.size() == 2, "load two steps");
+    uint64_t end = play(1);
+    ok &= check(FakeTimer::periods == std::vector<uint32_t>{1000, 1000, 500, 30}, "long step split into timer periods");
+    ok &= check(outputs == std::vector<output_t>{{0, 1}, {2500, 2}} && end == 2530 && !player.running(),
+                "outputs at step starts, stops at the end");
+
+    // 1005 would leave 5 us after a full period, too short to time
+    load({{1, 1005}, {2, 1008}});
+    end = play(1);
+    ok &= check(FakeTimer::periods == std::vector<uint32_t>{990, 15, 990, 18} && periodsInRange(),
+                "remainder fix-up keeps periods timeable");
+    ok &= check(outputs == std::vector<output_t>{{0, 1}, {1005, 2}} && end == 2013, "fix-up keeps step timing");
+
+    load({{1, 100}, {2, 0}, {3, 0}, {4, 50}});
+    play(1);
+    ok &= check(outputs == std::vector<output_t>{{0, 1}, {100, 4}}, "zero length steps skipped to the last");
+
+    load({{1, 100}, {5, 0}});
+    end = play(1);
+    ok &= check(outputs == std::vector<output_t>{{0, 1}, {100, 5}} && end == 100 && !player.running(),
+                "zero length tail step is held");
+
+    load({{1, 100}, {2, 200}});
+    end = play(3);
+    ok &= check(outputs == std::vector<output_t>{{0, 1}, {100, 2}, {300, 1}, {400, 2}, {600, 1}, {700, 2}} &&
+                    end == 900,
+                "sequence played 3 times");
+    load({{1, 100}});
+    play(Player::REPEAT_FOREVER, 100);
+    ok &= check(outputs.size() == 101 && player.running(), "REPEAT_FOREVER plays until stopped");
+    player.stop();
+    ok &= check(!player.running() && !FakeTimer::running, "stop");
+    ok &= check(player.start(0) == NO_ERROR && !FakeTimer::running, "start(0) stops");
+
+    ok &= check(load({{1, 100}, {2, 5}}) == ERROR_COMMAND && player.size() == 0, "step shorter than the timer refused");
+    ok &= check(load({{1, 0}, {2, 0}}) == ERROR_COMMAND, "sequence that takes no time refused");
+    ok &= check(player.start(1) == ERROR_COMMAND, "start without a sequence refused");
+    load({{1, 100}});
+    player.start(Player::REPEAT_FOREVER);
+    ok &= check(load({{2, 100}}) == ERROR_COMMAND && player.size() == 1, "load while playing refused");
+    player.stop();
+
+    ok &= check(loadTriggered({1, 2, 3}) == NO_ERROR && board.triggered().size() == 3, "load triggered sequence");
+    ok &= check(trigger(1).empty(), "triggers ignored until armed");
+    ok &= check(board.arm(true) == NO_ERROR && trigger(4) == std::vector<uint32_t>{1, 2, 3, 1}, "triggers step and wrap around");
+    ok &= check(board.arm(true) == NO_ERROR && trigger(1) == std::vector<uint32_t>{1}, "arming starts from the first");
+    ok &= check(loadTriggered({4}) == ERROR_COMMAND && board.triggered().size() == 3, "load while armed refused");
+    outputs.clear();
+    board.write(7);
+    ok &= check(!board.triggered().armed() && outputs.size() == 1 && outputs[0].state == 7, "DIGITAL_OUT write disarms");
+    ok &= check(trigger(1).empty(), "triggers ignored after the write");
+    ok &= check(board.arm(true) == NO_ERROR && board.arm(false) == NO_ERROR && trigger(1).empty(), "disarm");
+
+    load({{1, 100}}, board.sequence());
+    board.arm(true);
+    ok &= check(board.run(Player::REPEAT_FOREVER) == NO_ERROR && !board.triggered().armed(), "SEQUENCE_RUN disarms");
+    ok &= check(board.arm(true) == NO_ERROR && !FakeTimer::running, "arming stops the sequence");
+    board.run(Player::REPEAT_FOREVER);
+    board.write(0);
+    ok &= check(!board.sequence().running() && !FakeTimer::running, "DIGITAL_OUT write stops the sequence");
+
+    ok &= check(loadTriggered({}) == NO_ERROR && board.arm(true) == ERROR_COMMAND, "arm without patterns refused");
+    uint8_t small[4];
+    const uint32_t many[]{1, 2, 3, 4, 5};
+    ok &= check(encodeTriggered(small, sizeof(small), many, 5) == 0, "patterns too many for the buffer");
+
+    return ok ? 0 : 1;
+}
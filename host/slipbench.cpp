@@ -0,0 +1,37 @@
+// Host benchmark of the SLIP scan, escape and decode paths, and of whole frames with SLIP
+// against COBS.
+//
+// g++ -std=gnu++14 -O2 -march=native -I../firmware -I../lib/tinycbor/src slipbench.cpp -o slipbench
+// Add -DSLIP_SCALAR_SCAN to compare against the byte-at-a-time loop.
+
+#include "slipbench.h"
+#include <cstdio>
+#include <vector>
+
+using namespace sproto;
+
+int main() {
+    const size_t sizes[] = {64, 1024, 8192};
+    for (size_t size : sizes) {
+        std::vector<uint8_t> payload(size), work(3 * size + 8);
+        bench_result_t results[8];
+        size_t n = benchSlip(results, payload.data(), size, work.data(), 20000000 / size);
+        printf("payload %zu bytes\n", size);
+        for (size_t i = 0; i < n; i++) {
+            printf("  %-24s %8.3f bytes/cycle\n", results[i].name, results[i].bytesPerCycle());
+        }
+    }
+    for (size_t size : sizes) {
+        std::vector<uint8_t> payload(size), work(3 * size + 8);
+        bench_result_t results[16];
+        size_t n = benchFraming(results, payload.data(), size, work.data(), 20000000 / size);
+        printf("frames, payload %zu bytes\n", size);
+        for (size_t i = 0; i < n; i++) {
+            printf("  %-24s %8.3f bytes/cycle", results[i].name, results[i].bytesPerCycle());
+            if (results[i].wire)
+                printf(" %6zu bytes on the wire", results[i].wire);
+            printf("\n");
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,217 @@
+// Host benchmark of bulk transfers over a pty loopback. A thread runs the firmware
+// CommandServer with a BulkReceiver on the slave side, a BulkSender drives the master side.
+// Sends several MB of random data at a few chunk sizes, then through a relay that flips
+// bits in both directions, resumes an interrupted transfer, and checks a refused one.
+//
+// g++ -std=gnu++14 -O2 -I../firmware -I../lib/FastCRC -I../lib/tinycbor/src slipbulk.cpp
+//     ../lib/FastCRC/FastCRCsw.cpp ../lib/tinycbor/src/cborencoder.c ../lib/tinycbor/src/cborparser.c
+//     -lpthread -o slipbulk
+
+#include "posixslip.h"
+#include "slipbulk.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace sproto;
+using std::chrono::steady_clock;
+
+typedef BulkSender<PosixSlipProtocol> Sender;
+
+static uint32_t rnd = 12345;
+
+static uint8_t nextByte() {
+    rnd = rnd * 1103515245 + 12345;
+    return static_cast<uint8_t>(rnd >> 16);
+}
+
+// sleep until fd has input rather than spin, so the pty can make progress on one core
+static void waitReadable(int fd) {
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    ::poll(&pfd, 1, 10);
+}
+
+// the sink writes into memory, so the test can compare
+static std::vector<uint8_t> received;
+static bool complete = false;
+
+static error_t memoryOpen(uint32_t size) {
+    received.assign(size, 0);
+    complete = false;
+    return NO_ERROR;
+}
+
+static error_t memoryWrite(uint32_t offset, const uint8_t* data, size_t size) {
+    memcpy(received.data() + offset, data, size);
+    return NO_ERROR;
+}
+
+static void memoryClose(bool done) {
+    complete = done;
+}
+
+constexpr uint32_t TARGET = 1;
+const bulk_sink_t sinks[]{
+    {TARGET, memoryOpen, memoryWrite, memoryClose},
+};
+
+constexpr command_t commands[]{
+    {1, nullptr, nullptr},
+};
+
+// Run a transfer to the end. Goes back to the last chunk acknowledged when nothing moves
+// for 50 ms, and stops after stop_at bytes if given.
+static error_t run(Sender& sender, int fd, uint32_t& retries, uint32_t stop_at = 0) {
+    error_t err;
+    uint32_t last = 0;
+    steady_clock::time_point since = steady_clock::now();
+    while ((err = sender.poll()) == ERROR_INCOMPLETE) {
+        if (stop_at && sender.acked() >= stop_at)
+            break;
+        waitReadable(fd);
+        if (sender.acked() != last) {
+            last  = sender.acked();
+            since = steady_clock::now();
+        } else if (steady_clock::now() - since > std::chrono::milliseconds(50)) {
+            sender.retry();
+            retries++;
+            since = steady_clock::now();
+        }
+    }
+    return err;
+}
+
+static bool checkTransfer(const char* name, PosixSlipProtocol& host, int fd, const std::vector<uint8_t>& blob,
+                          uint32_t transfer, uint32_t chunk) {
+    uint8_t rx[64];
+    Sender sender(host, rx, sizeof(rx));
+    uint32_t retries = 0;
+    steady_clock::time_point start = steady_clock::now();
+    error_t err = sender.begin(transfer, TARGET, blob.data(), blob.size(), chunk);
+    if (err == NO_ERROR)
+        err = run(sender, fd, retries);
+    double seconds = std::chrono::duration<double>(steady_clock::now() - start).count();
+    bool ok        = err == NO_ERROR && complete && received == blob;
+    printf("%-8s chunk %4u %s, %6.1f MB/s, %u chunks resent, %u timeouts\n", name, sender.chunkSize(),
+           ok ? "is OK" : "is NOT OK", blob.size() / seconds / 1e6, sender.resent(), retries);
+    return ok;
+}
+
+// a transfer dropped halfway carries on where the receiver got to
+static bool checkResume(PosixSlipProtocol& host, int fd, const std::vector<uint8_t>& blob) {
+    uint8_t rx[64];
+    uint32_t retries = 0;
+    Sender first(host, rx, sizeof(rx));
+    bool ok = first.begin(100, TARGET, blob.data(), blob.size(), 1024) == NO_ERROR &&
+              run(first, fd, retries, blob.size() / 2) == ERROR_INCOMPLETE;
+    // whatever the first sender had in flight is still arriving
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    PosixSlipProtocol::decoder_t stale(rx, sizeof(rx));
+    while (host.readSlipFrame(stale) != ERROR_INCOMPLETE) {}
+    Sender second(host, rx, sizeof(rx));
+    ok &= second.begin(100, TARGET, blob.data(), blob.size(), 1024) == NO_ERROR;
+    while (ok && second.acked() == 0 && second.poll() == ERROR_INCOMPLETE)
+        waitReadable(fd);
+    uint32_t resumed_at = second.acked();
+    ok &= resumed_at >= blob.size() / 2 && run(second, fd, retries) == NO_ERROR && complete && received == blob;
+    printf("resume from %u of %zu bytes %s\n", resumed_at, blob.size(), ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+// a target the receiver does not have ends the transfer with its error
+static bool checkRefused(PosixSlipProtocol& host, int fd, const std::vector<uint8_t>& blob) {
+    uint8_t rx[64];
+    uint32_t retries = 0;
+    Sender sender(host, rx, sizeof(rx));
+    bool ok = sender.begin(200, TARGET + 1, blob.data(), blob.size(), 1024) == NO_ERROR &&
+              run(sender, fd, retries) == ERROR_COMMAND;
+    printf("refused target %s\n", ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+// Copy bytes between two descriptors both ways, flipping a bit in about one byte in `one_in`.
+static void relay(int a, int b, uint32_t one_in, std::atomic<bool>& stop) {
+    uint32_t state = 777;
+    uint8_t buffer[4096];
+    while (!stop) {
+        struct pollfd pfd[2];
+        pfd[0].fd     = a;
+        pfd[0].events = POLLIN;
+        pfd[1].fd     = b;
+        pfd[1].events = POLLIN;
+        if (::poll(pfd, 2, 10) <= 0)
+            continue;
+        for (int i = 0; i < 2; i++) {
+            if (!(pfd[i].revents & POLLIN))
+                continue;
+            ssize_t n = ::read(pfd[i].fd, buffer, sizeof(buffer));
+            for (ssize_t j = 0; j < n; j++) {
+                state = state * 1103515245 + 12345;
+                if ((state >> 8) % one_in == 0)
+                    buffer[j] ^= static_cast<uint8_t>(1 << ((state >> 4) & 7));
+            }
+            for (ssize_t done = 0; done < n && !stop;) {
+                ssize_t w = ::write(pfd[1 - i].fd, buffer + done, n - done);
+                if (w > 0)
+                    done += w;
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+}
+
+int main() {
+    int master, slave, relay_master, relay_slave;
+    if (!PosixSlipProtocol::openPtyPair(master, slave) || !PosixSlipProtocol::openPtyPair(relay_master, relay_slave)) {
+        perror("openpty");
+        return 1;
+    }
+    PosixSlipProtocol device, host;
+    device.begin(slave);
+    host.begin(master);
+
+    std::atomic<bool> stop(false);
+    std::thread server_thread([&] {
+        static uint8_t rx[4096];
+        uint8_t tx[128];
+        CommandServer<PosixSlipProtocol> server(device, commands, rx, sizeof(rx), tx, sizeof(tx), 6, "slipbulk");
+        BulkReceiver bulk(sinks, bulkMaxChunk(sizeof(rx)), 8);
+        server.setFrameHandler(PROTO_BULK, BulkReceiver::handleFrame, &bulk);
+        while (!stop) {
+            if (server.poll() == ERROR_INCOMPLETE)
+                waitReadable(slave);
+        }
+    });
+
+    std::vector<uint8_t> blob(8 << 20);
+    for (uint8_t& c : blob)
+        c = nextByte();
+
+    bool ok = true;
+    const uint32_t chunks[]{256, 1024, 4096};
+    uint32_t transfer = 1;
+    for (uint32_t chunk : chunks)
+        ok &= checkTransfer("clean", host, master, blob, transfer++, chunk);
+    ok &= checkResume(host, master, blob);
+    ok &= checkRefused(host, master, blob);
+
+    // the same again with the host on the far side of a relay that damages frames
+    PosixSlipProtocol noisy;
+    noisy.begin(relay_master);
+    std::atomic<bool> stop_relay(false);
+    std::thread relay_thread(relay, relay_slave, master, 20000, std::ref(stop_relay));
+    std::vector<uint8_t> small(blob.begin(), blob.begin() + (1 << 20));
+    for (uint32_t chunk : chunks)
+        ok &= checkTransfer("noisy", noisy, relay_master, small, transfer++, chunk);
+
+    stop_relay = true;
+    relay_thread.join();
+    stop = true;
+    server_thread.join();
+    return ok ? 0 : 1;
+}
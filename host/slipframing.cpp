@@ -0,0 +1,172 @@
+// Host check of the compile-time framings. Random frames go through the frame encoder and
+// back through the decoder for the RFC 1055, debug and a custom SLIP framing and for COBS,
+// split into random sized pieces on both sides. The SLIP table scan must agree with a plain
+// compare, and frames written through SlipProtocolBase must read back through it. Then shows
+// the overhead of each framing on a CBOR payload full of text, which is why the readable bytes
+// are only for debugging.
+//
+// g++ -std=gnu++14 -O2 -I../firmware -I../lib/tinycbor/src slipframing.cpp -o slipframing
+
+#include "cobsproto.h"
+#include "slipproto.h"
+#include <cstdio>
+#include <vector>
+
+using namespace sproto;
+
+typedef SlipFraming<0x00, 0x7D, 0x5E, 0x5D> SlipZeroEnd; // custom: END is NUL
+
+static uint32_t rnd = 12345;
+
+static uint8_t nextByte() {
+    rnd = rnd * 1103515245 + 12345;
+    return static_cast<uint8_t>(rnd >> 16);
+}
+
+// payload with plenty of bytes that need escaping or stuffing
+static size_t fillPayload(uint8_t* payload, uint8_t a, uint8_t b) {
+    size_t size = 1 + nextByte() * 2;
+    for (size_t j = 0; j < size; j++) {
+        uint8_t c  = nextByte();
+        payload[j] = c < 64 ? a : c < 128 ? b : c;
+    }
+    return size;
+}
+
+// whole frame in pieces as small as 1 byte
+template <class F>
+static size_t encode(const slice_t* parts, size_t nparts, uint8_t* out) {
+    typename F::encoder_t encoder(parts, nparts, true);
+    size_t n = 0;
+    while (!encoder.done())
+        n += encoder.encode(out + n, 1 + nextByte() % 16);
+    return n;
+}
+
+template <class F>
+static bool checkScan(const char* name) {
+    bool ok = true;
+    uint8_t payload[512];
+    for (int i = 0; i < 200 && ok; i++) {
+        size_t size = fillPayload(payload, F::END, F::ESC);
+        for (const uint8_t* p = payload; p < payload + size; p++)
+            ok &= slipFindSpecial<F>(p, payload + size) == slipFindSpecialScalar<F>(p, payload + size);
+    }
+    printf("%-12s scan %s\n", name, ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+template <class F>
+static bool checkRoundTrip(const char* name, uint8_t a, uint8_t b) {
+    bool ok = true;
+    std::vector<uint8_t> payload(512), encoded(F::maxFrameSize(512)), frame(512 + 3);
+    for (int i = 0; i < 2000 && ok; i++) {
+        size_t size = fillPayload(payload.data(), a, b);
+        size_t cut  = nextByte() % size;
+        slice_t parts[]{{payload.data(), cut}, {nullptr, 0}, {payload.data() + cut, size - cut}};
+        size_t n = encode<F>(parts, 3, encoded.data());
+        ok &= n <= F::maxFrameSize(size);
+        for (size_t j = 0; j + 1 < n; j++)
+            ok &= encoded[j] != F::END;
+        // decode in random sized chunks to split escape pairs and blocks
+        typename F::decoder_t decoder(frame.data(), frame.size());
+        error_t err = ERROR_INCOMPLETE;
+        for (size_t pos = 0, nused = 0; pos < n && err == ERROR_INCOMPLETE; pos += nused) {
+            size_t chunk = 1 + nextByte() % 16;
+            err          = decoder.decode(encoded.data() + pos, chunk < n - pos ? chunk : n - pos, nused);
+        }
+        ok &= err == NO_ERROR && decoder.crcOk() && decoder.payloadSize() == size &&
+              memcmp(decoder.frame(), payload.data(), size) == 0;
+    }
+    printf("%-12s round trip %s\n", name, ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+// protocol that writes into and reads back from a memory buffer
+template <class F>
+class LoopbackProtocol : public SlipProtocolBase<LoopbackProtocol<F>, F> {
+    typedef SlipProtocolBase<LoopbackProtocol<F>, F> base_t;
+    friend base_t;
+
+ public:
+    LoopbackProtocol() : base_t(true), size_(0), pos_(0) {}
+
+ protected:
+    size_t writeBytes_impl(const uint8_t* buffer, size_t size) {
+        memcpy(buffer_ + size_, buffer, size);
+        size_ += size;
+        return size;
+    }
+
+    size_t readBytes_impl(uint8_t* buffer, size_t size) {
+        size_t n = size_ - pos_ < size ? size_ - pos_ : size;
+        n        = n < 7 ? n : 7; // small reads, like USB packets
+        memcpy(buffer, buffer_ + pos_, n);
+        pos_ += n;
+        return n;
+    }
+
+    void writeNow_impl() {}
+    bool isStreamReady_impl() { return true; }
+
+    uint8_t buffer_[4096];
+    size_t size_;
+    size_t pos_;
+};
+
+template <class F>
+static bool checkLink(const char* name) {
+    LoopbackProtocol<F> link;
+    uint8_t payload[512], rx[600];
+    size_t size = fillPayload(payload, F::END, 0xDB);
+    slice_t parts[]{{payload, 10}, {payload + 10, size - 10}};
+    bool ok = link.writeSlipFrame(parts, 2) == size && link.writeBareFrame(PROTO_ACK) == 1;
+    typename LoopbackProtocol<F>::decoder_t decoder(rx, sizeof(rx));
+    error_t err;
+    while ((err = link.readSlipFrame(decoder)) == ERROR_INCOMPLETE) {}
+    ok &= err == NO_ERROR && decoder.crcOk() && decoder.payloadSize() == size && memcmp(decoder.frame(), payload, size) == 0;
+    while ((err = link.readSlipFrame(decoder)) == ERROR_INCOMPLETE) {}
+    ok &= err == NO_ERROR && decoder.frameSize() == 1 && decoder.frame()[0] == PROTO_ACK;
+    printf("%-12s protocol link %s\n", name, ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+// a CBOR map of text strings, as a command with a text parameter would send
+static size_t textPayload(uint8_t* buf) {
+    static const char* const words[] = {"path", "C:\\data\\run#1", "label", "ch#2 \\ gain", "unit", "mV"};
+    size_t n = 0;
+    buf[n++] = 0xa3;
+    for (const char* w : words) {
+        size_t len = strlen(w);
+        buf[n++]   = static_cast<uint8_t>(0x60 + len);
+        memcpy(buf + n, w, len);
+        n += len;
+    }
+    return n;
+}
+
+template <class F>
+static void showOverhead(const char* name) {
+    uint8_t payload[64], encoded[2 * 64 + 5];
+    size_t size = textPayload(payload);
+    slice_t part{payload, size};
+    size_t n = encode<F>(&part, 1, encoded);
+    printf("%-12s %zu byte text payload, %zu bytes on the wire\n", name, size, n);
+}
+
+int main() {
+    bool ok = true;
+    ok &= checkScan<SlipRfc1055>("rfc1055");
+    ok &= checkScan<SlipDebugFraming>("debug");
+    ok &= checkScan<SlipZeroEnd>("zero end");
+    ok &= checkRoundTrip<SlipRfc1055>("rfc1055", SlipRfc1055::END, SlipRfc1055::ESC);
+    ok &= checkRoundTrip<SlipDebugFraming>("debug", SlipDebugFraming::END, SlipDebugFraming::ESC);
+    ok &= checkRoundTrip<SlipZeroEnd>("zero end", SlipZeroEnd::END, SlipZeroEnd::ESC);
+    ok &= checkRoundTrip<CobsFraming>("cobs", 0, SlipRfc1055::END);
+    ok &= checkLink<SlipRfc1055>("rfc1055");
+    ok &= checkLink<CobsFraming>("cobs");
+    showOverhead<SlipRfc1055>("rfc1055");
+    showOverhead<SlipDebugFraming>("debug");
+    showOverhead<CobsFraming>("cobs");
+    return ok ? 0 : 1;
+}
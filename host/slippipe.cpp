@@ -0,0 +1,379 @@
+// Host benchmark of pipelined commands over a pty loopback. A thread runs the firmware
+// CommandServer on the slave side, the CommandPipeline drives the master side. Then checks
+// the per-command statuses of batch frames, times commands sent in batches, and runs
+// commands through a relay that flips bits to check that lost frames are sent again and
+// no command runs twice, and that firmware which NAKs sequenced frames refuses them.
+//
+// g++ -std=gnu++14 -O2 -I../firmware -I../lib/FastCRC -I../lib/tinycbor/src slippipe.cpp
+//     ../lib/FastCRC/FastCRCsw.cpp ../lib/tinycbor/src/cborencoder.c ../lib/tinycbor/src/cborparser.c
+//     -lpthread -o slippipe
+
+#include "posixslip.h"
+#include "slippipeline.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace sproto;
+
+static uint32_t pattern = 0;
+
+// sleep until fd has input rather than spin, so the pty can make progress on one core
+static void waitReadable(int fd) {
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    ::poll(&pfd, 1, 10);
+}
+
+static error_t setPattern(CborValue& params, CborEncoder&) {
+    return cborReadArgs(params, pattern);
+}
+
+static error_t getPattern(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_uint(&reply, pattern));
+}
+
+// not idempotent, so a command run twice shows in the total
+static uint32_t total = 0;
+
+static error_t addTotal(CborValue& params, CborEncoder&) {
+    uint32_t value;
+    error_t err = cborReadArgs(params, value);
+    if (err == NO_ERROR)
+        total += value;
+    return err;
+}
+
+static error_t getTotal(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_uint(&reply, total));
+}
+
+static size_t encodePattern(uint8_t* params, uint32_t value) {
+    CborEncoder enc, array;
+    cbor_encoder_init(&enc, params, 6, 0);
+    cbor_encoder_create_array(&enc, &array, 1);
+    cbor_encode_uint(&array, value);
+    cbor_encoder_close_container(&enc, &array);
+    return cbor_encoder_get_buffer_size(&enc, params);
+}
+
+typedef CommandPipeline<PosixSlipProtocol, 8, 256> BatchPipeline;
+
+// send one batch and wait for its ACK
+static error_t roundTrip(BatchPipeline& pipeline, const CommandBatch& batch, int fd, const uint8_t*& reply, size_t& size) {
+    uint8_t seq;
+    error_t err = pipeline.submitBatch(batch, seq);
+    if (err != NO_ERROR)
+        return err;
+    while (!pipeline.done(seq)) {
+        if (pipeline.poll() == ERROR_INCOMPLETE)
+            waitReadable(fd);
+    }
+    err = pipeline.result(seq, reply, size);
+    pipeline.release(seq);
+    return err;
+}
+
+static bool checkBatch(PosixSlipProtocol& host, int fd) {
+    uint8_t rx[512], buffer[512], params[6];
+    BatchPipeline pipeline(host, rx, sizeof(rx), 1);
+    CommandBatch batch(buffer, sizeof(buffer));
+    batch.add(PROTO_SET, 1, params, encodePattern(params, 7));
+    batch.add(PROTO_GET, 1, nullptr, 0);
+    batch.add(PROTO_SET, 9, params, encodePattern(params, 8)); // no such command
+    batch.add(PROTO_SET, 1, params, encodePattern(params, 9));
+    batch.add(PROTO_GET, 1, nullptr, 0);
+    const uint8_t* reply;
+    size_t size;
+    bool ok = roundTrip(pipeline, batch, fd, reply, size) == NO_ERROR;
+    // the queries read back what the sets before them wrote, and the bad id fails alone
+    const error_t expect_status[]{NO_ERROR, NO_ERROR, ERROR_COMMAND, NO_ERROR, NO_ERROR};
+    const uint32_t expect_value[]{0, 7, 0, 0, 9};
+    BatchReplyReader entries(reply, ok ? size : 0);
+    for (size_t i = 0; i < 5 && ok; i++) {
+        error_t status;
+        slice_t result;
+        ok &= entries.next(status, result) == NO_ERROR && status == expect_status[i];
+        if (!ok || !expect_value[i])
+            continue;
+        CborSequenceReader items(result.data, result.size);
+        CborParser parser;
+        CborValue it, values;
+        uint32_t echo = 0, value = 0;
+        ok &= items.next(parser, it) == NO_ERROR && cborRead(it, echo) == NO_ERROR && echo == 1;
+        items.advance(it);
+        ok &= items.next(parser, it) == NO_ERROR && cbor_value_enter_container(&it, &values) == CborNoError &&
+              cborReadArgs(values, value) == NO_ERROR && value == expect_value[i];
+    }
+    error_t status;
+    slice_t result;
+    ok &= entries.next(status, result) == ERROR_INCOMPLETE;
+
+    // more commands than the server has reply room for: it stops early, and says so
+    batch.clear();
+    uint32_t added = 0;
+    while (batch.add(PROTO_SET, 1, params, encodePattern(params, added & 0x3f)) == NO_ERROR)
+        added++;
+    ok &= roundTrip(pipeline, batch, fd, reply, size) == NO_ERROR;
+    BatchReplyReader many(reply, ok ? size : 0);
+    uint32_t run = 0;
+    while (many.next(status, result) == NO_ERROR && status == NO_ERROR)
+        run++;
+    ok &= run > 0 && run < added && pattern == ((run - 1) & 0x3f);
+    printf("batch statuses %s, %u of %u commands run when the reply filled\n", ok ? "is OK" : "is NOT OK", run, added);
+    return ok;
+}
+
+// Copy bytes between two descriptors both ways, flipping a bit in about one byte in `one_in`.
+static void relay(int a, int b, uint32_t one_in, std::atomic<bool>& stop) {
+    uint32_t state = 777;
+    uint8_t buffer[4096];
+    while (!stop) {
+        struct pollfd pfd[2];
+        pfd[0].fd     = a;
+        pfd[0].events = POLLIN;
+        pfd[1].fd     = b;
+        pfd[1].events = POLLIN;
+        if (::poll(pfd, 2, 10) <= 0)
+            continue;
+        for (int i = 0; i < 2; i++) {
+            if (!(pfd[i].revents & POLLIN))
+                continue;
+            ssize_t n = ::read(pfd[i].fd, buffer, sizeof(buffer));
+            for (ssize_t j = 0; j < n; j++) {
+                state = state * 1103515245 + 12345;
+                if ((state >> 8) % one_in == 0)
+                    buffer[j] ^= static_cast<uint8_t>(1 << ((state >> 4) & 7));
+            }
+            for (ssize_t done = 0; done < n && !stop;) {
+                ssize_t w = ::write(pfd[1 - i].fd, buffer + done, n - done);
+                if (w > 0)
+                    done += w;
+                else
+                    std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        }
+    }
+}
+
+// Every command on a damaged link completes, each exactly once. Only a request that has
+// waited 50 ms is sent again by hand; the rest are repaired as soon as a NAK or a later
+// reply shows them missing.
+static bool checkLossy(PosixSlipProtocol& host, int fd, int count) {
+    uint8_t rx[256], params[6];
+    CommandPipeline<PosixSlipProtocol> pipeline(host, rx, sizeof(rx), 8);
+    uint8_t seqs[256];
+    std::chrono::steady_clock::time_point deadlines[256];
+    int sent = 0, acked = 0, failed = 0, timeouts = 0;
+    uint32_t expect = total;
+    while (acked + failed < count) {
+        while (sent < count && pipeline.ready()) {
+            uint8_t seq;
+            if (pipeline.submit(PROTO_SET, 2, params, encodePattern(params, sent & 0x3f), seq) != NO_ERROR)
+                break;
+            expect += sent & 0x3f;
+            deadlines[sent & 0xff] = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+            seqs[sent++ & 0xff]    = seq;
+        }
+        if (pipeline.poll() == ERROR_INCOMPLETE)
+            waitReadable(fd);
+        for (int i = acked + failed; i < sent; i++) {
+            if (pipeline.pending(seqs[i & 0xff]) && std::chrono::steady_clock::now() > deadlines[i & 0xff]) {
+                pipeline.resend(seqs[i & 0xff]);
+                deadlines[i & 0xff] = std::chrono::steady_clock::now() + std::chrono::milliseconds(50);
+                timeouts++;
+            }
+        }
+        while (acked + failed < sent && pipeline.done(seqs[(acked + failed) & 0xff])) {
+            uint8_t seq = seqs[(acked + failed) & 0xff];
+            const uint8_t* reply;
+            size_t size;
+            if (pipeline.result(seq, reply, size) == NO_ERROR)
+                acked++;
+            else
+                failed++;
+            pipeline.release(seq);
+        }
+    }
+    bool ok = failed == 0 && total == expect;
+    printf("lossy link %s, %d commands, %u sent again, %d after a timeout\n", ok ? "is OK" : "is NOT OK", count,
+           pipeline.resent(), timeouts);
+    return ok;
+}
+
+// Firmware that predates sequenced frames NAKs every one of them. The request is sent again
+// a few times, then completes as a NAK instead of waiting for a reply that never comes.
+static bool checkRefused() {
+    int master, slave;
+    if (!PosixSlipProtocol::openPtyPair(master, slave))
+        return false;
+    PosixSlipProtocol old_device, host;
+    old_device.begin(slave);
+    host.begin(master);
+    std::atomic<bool> stop(false);
+    std::thread old_thread([&] {
+        uint8_t rx[256];
+        PosixSlipProtocol::decoder_t decoder(rx, sizeof(rx));
+        while (!stop) {
+            error_t err = old_device.readSlipFrame(decoder);
+            if (err == ERROR_INCOMPLETE)
+                waitReadable(slave);
+            else if (err == NO_ERROR)
+                old_device.writeBareFrame(PROTO_NAK);
+        }
+    });
+
+    uint8_t rx[256];
+    CommandPipeline<PosixSlipProtocol> pipeline(host, rx, sizeof(rx), 1);
+    uint8_t seq;
+    bool ok = pipeline.submitCode(PROTO_QUERY, seq) == NO_ERROR;
+    auto until = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (ok && !pipeline.done(seq) && std::chrono::steady_clock::now() < until) {
+        if (pipeline.poll() == ERROR_INCOMPLETE)
+            waitReadable(master);
+    }
+    const uint8_t* reply;
+    size_t size;
+    ok &= pipeline.result(seq, reply, size) == ERROR_COMMAND && pipeline.resent() == pipeline.MAX_NAKS - 1;
+    printf("refused by unsequenced firmware %s, sent %u times\n", ok ? "is OK" : "is NOT OK", pipeline.resent() + 1);
+    stop = true;
+    old_thread.join();
+    ::close(slave);
+    ::close(master);
+    return ok;
+}
+
+constexpr command_t commands[]{
+    {1, setPattern, getPattern},
+    {2, addTotal, getTotal},
+};
+
+int main() {
+    int master, slave;
+    if (!PosixSlipProtocol::openPtyPair(master, slave)) {
+        perror("openpty");
+        return 1;
+    }
+    PosixSlipProtocol device, host;
+    device.begin(slave);
+    host.begin(master);
+
+    std::atomic<bool> stop(false);
+    std::thread server_thread([&] {
+        uint8_t rx[1024], tx[128], retain[8 * (CommandServer<PosixSlipProtocol>::RETAIN_HEAD + 3 + sizeof(tx))];
+        CommandServer<PosixSlipProtocol> server(device, commands, rx, sizeof(rx), tx, sizeof(tx), 2, "slippipe");
+        server.setRetainBuffer(retain, sizeof(retain), 8);
+        while (!stop) {
+            if (server.poll() == ERROR_INCOMPLETE)
+                waitReadable(slave);
+        }
+    });
+
+    const int count = 20000;
+    uint8_t rx[256];
+    for (size_t window = 1; window <= 8; window *= 2) {
+        CommandPipeline<PosixSlipProtocol> pipeline(host, rx, sizeof(rx), window);
+        uint8_t seqs[256];
+        int sent = 0, acked = 0, failed = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (acked + failed < count) {
+            while (sent < count && pipeline.ready()) {
+                uint8_t params[6];
+                CborEncoder enc, array;
+                cbor_encoder_init(&enc, params, sizeof(params), 0);
+                cbor_encoder_create_array(&enc, &array, 1);
+                cbor_encode_uint(&array, sent & 0x3f);
+                cbor_encoder_close_container(&enc, &array);
+                uint8_t seq;
+                if (pipeline.submit(PROTO_SET, 1, params, cbor_encoder_get_buffer_size(&enc, params), seq) != NO_ERROR)
+                    break;
+                seqs[sent++ & 0xff] = seq;
+            }
+            if (pipeline.poll() == ERROR_INCOMPLETE)
+                waitReadable(master);
+            // collect in order; replies may complete out of order
+            while (acked + failed < sent && pipeline.done(seqs[(acked + failed) & 0xff])) {
+                uint8_t seq = seqs[(acked + failed) & 0xff];
+                const uint8_t* reply;
+                size_t size;
+                if (pipeline.result(seq, reply, size) == NO_ERROR)
+                    acked++;
+                else
+                    failed++;
+                pipeline.release(seq);
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("window %zu: %8.0f commands/s, %d acked, %d failed\n", window, count / secs, acked, failed);
+    }
+
+    bool ok = checkBatch(host, master);
+    for (size_t per_batch = 4; per_batch <= 16; per_batch *= 2) {
+        uint8_t buffer[256], params[6];
+        BatchPipeline pipeline(host, rx, sizeof(rx), 4);
+        CommandBatch batch(buffer, sizeof(buffer));
+        uint8_t seqs[256];
+        int counts[256];
+        int sent = 0, acked = 0, failed = 0, batches = 0, collected = 0;
+        auto start = std::chrono::steady_clock::now();
+        while (acked + failed < count) {
+            while (sent < count && pipeline.ready()) {
+                batch.clear();
+                for (size_t i = 0; i < per_batch && sent + batch.count() < static_cast<size_t>(count); i++)
+                    batch.add(PROTO_SET, 1, params, encodePattern(params, (sent + i) & 0x3f));
+                uint8_t seq;
+                if (pipeline.submitBatch(batch, seq) != NO_ERROR)
+                    break;
+                sent += batch.count();
+                seqs[batches & 0xff]     = seq;
+                counts[batches++ & 0xff] = batch.count();
+            }
+            if (pipeline.poll() == ERROR_INCOMPLETE)
+                waitReadable(master);
+            while (collected < batches && pipeline.done(seqs[collected & 0xff])) {
+                uint8_t seq = seqs[collected & 0xff];
+                int commands = counts[collected++ & 0xff];
+                const uint8_t* reply;
+                size_t size;
+                error_t status;
+                slice_t result;
+                int run = 0;
+                if (pipeline.result(seq, reply, size) == NO_ERROR) {
+                    BatchReplyReader entries(reply, size);
+                    while (entries.next(status, result) == NO_ERROR) {
+                        run++;
+                        if (status == NO_ERROR)
+                            acked++;
+                        else
+                            failed++;
+                    }
+                }
+                failed += commands - run; // NAK'd, or not run
+                pipeline.release(seq);
+            }
+        }
+        double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        printf("batch %zu, window 4: %8.0f commands/s, %d acked, %d failed\n", per_batch, count / secs, acked, failed);
+    }
+
+    // the same server, with the host on the far side of a relay that damages frames
+    int relay_master, relay_slave;
+    if (!PosixSlipProtocol::openPtyPair(relay_master, relay_slave)) {
+        perror("openpty");
+        return 1;
+    }
+    PosixSlipProtocol noisy;
+    noisy.begin(relay_master);
+    std::atomic<bool> stop_relay(false);
+    std::thread relay_thread(relay, relay_slave, master, 2000, std::ref(stop_relay));
+    ok &= checkLossy(noisy, relay_master, count);
+    stop_relay = true;
+    relay_thread.join();
+    ok &= checkRefused();
+
+    stop = true;
+    server_thread.join();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// Host check of the threaded command server over a pty loopback. The firmware
+// ThreadedCommandServer runs on std::thread through StdThreadShim, the CommandPipeline drives
+// the master side. A slow command must not stop the server reading the requests behind it.
+//
+// g++ -std=gnu++14 -O2 -I../firmware -I../lib/FastCRC -I../lib/tinycbor/src slipthreads.cpp
+//     ../lib/FastCRC/FastCRCsw.cpp ../lib/tinycbor/src/cborencoder.c ../lib/tinycbor/src/cborparser.c
+//     -lpthread -o slipthreads
+
+#include "posixslip.h"
+#include "slippipeline.h"
+#include "slipthreads.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace sproto;
+
+static std::atomic<uint32_t> pattern(0);
+
+static void waitReadable(int fd) {
+    struct pollfd pfd;
+    pfd.fd     = fd;
+    pfd.events = POLLIN;
+    ::poll(&pfd, 1, 10);
+}
+
+static error_t setPattern(CborValue& params, CborEncoder&) {
+    uint32_t value;
+    error_t err = cborReadArgs(params, value);
+    if (err == NO_ERROR)
+        pattern = value;
+    return err;
+}
+
+static error_t getPattern(CborValue&, CborEncoder& reply) {
+    return cborCheck(cbor_encode_uint(&reply, pattern));
+}
+
+static error_t setSlow(CborValue& params, CborEncoder&) {
+    uint32_t ms;
+    error_t err = cborReadArgs(params, ms);
+    if (err == NO_ERROR)
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    return err;
+}
+
+constexpr command_t commands[]{
+    {1, setPattern, getPattern},
+    {2, setSlow, nullptr},
+};
+
+typedef ThreadedCommandServer<PosixSlipProtocol, StdThreadShim> server_t;
+
+static size_t encodeUint(uint8_t* params, size_t size, uint32_t value) {
+    CborEncoder enc, array;
+    cbor_encoder_init(&enc, params, size, 0);
+    cbor_encoder_create_array(&enc, &array, 1);
+    cbor_encode_uint(&array, value);
+    cbor_encoder_close_container(&enc, &array);
+    return cbor_encoder_get_buffer_size(&enc, params);
+}
+
+// collect every reply, in order
+static int drain(CommandPipeline<PosixSlipProtocol>& pipeline, int master, const uint8_t* seqs, int count) {
+    int acked = 0;
+    for (int i = 0; i < count;) {
+        if (!pipeline.done(seqs[i])) {
+            if (pipeline.poll() == ERROR_INCOMPLETE)
+                waitReadable(master);
+            continue;
+        }
+        const uint8_t* reply;
+        size_t size;
+        acked += pipeline.result(seqs[i], reply, size) == NO_ERROR;
+        pipeline.release(seqs[i++]);
+    }
+    return acked;
+}
+
+int main() {
+    int master, slave;
+    if (!PosixSlipProtocol::openPtyPair(master, slave)) {
+        perror("openpty");
+        return 1;
+    }
+    PosixSlipProtocol device, host;
+    device.begin(slave);
+    host.begin(master);
+
+    static server_t server(device, commands, 2, "slipthreads");
+    thread_config_t config{0, 0, 0};
+    if (!server.start(config, config, config)) {
+        printf("start failed\n");
+        return 1;
+    }
+
+    bool ok = true;
+    uint8_t rx[256], params[8], seqs[8];
+    CommandPipeline<PosixSlipProtocol> pipeline(host, rx, sizeof(rx), 8);
+
+    // a 200 ms command followed by fast ones: RX must parse them while dispatch sleeps
+    pipeline.submit(PROTO_SET, 2, params, encodeUint(params, sizeof(params), 200), seqs[0]);
+    for (int i = 1; i < 4; i++)
+        pipeline.submit(PROTO_SET, 1, params, encodeUint(params, sizeof(params), i), seqs[i]);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    uint32_t parsed = server.received();
+    int acked       = drain(pipeline, master, seqs, 4);
+    printf("parsed %u of 4 frames during a slow command, %d acked %s\n", parsed, acked, parsed == 4 && acked == 4 ? "is OK" : "is NOT OK");
+    ok &= parsed == 4 && acked == 4 && pattern == 3;
+
+    // throughput with a full window
+    const int count = 20000;
+    int sent = 0, done = 0;
+    uint8_t ring[256];
+    auto start = std::chrono::steady_clock::now();
+    while (done < count) {
+        while (sent < count && pipeline.ready()) {
+            if (pipeline.submit(PROTO_SET, 1, params, encodeUint(params, sizeof(params), sent & 0x3f), ring[sent & 0xff]) != NO_ERROR)
+                break;
+            sent++;
+        }
+        if (pipeline.poll() == ERROR_INCOMPLETE)
+            waitReadable(master);
+        while (done < sent && pipeline.done(ring[done & 0xff])) {
+            const uint8_t* reply;
+            size_t size;
+            ok &= pipeline.result(ring[done & 0xff], reply, size) == NO_ERROR;
+            pipeline.release(ring[done++ & 0xff]);
+        }
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("window 8: %8.0f commands/s %s\n", count / secs, ok ? "is OK" : "is NOT OK");
+
+    server.stop();
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,122 @@
+// Host check and benchmark of the SPSC receive ring under contention. A producer thread plays
+// the USB RX side, the main thread drains the ring, first as raw bytes, then into the
+// SlipDecoder the way ArduinoSlipProtocol::readBytes feeds it.
+//
+// g++ -std=gnu++14 -O2 -I../firmware -I../lib/tinycbor/src spscring.cpp -lpthread -o spscring
+
+#include "slipproto.h"
+#include "spscring.h"
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+using namespace sproto;
+
+typedef SpscRing<1024> ring_t;
+static ring_t ring;
+
+// producer pushes a counting byte stream in chunks of 1..max_chunk, single pushes for chunk 1
+static bool checkOrder(size_t max_chunk, size_t pop_size, size_t total) {
+    std::thread producer([=] {
+        uint8_t chunk[256];
+        uint8_t next = 0;
+        size_t sent  = 0;
+        uint32_t rnd = 12345;
+        while (sent < total) {
+            rnd      = rnd * 1103515245 + 12345;
+            size_t n = 1 + (rnd >> 16) % max_chunk;
+            if (n > total - sent)
+                n = total - sent;
+            for (size_t i = 0; i < n; i++)
+                chunk[i] = next + i;
+            size_t done = n == 1 ? (ring.push(chunk[0]) ? 1 : 0) : ring.push(chunk, n);
+            next += done;
+            sent += done;
+            if (done < n)
+                std::this_thread::yield();
+        }
+    });
+
+    std::vector<uint8_t> buf(pop_size);
+    uint8_t expect = 0;
+    size_t got     = 0;
+    bool ok        = true;
+    auto start     = std::chrono::steady_clock::now();
+    while (got < total) {
+        size_t n = ring.pop(buf.data(), buf.size());
+        if (n == 0) {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < n; i++)
+            ok &= buf[i] == uint8_t(expect + i);
+        expect += n;
+        got += n;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    producer.join();
+    printf("push <=%3zu pop %4zu: %8.1f MB/s %s\n", max_chunk, pop_size, total / secs / 1e6, ok ? "is OK" : "is NOT OK");
+    return ok;
+}
+
+// producer pushes escaped frames, the decoder reads them in place with batch pops
+static bool checkFrames(size_t frames) {
+    uint8_t payload[100];
+    for (size_t i = 0; i < sizeof(payload); i++)
+        payload[i] = i % 3 == 0 ? SLIP_END : i % 3 == 1 ? SLIP_ESC : i;
+    uint8_t escaped[2 * sizeof(payload) + 1];
+    const uint8_t* src = payload;
+    size_t size        = slipEscape(src, payload + sizeof(payload), escaped, sizeof(escaped));
+    escaped[size++]    = SLIP_END;
+
+    std::thread producer([&] {
+        for (size_t f = 0; f < frames; f++) {
+            size_t done = 0;
+            while (done < size) {
+                done += ring.push(escaped + done, size - done);
+                if (done < size)
+                    std::this_thread::yield();
+            }
+        }
+    });
+
+    uint8_t rx[256];
+    SlipDecoder decoder(rx, sizeof(rx));
+    size_t good = 0, bad = 0;
+    auto start = std::chrono::steady_clock::now();
+    while (good + bad < frames) {
+        error_t err = ERROR_INCOMPLETE;
+        if (decoder.pending())
+            err = decoder.commit(0); // a frame may already be buffered behind the last one
+        if (err == ERROR_INCOMPLETE) {
+            size_t n = ring.pop(decoder.rxbegin(), decoder.rxsize());
+            if (n == 0) {
+                std::this_thread::yield();
+                continue;
+            }
+            err = decoder.commit(n);
+        }
+        if (err == ERROR_INCOMPLETE)
+            continue;
+        if (err == NO_ERROR && decoder.frameSize() == sizeof(payload) && memcmp(decoder.frame(), payload, sizeof(payload)) == 0)
+            good++;
+        else
+            bad++;
+    }
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    producer.join();
+    printf("slip frames: %8.0f frames/s, %zu good, %zu bad %s\n", frames / secs, good, bad, bad == 0 ? "is OK" : "is NOT OK");
+    return bad == 0;
+}
+
+int main() {
+    bool ok = true;
+    ok &= checkOrder(1, 64, 1 << 22);
+    ok &= checkOrder(64, 64, 1 << 26);
+    ok &= checkOrder(256, 1024, 1 << 26);
+    ok &= checkOrder(256, 7, 1 << 24);
+    ok &= checkFrames(200000);
+    return ok ? 0 : 1;
+}
@@ -61,6 +61,13 @@
 #define CRC_SW 1
 #endif
 
+// x86 host builds can fold KERMIT with PCLMULQDQ, chosen at runtime by CPUID
+#if CRC_SW && !defined(ARDUINO) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC_CLMUL 1
+#else
+#define CRC_CLMUL 0
+#endif
+
 // ================= 7-BIT CRC ===================
 class FastCRC7
 {
@@ -148,6 +155,15 @@ public:
   uint16_t modbus_upd(const uint8_t *data, uint16_t len);			// Call for subsequent calculations with previous seed
   uint16_t xmodem_upd(const uint8_t *data, uint16_t len);			// Call for subsequent calculations with previous seed
   uint16_t x25_upd(const uint8_t *data, uint16_t len);				// Call for subsequent calculations with previous seed
+#if CRC_SW
+  // KERMIT variants. kermit_upd uses n4 on microcontrollers, the fastest supported one on hosts.
+  uint16_t kermit_upd_n4(const uint8_t *data, uint16_t len);		// Slicing-by-4
+  uint16_t kermit_upd_n8(const uint8_t *data, uint16_t len);		// Slicing-by-8
+#if CRC_CLMUL
+  uint16_t kermit_upd_clmul(const uint8_t *data, uint16_t len);	// Carry-less multiply folding. Check clmul_supported() first
+  static bool clmul_supported();
+#endif
+#endif
 #if !CRC_SW
   uint16_t generic(const uint16_t polyom, const uint16_t seed, const uint32_t flags, const uint8_t *data, const uint16_t datalen); //Not available in non-hw-variant (not T3.x)
 #endif
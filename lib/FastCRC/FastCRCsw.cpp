@@ -51,6 +51,10 @@
 #include "FastCRC_cpu.h"
 #include "FastCRC_tables.h"
 
+#if CRC_CLMUL
+#include <immintrin.h>
+#endif
+
 
 // ================= 7-BIT CRC ===================
 
@@ -274,6 +278,22 @@ uint16_t FastCRC16::modbus(const uint8_t *data, const uint16_t datalen)
  * @return CRC value
  */
 uint16_t FastCRC16::kermit_upd(const uint8_t *data, uint16_t len)
+{
+#if CRC_CLMUL
+	static const bool clmul = clmul_supported();
+	if (clmul && len >= 32)
+		return kermit_upd_clmul(data, len);
+	return kermit_upd_n8(data, len);
+#elif !defined(ARDUINO)
+	return kermit_upd_n8(data, len);
+#else
+	return kermit_upd_n4(data, len);
+#endif
+}
+
+/** KERMIT, slicing-by-4
+ */
+uint16_t FastCRC16::kermit_upd_n4(const uint8_t *data, uint16_t len)
 {
 
 	uint16_t crc = seed;
@@ -300,6 +320,114 @@ uint16_t FastCRC16::kermit_upd(const uint8_t *data, uint16_t len)
 	return crc;
 }
 
+#define crc_n8(crc, data0, data1, table, table8) crc ^= data0; \
+	crc = pgm_read_word(&table8[(crc & 0xff) + 0x300]) ^		\
+	pgm_read_word(&table8[((crc >> 8) & 0xff) + 0x200]) ^	\
+	pgm_read_word(&table8[((data0 >> 16) & 0xff) + 0x100]) ^	\
+	pgm_read_word(&table8[data0 >> 24]) ^	\
+	pgm_read_word(&table[(data1 & 0xff) + 0x300]) ^	\
+	pgm_read_word(&table[((data1 >> 8) & 0xff) + 0x200]) ^	\
+	pgm_read_word(&table[((data1 >> 16) & 0xff) + 0x100]) ^	\
+	pgm_read_word(&table[data1 >> 24]);
+
+/** KERMIT, slicing-by-8
+ * Twice the table size of slicing-by-4 for half the loop iterations.
+ */
+uint16_t FastCRC16::kermit_upd_n8(const uint8_t *data, uint16_t len)
+{
+
+	uint16_t crc = seed;
+
+	while (((uintptr_t)data & 3) && len) {
+		crc = (crc >> 8) ^ pgm_read_word(&crc_table_kermit[(crc & 0xff) ^ *data++]);
+		len--;
+	}
+
+	while (len >= 16) {
+		len -= 16;
+		crc_n8(crc, ((uint32_t *)data)[0], ((uint32_t *)data)[1], crc_table_kermit, crc_table_kermit8);
+		crc_n8(crc, ((uint32_t *)data)[2], ((uint32_t *)data)[3], crc_table_kermit, crc_table_kermit8);
+		data += 16;
+	}
+
+	while (len--) {
+		crc = (crc >> 8) ^ pgm_read_word(&crc_table_kermit[(crc & 0xff) ^ *data++]);
+	}
+
+	seed = crc;
+	return crc;
+}
+
+#if CRC_CLMUL
+/** PCLMULQDQ is available on this CPU
+ */
+bool FastCRC16::clmul_supported()
+{
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+}
+
+// Fold a 128-bit remainder forward over N bits and add the next block. The low qword of k is
+// x^(N+63) mod P, the high qword x^(N-1) mod P, both bit-reflected into the top 16 bits.
+__attribute__((target("pclmul,sse2")))
+static inline __m128i kermit_fold(__m128i r, __m128i k, __m128i next)
+{
+	__m128i lo = _mm_clmulepi64_si128(r, k, 0x00);
+	__m128i hi = _mm_clmulepi64_si128(r, k, 0x11);
+	return _mm_xor_si128(_mm_xor_si128(lo, hi), next);
+}
+
+/** KERMIT, carry-less multiply folding
+ * Folds four 16-byte lanes in parallel, then finishes the last remainder and any tail with
+ * slicing-by-8. Only call when clmul_supported().
+ */
+__attribute__((target("pclmul,sse2")))
+uint16_t FastCRC16::kermit_upd_clmul(const uint8_t *data, uint16_t len)
+{
+	if (len < 32)
+		return kermit_upd_n8(data, len);
+
+	const __m128i k128 = _mm_set_epi64x(0x7eea000000000000LL, (long long)0xa95d000000000000ULL);
+	const __m128i k512 = _mm_set_epi64x(0x7f90000000000000LL, (long long)0x9822000000000000ULL);
+
+	// a reflected CRC seed is the same as xoring it into the first two bytes
+	__m128i r0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *)data), _mm_cvtsi32_si128(seed));
+	data += 16;
+	len -= 16;
+
+	if (len >= 48) {
+		__m128i r1 = _mm_loadu_si128((const __m128i *)data);
+		__m128i r2 = _mm_loadu_si128((const __m128i *)(data + 16));
+		__m128i r3 = _mm_loadu_si128((const __m128i *)(data + 32));
+		data += 48;
+		len -= 48;
+		while (len >= 64) {
+			r0 = kermit_fold(r0, k512, _mm_loadu_si128((const __m128i *)data));
+			r1 = kermit_fold(r1, k512, _mm_loadu_si128((const __m128i *)(data + 16)));
+			r2 = kermit_fold(r2, k512, _mm_loadu_si128((const __m128i *)(data + 32)));
+			r3 = kermit_fold(r3, k512, _mm_loadu_si128((const __m128i *)(data + 48)));
+			data += 64;
+			len -= 64;
+		}
+		r0 = kermit_fold(r0, k128, r1);
+		r0 = kermit_fold(r0, k128, r2);
+		r0 = kermit_fold(r0, k128, r3);
+	}
+
+	while (len >= 16) {
+		r0 = kermit_fold(r0, k128, _mm_loadu_si128((const __m128i *)data));
+		data += 16;
+		len -= 16;
+	}
+
+	// the remainder is congruent to everything so far: CRC it as plain data
+	uint8_t rest[16];
+	_mm_storeu_si128((__m128i *)rest, r0);
+	seed = 0;
+	kermit_upd_n8(rest, sizeof(rest));
+	return kermit_upd_n8(data, len);
+}
+#endif
+
 uint16_t FastCRC16::kermit(const uint8_t *data, const uint16_t datalen)
 {
  // poly=0x1021 init=0x0000 refin=true refout=true xorout=0x0000 check=0x2189
@@ -144,6 +144,18 @@ void setup() {
   crc = CRC16.kermit(buf, BUFSIZE);
   time = micros() - time;
   printVals("KERMIT FastCRC:", crc, time);
+
+  CRC16.kermit(buf, 0);
+  time = micros();
+  crc = CRC16.kermit_upd_n4(buf, BUFSIZE);
+  time = micros() - time;
+  printVals("KERMIT slicing-by-4:", crc, time);
+
+  CRC16.kermit(buf, 0);
+  time = micros();
+  crc = CRC16.kermit_upd_n8(buf, BUFSIZE);
+  time = micros() - time;
+  printVals("KERMIT slicing-by-8:", crc, time);
 #endif
 
 
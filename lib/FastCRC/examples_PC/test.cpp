@@ -1,11 +1,64 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
 #include "FastCRC.h"
 
-// g++ -std=gnu++11 test.cpp FastCRCsw.cpp -otest.exe
+// g++ -std=gnu++11 -O2 test.cpp FastCRCsw.cpp -otest.exe
 
+FastCRC16 CRC16;
 FastCRC32 CRC32;
 uint8_t buf[9] = {'1','2','3','4','5','6','7','8','9'};
 
+typedef uint16_t (FastCRC16::*kermit_fn)(const uint8_t *data, uint16_t len);
+
+struct kermit_variant {
+  const char *name;
+  kermit_fn fn;
+};
+
+const kermit_variant kermit_variants[] = {
+  {"kermit n4   ", &FastCRC16::kermit_upd_n4},
+  {"kermit n8   ", &FastCRC16::kermit_upd_n8},
+#if CRC_CLMUL
+  {"kermit clmul", &FastCRC16::kermit_upd_clmul},
+#endif
+};
+const int kermit_count = sizeof(kermit_variants) / sizeof(kermit_variants[0]);
+
+uint16_t kermit_with(kermit_fn fn, const uint8_t *data, uint16_t len)
+{
+  CRC16.kermit(NULL, 0); // reset seed
+  return (CRC16.*fn)(data, len);
+}
+
+// every variant must agree with n4 at every length and alignment
+bool kermit_agree(kermit_fn fn)
+{
+  static uint8_t data[1024 + 16];
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = rand();
+  for (int offset = 0; offset < 16; offset++) {
+    for (uint16_t len = 0; len <= 1024; len++) {
+      if (kermit_with(fn, data + offset, len) != kermit_with(&FastCRC16::kermit_upd_n4, data + offset, len))
+        return false;
+    }
+  }
+  return true;
+}
+
+void kermit_bench(const kermit_variant &v, uint16_t len)
+{
+  static uint8_t data[65535];
+  for (size_t i = 0; i < sizeof(data); i++)
+    data[i] = i;
+  const long total = 256L * 1024 * 1024;
+  uint16_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (long done = 0; done < total; done += len)
+    sink += kermit_with(v.fn, data, len);
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%s %5u bytes: %8.1f MB/s (%04x)\n", v.name, len, total / secs / 1e6, sink);
+}
 
 int main()
 {
@@ -18,4 +71,30 @@ int main()
   crc = CRC32.cksum(buf, sizeof(buf));
   printf("cksum %s\n", 0x765e7680 == crc ? "is OK" : "is NOT OK");
 
-}
\ No newline at end of file
+  crc = CRC16.kermit(buf, sizeof(buf));
+  printf("kermit %s\n", 0x2189 == crc ? "is OK" : "is NOT OK");
+
+#if CRC_CLMUL
+  printf("pclmul %s\n", FastCRC16::clmul_supported() ? "is supported" : "is NOT supported");
+#endif
+
+  for (int i = 0; i < kermit_count; i++) {
+    const kermit_variant &v = kermit_variants[i];
+#if CRC_CLMUL
+    if (v.fn == &FastCRC16::kermit_upd_clmul && !FastCRC16::clmul_supported())
+      continue;
+#endif
+    printf("%s %s\n", v.name, kermit_agree(v.fn) ? "is OK" : "is NOT OK");
+  }
+
+  const uint16_t lengths[] = {64, 1024, 65535};
+  for (uint16_t len : lengths) {
+    for (int i = 0; i < kermit_count; i++) {
+#if CRC_CLMUL
+      if (kermit_variants[i].fn == &FastCRC16::kermit_upd_clmul && !FastCRC16::clmul_supported())
+        continue;
+#endif
+      kermit_bench(kermit_variants[i], len);
+    }
+  }
+}
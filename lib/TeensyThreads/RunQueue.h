@@ -0,0 +1,124 @@
+/*
+ * RunQueue.h - Priority ready queue for the TeensyThreads scheduler.
+ *
+ * Kept free of Arduino headers so the scheduling decision can be tested
+ * and benchmarked on a host.
+ *
+ *******************
+ *
+ * Each priority level has a circular, doubly linked list of thread ids,
+ * and a bitmap records which levels are non-empty. Picking the next
+ * thread is a count-leading-zeros on the bitmap plus a list head, so a
+ * context switch costs the same whatever MAX_THREADS is.
+ *
+ * Threads that stop running (suspended, killed, ended) are not removed
+ * when their state changes; next() drops them when they reach the head.
+ * Threads that start running again must be put back with insert().
+ */
+#ifndef _RUNQUEUE_H
+#define _RUNQUEUE_H
+
+#include <stdint.h>
+
+template <int N, int LEVELS>
+class RunQueue {
+  static_assert(N <= 127, "thread ids are stored in int8_t");
+  static_assert(LEVELS <= 32, "one bitmap word of levels");
+
+private:
+  uint32_t ready = 0;     // bit p set when level p has threads
+  int8_t head[LEVELS];    // next thread to run at each level, -1 if none
+  int8_t next_id[N];
+  int8_t prev_id[N];
+  uint8_t prio[N];
+  uint8_t queued[N];
+
+public:
+  RunQueue() {
+    for (int p = 0; p < LEVELS; p++) head[p] = -1;
+    for (int i = 0; i < N; i++) {
+      prio[i] = 0;
+      queued[i] = 0;
+    }
+  }
+
+  bool contains(int id) const { return queued[id]; }
+  int priority(int id) const { return prio[id]; }
+
+  // Highest level with a queued thread, -1 if none
+  int topPriority() const {
+    return ready ? 31 - __builtin_clz(ready) : -1;
+  }
+
+  // Thread at the head of the highest level, -1 if none
+  int top() const {
+    return ready ? head[topPriority()] : -1;
+  }
+
+  // Queue id behind the other threads of its level. No-op if already queued.
+  void insert(int id) {
+    if (queued[id]) return;
+    queued[id] = 1;
+    int p = prio[id];
+    int h = head[p];
+    if (h < 0) {
+      head[p] = next_id[id] = prev_id[id] = id;
+      ready |= 1u << p;
+      return;
+    }
+    int t = prev_id[h];
+    next_id[t] = id;
+    prev_id[id] = t;
+    next_id[id] = h;
+    prev_id[h] = id;
+  }
+
+  void remove(int id) {
+    if (!queued[id]) return;
+    queued[id] = 0;
+    int p = prio[id];
+    if (next_id[id] == id) {
+      head[p] = -1;
+      ready &= ~(1u << p);
+      return;
+    }
+    next_id[prev_id[id]] = next_id[id];
+    prev_id[next_id[id]] = prev_id[id];
+    if (head[p] == id) head[p] = next_id[id];
+  }
+
+  // Change the level of id; a queued thread moves to the back of the new level
+  void setPriority(int id, int p) {
+    if (queued[id]) {
+      remove(id);
+      prio[id] = p;
+      insert(id);
+    }
+    else {
+      prio[id] = p;
+    }
+  }
+
+  // True if other threads are queued at the level of id, so it needs a time slice
+  bool shared(int id) const { return queued[id] && next_id[id] != id; }
+
+  // Send id to the back of its level, if it is at the front
+  void rotate(int id) {
+    if (queued[id] && head[prio[id]] == id) head[prio[id]] = next_id[id];
+  }
+
+  /*
+   * Pick the thread to run after current. A runnable current thread goes
+   * behind its equals (round robin within a level); threads found not
+   * runnable are dropped. Returns -1 if nothing is runnable.
+   */
+  template <class F>
+  int next(int current, F runnable) {
+    if (runnable(current)) rotate(current);
+    int id;
+    while ((id = top()) >= 0 && !runnable(id)) remove(id);
+    return id;
+  }
+};
+
+#endif
@@ -40,6 +40,17 @@ unsigned int time_end;
 
 #define __flush_cpu() __asm__ volatile("DMB");
 
+// Disable interrupts and return the previous state, for code that may run in an ISR
+static inline uint32_t irq_save() {
+  uint32_t primask;
+  __asm__ volatile("mrs %0, primask\n cpsid i" : "=r" (primask) : : "memory");
+  return primask;
+}
+
+static inline void irq_restore(uint32_t primask) {
+  __asm__ volatile("msr primask, %0" : : "r" (primask) : "memory");
+}
+
 // These variables are used by the assembly context_switch() function.
 // They are copies or pointers to data in Threads and ThreadInfo
 // and put here seperately in order to simplify the code.
@@ -131,18 +142,46 @@ void __attribute((naked, noinline)) threads_svcall_isr(void)
  * 
  * Teensy 4:
  * Use unused GPT timers for context switching
+ *
+ * The GPT runs free at 1 MHz and is tickless: getNextThread() programs the
+ * compare register for the end of the slice when another thread of the same
+ * priority is waiting, or else for the nearest timed-wait deadline. A thread
+ * that runs alone, or a system where every thread waits, takes no timer
+ * interrupts. The counter is also the clock for wait deadlines.
  */
 
 extern "C" void unused_interrupt_vector(void);
 
+static volatile uint32_t *gpt_ocr;  // compare and counter registers of the GPT in use
+static volatile uint32_t *gpt_cnt;
+static int gpt_irq = -1;
+static uint32_t gpt_tick_us = 1000; // length of one tick of a time slice
+
+// longest the GPT sleeps without a deadline, so a stopped scheduler still gets checked
+static const uint32_t gpt_idle_us = 1000000;
+// nearest compare the GPT is given, so it can't be set behind the counter
+static const uint32_t gpt_min_us = 5;
+
+static inline uint32_t deadline_clock() {
+  return gpt_cnt ? *gpt_cnt : micros();
+}
+static const uint32_t deadline_per_ms = 1000; // so waits top out near 35 minutes
+
+static void gpt_program(uint32_t delta_us) {
+  if (delta_us < gpt_min_us) delta_us = gpt_min_us;
+  *gpt_ocr = *gpt_cnt + delta_us;
+}
+
 static void __attribute((naked, noinline)) gpt1_isr() {
   GPT1_SR |= GPT_SR_OF1;  // clear set bit
+  GPT1_OCR1 = GPT1_CNT + gpt_idle_us; // getNextThread() sets the real deadline
   __asm volatile ("dsb"); // see github bug #20 by manitou48
   __asm volatile("b context_switch");
 }
 
 static void __attribute((naked, noinline)) gpt2_isr() {
   GPT2_SR |= GPT_SR_OF1;  // clear set bit
+  GPT2_OCR1 = GPT2_CNT + gpt_idle_us; // getNextThread() sets the real deadline
   __asm volatile ("dsb"); // see github bug #20 by manitou48
   __asm volatile("b context_switch");
 }
@@ -176,6 +215,8 @@ bool gtp1_init(unsigned int microseconds)
     }
   }
 
+  gpt_tick_us = microseconds;
+
   switch (gpt_number) {
     case 1:
       CCM_CCGR1 |= CCM_CCGR1_GPT1_BUS(CCM_CCGR_ON) ;  // enable GPT1 module
@@ -184,7 +225,10 @@ bool gtp1_init(unsigned int microseconds)
       GPT1_OCR1 = microseconds - 1;  // compare value
       GPT1_SR = 0x3F;                // clear all prior status
       GPT1_IR = GPT_IR_OF1IE;        // use first timer
-      GPT1_CR = GPT_CR_EN | GPT_CR_CLKSRC(1) ; // set to peripheral clock (24MHz)
+      GPT1_CR = GPT_CR_EN | GPT_CR_FRR | GPT_CR_CLKSRC(1) ; // free run from peripheral clock (24MHz)
+      gpt_ocr = &GPT1_OCR1;
+      gpt_cnt = &GPT1_CNT;
+      gpt_irq = IRQ_GPT1;
       break;
     case 2:
       CCM_CCGR1 |= CCM_CCGR1_GPT1_BUS(CCM_CCGR_ON) ;  // enable GPT1 module
@@ -193,7 +237,10 @@ bool gtp1_init(unsigned int microseconds)
       GPT2_OCR1 = microseconds - 1;  // compare value
       GPT2_SR = 0x3F;                // clear all prior status
       GPT2_IR = GPT_IR_OF1IE;        // use first timer
-      GPT2_CR = GPT_CR_EN | GPT_CR_CLKSRC(1) ; // set to peripheral clock (24MHz)
+      GPT2_CR = GPT_CR_EN | GPT_CR_FRR | GPT_CR_CLKSRC(1) ; // free run from peripheral clock (24MHz)
+      gpt_ocr = &GPT2_OCR1;
+      gpt_cnt = &GPT2_CNT;
+      gpt_irq = IRQ_GPT2;
       break;
     default:
       return false;
@@ -202,8 +249,20 @@ bool gtp1_init(unsigned int microseconds)
   return true;
 }
 
+#else
+
+static inline uint32_t deadline_clock() {
+  return systick_millis_count;
+}
+static const uint32_t deadline_per_ms = 1;
+
 #endif
 
+// Timeout in milliseconds to deadline_clock() units, capped to stay within int32_t
+static inline uint32_t deadline_from_ms(unsigned int ms) {
+  return ms < 0x7FFFFFFF / deadline_per_ms ? ms * deadline_per_ms : 0x7FFFFFFF;
+}
+
 /*************************************************/
 /**\name UTILITIES FUNCTIONS                     */
 /*************************************************/
@@ -258,6 +317,7 @@ Threads::Threads() : current_thread(0), thread_count(0), thread_error(0) {
   currentCount = Threads::DEFAULT_TICKS;
   currentActive = FIRST_RUN;
   threadp[0]->flags = RUNNING;
+  runq.insert(0);
   threadp[0]->ticks = DEFAULT_TICKS;
   threadp[0]->stack = (uint8_t*)&_estack - DEFAULT_STACK0_SIZE;
   threadp[0]->stack_size = DEFAULT_STACK0_SIZE;
@@ -304,6 +364,10 @@ int Threads::start(int prev_state) {
   int old_state = currentActive;
   if (prev_state == -1) prev_state = STARTED;
   currentActive = prev_state;
+#ifdef __IMXRT1062__
+  // switches were skipped while stopped, so look again within a tick
+  if (gpt_ocr) gpt_program(gpt_tick_us);
+#endif
   __enable_irq();
   return old_state;
 }
@@ -344,17 +408,41 @@ void Threads::getNextThread() {
     stack_overflow_isr();
   }
 
-  // Find the next running thread
-  while(1) {
-    current_thread++;
-    if (current_thread >= MAX_THREADS) {
-      current_thread = 0; // thread 0 is MSP; always active so return
-      break;
+  // End timed waits whose deadline passed, and find the nearest one left
+  uint32_t now = deadline_clock();
+  int32_t nearest = 0x7FFFFFFF;
+  uint32_t timed = timed_waiters;
+  while (timed) {
+    int id = __builtin_ctz(timed);
+    timed &= timed - 1;
+    int32_t left = (int32_t)(threadp[id]->wait_deadline - now);
+    if (left <= 0) {
+      timed_waiters &= ~(1u << id);
+      ready(id);
+    }
+    else if (left < nearest) {
+      nearest = left;
     }
-    if (threadp[current_thread] && threadp[current_thread]->flags == RUNNING) break;
   }
+
+  // Highest priority running thread, round robin among equals
+  int next = runq.next(current_thread, [this](int id) { return threadp[id]->flags == RUNNING; });
+  current_thread = next >= 0 ? next : 0; // thread 0 is MSP; always active
+  preempt_pending = 0;
   currentCount = threadp[current_thread]->ticks;
 
+#ifdef __IMXRT1062__
+  // Tickless: every GPT interrupt switches, so program it for the next reason to
+  if (gpt_ocr) {
+    currentCount = 0;
+    if (next >= 0 && runq.shared(next)) {
+      int32_t slice = (threadp[next]->ticks + 1) * gpt_tick_us;
+      if (slice < nearest) nearest = slice;
+    }
+    gpt_program(nearest < (int32_t)gpt_idle_us ? nearest : gpt_idle_us);
+  }
+#endif
+
   currentThread = threadp[current_thread];
   currentSave = &threadp[current_thread]->save;
   currentMSP = (current_thread==0?1:0);
@@ -562,8 +650,11 @@ int Threads::addThread(ThreadFunction p, void * arg, int stack_size, void *stack
       void *psp = loadstack(p, arg, tp->stack, tp->stack_size);
       tp->sp = psp;
       tp->ticks = DEFAULT_TICKS;
-      tp->flags = RUNNING;
       tp->save.lr = 0xFFFFFFF9;
+      __disable_irq();
+      runq.setPriority(i, DEFAULT_PRIORITY);
+      ready(i);
+      __enable_irq();
 
 #ifdef DEBUG
       tp->cyclesStart = ARM_DWT_CYCCNT;
@@ -587,7 +678,14 @@ int Threads::getState(int id)
 
 int Threads::setState(int id, int state)
 {
-  threadp[id]->flags = state;
+  if (state == RUNNING) {
+    __disable_irq();
+    ready(id);
+    __enable_irq();
+  }
+  else {
+    threadp[id]->flags = state;
+  }
   return state;
 }
 
@@ -620,10 +718,85 @@ int Threads::suspend(int id)
 
 int Threads::restart(int id)
 {
-  threadp[id]->flags = RUNNING;
+  __disable_irq();
+  ready(id);
+  __enable_irq();
+  preempt();
   return id;
 }
 
+void Threads::setPriority(int id, int priority)
+{
+  if (priority < 0) priority = 0;
+  if (priority >= PRIORITY_LEVELS) priority = PRIORITY_LEVELS - 1;
+  __disable_irq();
+  runq.setPriority(id, priority);
+  __enable_irq();
+}
+
+int Threads::getPriority(int id)
+{
+  return runq.priority(id);
+}
+
+void Threads::ready(int id)
+{
+  threadp[id]->flags = RUNNING;
+  runq.insert(id);
+  int priority = runq.priority(id);
+  int current = runq.priority(current_thread);
+  if (priority > current) {
+    preempt_pending = 1;
+  }
+#ifdef __IMXRT1062__
+  else if (priority == current && id != current_thread && gpt_ocr) {
+    // the current thread now shares its level, so its slice has to end
+    int32_t slice = (threadp[current_thread]->ticks + 1) * gpt_tick_us;
+    if ((int32_t)(*gpt_ocr - *gpt_cnt) > slice) gpt_program(slice);
+  }
+#endif
+}
+
+void Threads::preempt()
+{
+  if (!preempt_pending) return;
+  uint32_t ipsr;
+  __asm volatile("mrs %0, ipsr" : "=r" (ipsr));
+  if (!ipsr) {
+    yield();
+    return;
+  }
+  // in an ISR: switch as soon as it returns
+  currentCount = 0;
+#ifdef __IMXRT1062__
+  if (gpt_irq >= 0) NVIC_SET_PENDING(gpt_irq);
+#endif
+}
+
+int Threads::waitNotify(unsigned int timeout_ms)
+{
+  __disable_irq();
+  ThreadInfo *me = threadp[current_thread];
+  if (me->notified) {
+    me->notified = 0;
+    __enable_irq();
+    return 1;
+  }
+  int ret = block(notify_queue[current_thread], deadline_from_ms(timeout_ms));
+  __disable_irq();
+  me->notified = 0; // a notify that raced with the timeout
+  __enable_irq();
+  return ret;
+}
+
+void Threads::notify(int id)
+{
+  uint32_t primask = irq_save();
+  if (!wake(notify_queue[id])) threadp[id]->notified = 1;
+  irq_restore(primask);
+  preempt();
+}
+
 void Threads::setTimeSlice(int id, unsigned int ticks)
 {
   threadp[id]->ticks = ticks - 1;
@@ -648,8 +821,14 @@ void Threads::yield_and_start() {
 }
 
 void Threads::delay(int millisecond) {
-  int mx = millis();
-  while((int)millis() - mx < millisecond) yield();
+  if (millisecond <= 0) {
+    yield();
+    return;
+  }
+  // block on a queue nobody wakes, so only the deadline ends the wait
+  WaitQueue q;
+  __disable_irq();
+  block(q, deadline_from_ms(millisecond));
 }
 
 /*
@@ -662,6 +841,15 @@ void Threads::setSleepCallback(ThreadFunctionSleep callback)
 }
 
 void Threads::delay_us(int microsecond){
+#ifdef __IMXRT1062__
+  // deadlines are in microseconds, so this can block too
+  if (microsecond > 0) {
+    WaitQueue q;
+    __disable_irq();
+    block(q, microsecond);
+    return;
+  }
+#endif
   int mx = micros();
   while ((int)micros() - mx < microsecond) yield();
 }
@@ -809,57 +997,158 @@ Threads::Suspend::~Suspend() {
   __enable_irq();
 }
 
-int Threads::Mutex::getState() {
-  int p = threads.stop();
-  int ret = state;
-  threads.start(p);
-  return ret;
+void Threads::WaitQueue::push(Waiter *w) {
+  w->next = 0;
+  if (tail) tail->next = w;
+  else head = w;
+  tail = w;
 }
 
-int __attribute__ ((noinline)) Threads::Mutex::lock(unsigned int timeout_ms) {
-  if (try_lock()) return 1; // we're good, so avoid more checks
+Threads::Waiter *Threads::WaitQueue::pop() {
+  Waiter *w = head;
+  if (w) {
+    head = w->next;
+    if (!head) tail = 0;
+  }
+  return w;
+}
+
+void Threads::WaitQueue::remove(Waiter *w) {
+  Waiter *prev = 0;
+  for (Waiter *p = head; p; prev = p, p = p->next) {
+    if (p != w) continue;
+    if (prev) prev->next = p->next;
+    else head = p->next;
+    if (tail == p) tail = prev;
+    return;
+  }
+}
 
-  uint32_t start = systick_millis_count;
+/*
+ * The blocked thread is SUSPENDED, so the scheduler skips it until wake() or,
+ * for a timed wait, until getNextThread() sees its deadline pass. Thread 0
+ * can't be suspended; it keeps yielding until woken instead.
+ */
+int Threads::block(WaitQueue &q, uint32_t timeout) {
+  Waiter w;
+  ThreadInfo *me = threadp[current_thread];
+  w.id = current_thread;
+  w.granted = 0;
+  q.push(&w);
+  if (timeout) {
+    me->wait_deadline = deadline_clock() + timeout;
+    timed_waiters |= 1u << w.id;
+  }
   while (1) {
-    if (try_lock()) return 1;
-    if (timeout_ms && (systick_millis_count - start > timeout_ms)) return 0;
-    if (waitthread==-1) { // can hold 1 thread suspend until unlock
-      int p = threads.stop();
-      waitthread = threads.current_thread;
-      waitcount = currentCount;
-      threads.suspend(waitthread);
-      threads.start(p);
+    if (w.id) me->flags = SUSPENDED;
+    __enable_irq();
+    yield();
+    __disable_irq();
+    if (w.granted) break;
+    if (timeout && (int32_t)(deadline_clock() - me->wait_deadline) >= 0) {
+      q.remove(&w);
+      break;
     }
-    threads.yield();
   }
-  __flush_cpu();
-  return 0;
+  timed_waiters &= ~(1u << w.id);
+  ready(w.id);
+  __enable_irq();
+  return w.granted;
 }
 
-int Threads::Mutex::try_lock() {
-  int p = threads.stop();
+int Threads::wake(WaitQueue &q) {
+  Waiter *w = q.pop();
+  if (!w) return 0;
+  w->granted = 1;
+  timed_waiters &= ~(1u << w->id);
+  ready(w->id);
+  return 1;
+}
+
+int Threads::Mutex::getState() {
+  return state;
+}
+
+int __attribute__ ((noinline)) Threads::Mutex::lock(unsigned int timeout_ms) {
+  if (try_lock()) return 1; // uncontended
+  __disable_irq();
   if (state == 0) {
     state = 1;
-    threads.start(p);
+    __enable_irq();
+    return 1;
+  }
+  // unlock() leaves state set and hands the lock to us
+  int ret = threads.block(waiters, deadline_from_ms(timeout_ms));
+  __flush_cpu();
+  return ret;
+}
+
+int Threads::Mutex::try_lock() {
+  if (__sync_bool_compare_and_swap(&state, 0, 1)) {
+    __flush_cpu();
     return 1;
   }
-  threads.start(p);
   return 0;
 }
 
+void Threads::Mutex::release() {
+  if (state == 1 && !threads.wake(waiters)) state = 0;
+}
+
 int __attribute__ ((noinline)) Threads::Mutex::unlock() {
-  int p = threads.stop();
-  if (state==1) {
-    state = 0;
-    if (waitthread >= 0) { // reanimate a suspended thread waiting for unlock
-      threads.restart(waitthread);
-      waitthread = -1;
-      __flush_cpu();
-      threads.yield_and_start();
-      return 1;
-    }
-  }
   __flush_cpu();
-  threads.start(p);
+  __disable_irq();
+  release();
+  __enable_irq();
+  threads.preempt();
   return 1;
 }
+
+int Threads::ConditionVariable::wait(Mutex &m, unsigned int timeout_ms) {
+  __flush_cpu();
+  __disable_irq();
+  m.release();
+  int ret = threads.block(waiters, deadline_from_ms(timeout_ms));
+  m.lock();
+  return ret;
+}
+
+void Threads::ConditionVariable::notify_one() {
+  uint32_t primask = irq_save();
+  threads.wake(waiters);
+  irq_restore(primask);
+  threads.preempt();
+}
+
+void Threads::ConditionVariable::notify_all() {
+  uint32_t primask = irq_save();
+  while (threads.wake(waiters));
+  irq_restore(primask);
+  threads.preempt();
+}
+
+int Threads::Semaphore::acquire(unsigned int timeout_ms) {
+  __disable_irq();
+  if (count > 0) {
+    count--;
+    __enable_irq();
+    return 1;
+  }
+  // release() hands its count to us without touching count
+  return threads.block(waiters, deadline_from_ms(timeout_ms));
+}
+
+int Threads::Semaphore::try_acquire() {
+  __disable_irq();
+  int ret = count > 0;
+  if (ret) count--;
+  __enable_irq();
+  return ret;
+}
+
+void Threads::Semaphore::release() {
+  uint32_t primask = irq_save();
+  if (!threads.wake(waiters)) count++;
+  irq_restore(primask);
+  threads.preempt();
+}
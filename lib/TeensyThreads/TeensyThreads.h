@@ -71,6 +71,7 @@
 
 #include <stdint.h>
 #include <stddef.h>
+#include "RunQueue.h"
 
 /* Enabling debugging information allows access to:
  *   getCyclesUsed()
@@ -158,6 +159,8 @@ class ThreadInfo {
     void *sp;
     int ticks;
     volatile int sleep_time_till_end_tick; // Per-task sleep time
+    volatile uint32_t wait_deadline = 0;   // when a timed wait ends, see Threads::block()
+    volatile int notified = 0;             // notify() arrived while not waiting
 #ifdef DEBUG
     unsigned long cyclesStart;  // On T_4 the CycCnt is always active - on T_3.x it currently is not - unless Audio starts it AFAIK
     unsigned long cyclesAccum;
@@ -188,6 +191,9 @@ public:
   static const int DEFAULT_TICK_MICROSECONDS = 100;
   static const int UTIL_STATE_NAME_DESCRIPTION_LENGTH = 24;
   static const int UTIL_TRHEADS_BUFFER_LENGTH = 1024;
+  // Priority levels; higher runs first, equal priorities share round robin
+  static const int PRIORITY_LEVELS = 8;
+  static const int DEFAULT_PRIORITY = 0;
 
 
   // State of threading system
@@ -219,6 +225,13 @@ protected:
    * But in the future, a linked list might be more appropriate.
    */
   ThreadInfo *threadp[MAX_THREADS];
+  // Runnable threads by priority; only touched with interrupts disabled
+  RunQueue<MAX_THREADS, PRIORITY_LEVELS> runq;
+  // Bit per thread blocked in a timed wait; getNextThread() ends the waits that expire
+  volatile uint32_t timed_waiters = 0;
+  static_assert(MAX_THREADS <= 32, "timed_waiters has one bit per thread");
+  // A thread of higher priority than the current one was made runnable
+  volatile int preempt_pending = 0;
   // This used to be allocated statically, as below. Kept for reference in case of bugs.
   // ThreadInfo thread[MAX_THREADS];
 
@@ -258,8 +271,12 @@ public:
   int kill(int id);
   // Suspend a thread (on the next slice tick). Can be restarted with restart().
   int suspend(int id);
-  // Restart a suspended thread.
+  // Restart a suspended thread. Switches to it now if it has a higher priority.
   int restart(int id);
+  // Set the priority of a thread, 0 to PRIORITY_LEVELS-1. A runnable thread always
+  // runs before any of lower priority. Takes effect at the next context switch.
+  void setPriority(int id, int priority);
+  int getPriority(int id);
   // Set the slice length time in ticks for a thread (1 tick = 1 millisecond, unless using MicroTimer)
   void setTimeSlice(int id, unsigned int ticks);
   // Set the slice length time in ticks for all new threads (1 tick = 1 millisecond, unless using MicroTimer)
@@ -288,7 +305,7 @@ public:
   // Yield current thread's remaining time slice to the next thread, causing immediate
   // context switch
   static void yield();
-  // Wait for milliseconds using yield(), giving other slices your wait time
+  // Wait for milliseconds, suspended so other threads get the time
   void delay(int millisecond);
   // Wait for microseconds using yield(), giving other slices your wait time
   void delay_us(int microsecond);
@@ -313,6 +330,11 @@ public:
 
 protected:
   void getNextThread();
+  // Mark id RUNNING and queue it to run. Call with interrupts disabled.
+  void ready(int id);
+  // Switch away now if ready() queued a thread that outranks the current one.
+  // From an ISR the switch happens at the next tick instead.
+  void preempt();
   void *loadstack(ThreadFunction p, void * arg, void *stackaddr, int stack_size);
   static void force_switch_isr();
   void setStackMarker(void *stack);
@@ -322,11 +344,55 @@ private:
   void yield_and_start();
 
 public:
+  // A thread blocked in a WaitQueue. Lives on the blocked thread's stack.
+  struct Waiter {
+    Waiter *next;
+    int id;                // thread id
+    volatile int granted;  // set by the thread that woke it
+  };
+
+  // FIFO of blocked threads. Only touched with interrupts disabled.
+  class WaitQueue {
+  private:
+    Waiter *head = 0;
+    Waiter *tail = 0;
+  public:
+    bool empty() { return head == 0; }
+    void push(Waiter *w);
+    Waiter *pop();
+    void remove(Waiter *w);
+  };
+
+protected:
+  // Block the current thread in q until wake() or timeout (0 = forever). The timeout
+  // is in microseconds on Teensy 4 and milliseconds on Teensy 3.
+  // Call with interrupts disabled; returns with them enabled. 1 if woken, 0 on timeout.
+  int block(WaitQueue &q, uint32_t timeout);
+  // Wake the oldest thread in q. Call with interrupts disabled. 1 if there was one.
+  int wake(WaitQueue &q);
+
+  WaitQueue notify_queue[MAX_THREADS]; // where each thread waits in waitNotify()
+
+public:
+  // Wait until another thread or an ISR calls notify() for this thread, up to
+  // timeout_ms milliseconds (0 = forever). A notify sent before the wait is kept,
+  // so none are lost. Returns 1 if notified, 0 on timeout.
+  int waitNotify(unsigned int timeout_ms = 0);
+  // Wake thread id from waitNotify(). Safe to call from an ISR, where a thread of
+  // higher priority than the interrupted one runs as soon as the ISR returns.
+  void notify(int id);
+
+public:
+  class ConditionVariable;
+
+  // Blocked threads queue in FIFO order and are suspended, so they take no time slices.
+  // unlock() hands the lock straight to the oldest waiter.
   class Mutex {
   private:
     volatile int state = 0;
-    volatile int waitthread = -1;
-    volatile int waitcount = 0;
+    WaitQueue waiters;
+    void release(); // unlock with interrupts already disabled
+    friend class ConditionVariable;
   public:
     int getState(); // get the lock state; 1=locked; 0=unlocked
     int lock(unsigned int timeout_ms = 0); // lock, optionally waiting up to timeout_ms milliseconds
@@ -334,6 +400,30 @@ public:
     int unlock();   // unlock if locked
   };
 
+  class ConditionVariable {
+  private:
+    WaitQueue waiters;
+  public:
+    // Unlock m, wait for a notify or up to timeout_ms (0 = forever), then lock m again.
+    // Returns 1 if notified, 0 on timeout.
+    int wait(Mutex &m, unsigned int timeout_ms = 0);
+    void notify_one();
+    void notify_all();
+  };
+
+  // Counting semaphore. release() hands a count straight to the oldest waiter.
+  class Semaphore {
+  private:
+    volatile int count;
+    WaitQueue waiters;
+  public:
+    Semaphore(int initial = 0) : count(initial) {}
+    int getCount() { return count; }
+    int acquire(unsigned int timeout_ms = 0); // take a count, waiting up to timeout_ms (0 = forever); 1 if taken
+    int try_acquire(); // take a count if one is free; 1 if taken
+    void release();    // add a count, or wake a waiter
+  };
+
   class Scope {
   private:
     Mutex *r;
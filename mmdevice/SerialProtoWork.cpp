@@ -14,8 +14,13 @@
 
 #include "SerialProtoWork.h"
 #include "ModuleInterface.h"
+#include "devicecmds.h"
+#include "sequenceplayer.h"
 #include <sstream>
+#include <fstream>
+#include <cstdlib>
 #include <cstdio>
+#include <algorithm>
 
 #ifdef WIN32
    #define WIN32_LEAN_AND_MEAN
@@ -28,8 +33,11 @@ const char* g_DeviceNameSerialProtoWorkShutter = "SerialProtoWork-Shutter";
 
 
 // Global info about the state of the SerialProtoWork.  This should be folded into a class
-const int g_Min_MMVersion = 1;
-const int g_Max_MMVersion = 2;
+const int g_Min_MMVersion = 3; // first firmware sure to answer sequenced frames
+const int g_Max_MMVersion = 6;
+const int g_Min_BatchVersion = 5; // firmware that takes batch frames
+const size_t g_maxBatch = 32;     // commands per batch frame
+static_assert(g_maxBatch * sproto::BATCH_STATUS_SIZE <= sproto::DEVICE_REPLY_SIZE, "a batch of set commands must run to the end");
 const char* g_versionProp = "Version";
 const char* g_normalLogicString = "Normal";
 const char* g_invertedLogicString = "Inverted";
@@ -37,8 +45,18 @@ const char* g_invertedLogicString = "Inverted";
 const char* g_On = "On";
 const char* g_Off = "Off";
 
-// static lock
-MMThreadLock CSerialProtoWorkHub::lock_;
+const char* g_commandWindowProp = "CommandWindow";
+const double g_replyTimeoutMs = 250.0;
+const double g_probeTimeoutMs = 5.0;    // first readiness probe, doubled on every retry
+const double g_readyTimeoutMs = 3000.0; // covers boards that reset and run a bootloader on open
+const double g_detectValidMs = 10000.0; // a port asked about again within this is not probed again
+const double g_confirmTimeoutMs = 50.0; // probing a port a board was last found on, before the full wait
+const char* g_detectCacheFile = "SerialProtoWorkBoards.txt";
+const double g_idlePollMs = 1.0;        // wait between polls for replies that have not arrived
+const char* g_serialNumberProp = "SerialNumber";
+const char* g_shadowMaxAgeProp = "ShadowMaxAgeMs";
+
+SerialProtoWorkDetector g_detector;
 
 ///////////////////////////////////////////////////////////////////////////////
 // Exported MMDevice API
@@ -71,17 +89,529 @@ MODULE_API void DeleteDevice(MM::Device* pDevice)
    delete pDevice;
 }
 
+///////////////////////////////////////////////////////////////////////////////
+// MMSlipProtocol implementation
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+size_t MMSlipProtocol::writeBytes_impl(const uint8_t* buffer, size_t size)
+{
+   txbuffer_.insert(txbuffer_.end(), buffer, buffer + size);
+   return size;
+}
+
+void MMSlipProtocol::writeNow_impl()
+{
+   if (txbuffer_.empty())
+      return;
+   if (hub_.WriteToComPortH(port_.c_str(), txbuffer_.data(), (unsigned) txbuffer_.size()) != DEVICE_OK)
+      writeFailed_ = true;
+   txbuffer_.clear();
+}
+
+size_t MMSlipProtocol::readBytes_impl(uint8_t* buffer, size_t size)
+{
+   unsigned long bytesRead = 0;
+   if (hub_.ReadFromComPortH(port_.c_str(), buffer, (unsigned) size, bytesRead) != DEVICE_OK)
+      return 0;
+   return bytesRead;
+}
+
+void MMSlipProtocol::clearInput_impl()
+{
+   hub_.PurgeComPortH(port_.c_str());
+}
+
+bool MMSlipProtocol::isStreamReady_impl()
+{
+   return hub_.IsPortAvailable();
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SerialProtoWorkIOThread implementation
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+SerialProtoWorkIOThread::SerialProtoWorkIOThread(CSerialProtoWorkHub& hub) :
+   proto_ (hub),
+   pipeline_ (proto_, rxbuffer_, sizeof(rxbuffer_)),
+   running_ (false),
+   stop_ (false),
+   sleeping_ (false),
+   batching_ (false)
+{
+}
+
+SerialProtoWorkIOThread::~SerialProtoWorkIOThread()
+{
+   Stop();
+}
+
+// The pipeline must not be touched by anyone else until Stop()
+void SerialProtoWorkIOThread::Start(const std::string& port, long window)
+{
+   if (running_)
+      return;
+   proto_.SetPort(port);
+   pipeline_.setWindow(window);
+   batching_ = false;
+   stop_ = false;
+   running_ = true;
+   activate();
+}
+
+void SerialProtoWorkIOThread::Stop()
+{
+   if (!running_)
+      return;
+   {
+      std::lock_guard<std::mutex> lock(wakeMutex_);
+      stop_ = true;
+   }
+   wake_.notify_one();
+   wait();
+   running_ = false;
+   // requests posted while the thread was exiting
+   for (SerialProtoWorkRequest* req = queue_.TakeAll(); req; )
+   {
+      SerialProtoWorkRequest* next = req->next;
+      Complete(req, ERR_COMMUNICATION);
+      req = next;
+   }
+}
+
+SerialProtoWorkRequest* SerialProtoWorkIOThread::NewRequest(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize, double timeoutMs)
+{
+   SerialProtoWorkRequest* req = new SerialProtoWorkRequest;
+   req->next = 0;
+   req->type = type;
+   req->id = id;
+   req->timeoutMs = timeoutMs;
+   req->coalesce = false;
+   req->merged = 0;
+   req->batched = 0;
+   req->resent = false;
+   if (params)
+      req->params.assign(params, params + paramsSize);
+   return req;
+}
+
+// Takes ownership of req
+std::future<SerialProtoWorkReply> SerialProtoWorkIOThread::Post(SerialProtoWorkRequest* req)
+{
+   std::future<SerialProtoWorkReply> reply = req->reply.get_future();
+   bool running;
+   {
+      // Stop() sets stop_ under this lock before it empties the queue, so the
+      // request is either pushed in time to be completed there or not at all
+      std::lock_guard<std::mutex> lock(wakeMutex_);
+      running = running_;
+      if (running && !stop_)
+      {
+         queue_.Push(req);
+         if (sleeping_)
+            wake_.notify_one();
+         return reply;
+      }
+   }
+   Complete(req, running ? ERR_COMMUNICATION : ERR_NO_PORT_SET);
+   return reply;
+}
+
+// Completes req and every request it replaced
+void SerialProtoWorkIOThread::Complete(SerialProtoWorkRequest* req, const SerialProtoWorkReply& reply)
+{
+   while (req)
+   {
+      if (req->done)
+         req->done(reply);
+      SerialProtoWorkRequest* merged = req->merged;
+      req->reply.set_value(reply);
+      delete req;
+      req = merged;
+   }
+}
+
+void SerialProtoWorkIOThread::Complete(SerialProtoWorkRequest* req, int error)
+{
+   SerialProtoWorkReply reply;
+   reply.error = error;
+   Complete(req, reply);
+}
+
+// A register write replaces an earlier write to the same register that is
+// still waiting for room in the window, so only the last value is sent.
+// The request goes to the back, keeping the order of the last writes.
+void SerialProtoWorkIOThread::Enqueue(std::deque<SerialProtoWorkRequest*>& backlog, SerialProtoWorkRequest* req)
+{
+   if (req->coalesce)
+   {
+      for (std::deque<SerialProtoWorkRequest*>::iterator it = backlog.begin(); it != backlog.end(); ++it)
+      {
+         SerialProtoWorkRequest* old = *it;
+         if (old->coalesce && old->type == req->type && old->id == req->id)
+         {
+            backlog.erase(it);
+            SerialProtoWorkRequest* last = old;
+            while (last->merged)
+               last = last->merged;
+            last->merged = req->merged;
+            req->merged = old;
+            break;
+         }
+      }
+   }
+   backlog.push_back(req);
+}
+
+// Completes req and every request sent after it in the same batch frame
+void SerialProtoWorkIOThread::Fail(SerialProtoWorkRequest* req, int error)
+{
+   while (req)
+   {
+      SerialProtoWorkRequest* batched = req->batched;
+      Complete(req, error);
+      req = batched;
+   }
+}
+
+// Completes the requests of a batch frame, each from its own entry in the
+// ACK. SubmitBatch sizes batches so the reply never fills up, so the board
+// only stops early at a command it could not read. Requests after that one
+// were not run and fail, rather than being sent again behind later writes.
+void SerialProtoWorkIOThread::CompleteBatch(SerialProtoWorkRequest* req, sproto::error_t err, const uint8_t* data, size_t size)
+{
+   if (err != sproto::NO_ERROR)
+   {
+      Fail(req, ReplyToError(err));
+      return;
+   }
+   sproto::BatchReplyReader entries(data, size);
+   while (req)
+   {
+      SerialProtoWorkRequest* batched = req->batched;
+      req->batched = 0;
+      sproto::error_t status = sproto::NO_ERROR;
+      sproto::slice_t result = {0, 0};
+      sproto::error_t entry = entries.next(status, result);
+      SerialProtoWorkReply reply;
+      reply.error = ReplyToError(entry == sproto::NO_ERROR ? status : entry);
+      if (reply.error == DEVICE_OK)
+         reply.data.assign(result.data, result.data + result.size);
+      Complete(req, reply);
+      req = batched;
+   }
+}
+
+bool SerialProtoWorkIOThread::IsBatchable(const SerialProtoWorkRequest* req)
+{
+   return req->type == sproto::PROTO_SET || req->type == sproto::PROTO_GET;
+}
+
+sproto::error_t SerialProtoWorkIOThread::Submit(SerialProtoWorkRequest* req)
+{
+   const unsigned char* params = req->params.empty() ? 0 : req->params.data();
+   return pipeline_.submit(req->type, req->id, params, req->params.size(), req->seq);
+}
+
+// Sends req and the commands queued right behind it in one batch frame, as
+// many as fit, linked from req through batched. Sent alone if nothing can
+// go with it. The set commands of a batch always fit their status in the
+// reply; a query may fill it, so a query ends the batch and the board runs
+// every command.
+sproto::error_t SerialProtoWorkIOThread::SubmitBatch(SerialProtoWorkRequest* req, std::deque<SerialProtoWorkRequest*>& backlog)
+{
+   if (!IsBatchable(req) || req->type == sproto::PROTO_GET || backlog.empty() || !IsBatchable(backlog.front()))
+      return Submit(req);
+   sproto::CommandBatch batch(batchBuffer_, sizeof(batchBuffer_));
+   SerialProtoWorkRequest* last = 0;
+   for (SerialProtoWorkRequest* next = req; next && batch.count() < g_maxBatch && IsBatchable(next); )
+   {
+      const unsigned char* params = next->params.empty() ? 0 : next->params.data();
+      if (batch.add(next->type, next->id, params, next->params.size()) != sproto::NO_ERROR)
+         break;
+      if (last)
+      {
+         last->batched = next;
+         backlog.pop_front();
+      }
+      last = next;
+      if (next->type == sproto::PROTO_GET)
+         break;
+      next = backlog.empty() ? 0 : backlog.front();
+   }
+   if (batch.count() < 2)
+      return Submit(req);
+   return pipeline_.submitBatch(batch, req->seq);
+}
+
+int SerialProtoWorkIOThread::ReplyToError(sproto::error_t err)
+{
+   switch (err)
+   {
+      case sproto::NO_ERROR:
+         return DEVICE_OK;
+      case sproto::ERROR_COMMAND:
+         return ERR_COMMAND_FAILED;
+      case sproto::ERROR_STREAM:
+         return ERR_WRITE_FAILED;
+      default:
+         return ERR_COMMUNICATION;
+   }
+}
+
+void SerialProtoWorkIOThread::FailAll(std::deque<SerialProtoWorkRequest*>& requests, int error)
+{
+   for (size_t i = 0; i < requests.size(); i++)
+   {
+      pipeline_.release(requests[i]->seq);
+      Fail(requests[i], error);
+   }
+   requests.clear();
+}
+
+// a batch waits as long as its most patient command
+static std::chrono::microseconds Patience(const SerialProtoWorkRequest* req)
+{
+   double timeoutMs = 0.0;
+   for (const SerialProtoWorkRequest* batched = req; batched; batched = batched->batched)
+      timeoutMs = (std::max)(timeoutMs, batched->timeoutMs);
+   return std::chrono::microseconds((long long) (timeoutMs * 1000.0));
+}
+
+int SerialProtoWorkIOThread::svc()
+{
+   std::deque<SerialProtoWorkRequest*> backlog;  // posted, waiting for room in the window
+   std::deque<SerialProtoWorkRequest*> inflight; // sent, waiting for the reply
+
+   while (!stop_)
+   {
+      for (SerialProtoWorkRequest* req = queue_.TakeAll(); req; req = req->next)
+         Enqueue(backlog, req);
+
+      // send as many as the window allows in a single write
+      std::deque<SerialProtoWorkRequest*> sent;
+      while (!backlog.empty() && pipeline_.ready())
+      {
+         SerialProtoWorkRequest* req = backlog.front();
+         backlog.pop_front();
+         sproto::error_t err = batching_ ? SubmitBatch(req, backlog) : Submit(req);
+         if (err != sproto::NO_ERROR)
+         {
+            Fail(req, ReplyToError(err));
+            continue;
+         }
+         req->deadline = std::chrono::steady_clock::now() + Patience(req);
+         sent.push_back(req);
+      }
+      if (!sent.empty())
+      {
+         proto_.writeNow();
+         if (proto_.WriteFailed())
+            FailAll(sent, ERR_WRITE_FAILED);
+         inflight.insert(inflight.end(), sent.begin(), sent.end());
+      }
+
+      // match every reply that has arrived to its request
+      size_t frames = 0;
+      while (pipeline_.poll() == sproto::NO_ERROR)
+         frames++;
+      proto_.writeNow(); // requests the pipeline sent again for a lost frame
+      std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+      for (std::deque<SerialProtoWorkRequest*>::iterator it = inflight.begin(); it != inflight.end(); )
+      {
+         SerialProtoWorkRequest* req = *it;
+         if (pipeline_.done(req->seq))
+         {
+            const uint8_t* data = 0;
+            size_t size = 0;
+            uint8_t seq = req->seq;
+            sproto::error_t err = pipeline_.result(seq, data, size);
+            if (req->batched)
+            {
+               CompleteBatch(req, err, data, size);
+            }
+            else
+            {
+               SerialProtoWorkReply reply;
+               reply.error = ReplyToError(err);
+               if (reply.error == DEVICE_OK)
+                  reply.data.assign(data, data + size);
+               Complete(req, reply);
+            }
+            pipeline_.release(seq);
+         }
+         else if (now > req->deadline && !req->resent && pipeline_.resend(req->seq) == sproto::NO_ERROR)
+         {
+            // once more before giving up, in case the last frame was lost. The device
+            // answers again without running it twice.
+            req->resent = true;
+            req->deadline = now + Patience(req);
+            proto_.writeNow();
+            ++it;
+            continue;
+         }
+         else if (now > req->deadline)
+         {
+            // a late reply is dropped by the pipeline
+            pipeline_.release(req->seq);
+            Fail(req, ERR_COMMUNICATION);
+         }
+         else
+         {
+            ++it;
+            continue;
+         }
+         it = inflight.erase(it);
+      }
+
+      bool due = !inflight.empty() || !backlog.empty();
+      if (due && (frames > 0 || !sent.empty()))
+         continue;
+      // ReadFromComPort cannot block. While replies are due look again after
+      // g_idlePollMs, or as soon as a request is posted.
+      std::unique_lock<std::mutex> lock(wakeMutex_);
+      sleeping_ = true;
+      if (due)
+         wake_.wait_for(lock, std::chrono::microseconds((long long) (g_idlePollMs * 1000.0)), [this] {return stop_ || !queue_.Empty();});
+      else
+         wake_.wait(lock, [this] {return stop_ || !queue_.Empty();});
+      sleeping_ = false;
+   }
+
+   FailAll(inflight, ERR_COMMUNICATION);
+   for (size_t i = 0; i < backlog.size(); i++)
+      Complete(backlog[i], ERR_COMMUNICATION);
+   return 0;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// SerialProtoWorkDetector implementation
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~
+//
+bool SerialProtoWorkDetector::IsFresh(const std::string& port, std::chrono::steady_clock::time_point now)
+{
+   std::map<std::string, PortResult>::iterator it = ports_.find(port);
+   return it != ports_.end() && now - it->second.time < std::chrono::milliseconds((long long) g_detectValidMs);
+}
+
+// Caller holds mutex_
+bool SerialProtoWorkDetector::IsKnownPort(const std::string& port)
+{
+   for (std::map<uint32_t, BoardRecord>::iterator it = boards_.begin(); it != boards_.end(); ++it)
+   {
+      if (it->second.port == port)
+         return true;
+   }
+   return false;
+}
+
+// Caller holds mutex_
+void SerialProtoWorkDetector::Record(CSerialProtoWorkHub& hub, const std::string& port, const PortResult& result)
+{
+   ports_[port] = result;
+   if (result.error != DEVICE_OK || result.serial == 0)
+      return;
+   std::map<uint32_t, BoardRecord>::iterator board = boards_.find(result.serial);
+   if (board != boards_.end() && board->second.port == port && board->second.version == result.version)
+      return;
+   if (board != boards_.end() && board->second.port != port)
+   {
+      std::ostringstream os;
+      os << "SerialProtoWork " << result.serial << " moved from " << board->second.port << " to " << port;
+      hub.LogMessage(os.str().c_str(), false);
+   }
+   BoardRecord& record = boards_[result.serial];
+   record.port = port;
+   record.version = result.version;
+   Save();
+}
+
+// the cache file lives in the temporary directory
+static std::string DetectCachePath()
+{
+   const char* dir = std::getenv("TEMP");
+   if (!dir)
+      dir = std::getenv("TMPDIR");
+   if (!dir)
+      dir = "/tmp";
+   return std::string(dir) + "/" + g_detectCacheFile;
+}
+
+// One board per line: serial number, firmware version, port. Caller holds mutex_
+void SerialProtoWorkDetector::Load()
+{
+   std::ifstream file(DetectCachePath().c_str());
+   uint32_t serial;
+   BoardRecord record;
+   while (file >> serial >> record.version && std::getline(file >> std::ws, record.port))
+      boards_[serial] = record;
+}
+
+// Caller holds mutex_
+void SerialProtoWorkDetector::Save()
+{
+   std::ofstream file(DetectCachePath().c_str(), std::ios::trunc);
+   for (std::map<uint32_t, BoardRecord>::iterator it = boards_.begin(); it != boards_.end(); ++it)
+      file << it->first << " " << it->second.version << " " << it->second.port << "\n";
+}
+
+// The core asks about one port at a time, possibly from several threads.
+// Each question probes only its own port, outside the lock, so questions
+// about different ports run side by side. A second question about a port
+// being probed waits for that probe. A board remembered on the port answers
+// the short probes at once; otherwise the probe waits out a bootloader.
+MM::DeviceDetectionStatus SerialProtoWorkDetector::Detect(CSerialProtoWorkHub& hub, const std::string& port)
+{
+   std::unique_lock<std::mutex> lock(mutex_);
+   if (!loaded_)
+   {
+      Load();
+      loaded_ = true;
+   }
+   probed_.wait(lock, [&] { return probing_.count(port) == 0; });
+   if (!IsFresh(port, std::chrono::steady_clock::now()))
+   {
+      bool known = IsKnownPort(port);
+      probing_.insert(port);
+      lock.unlock();
+      PortResult probe;
+      probe.error = ERR_COMMUNICATION;
+      if (known)
+         probe.error = hub.ProbePort(port, probe.version, probe.serial, g_confirmTimeoutMs);
+      if (probe.error != DEVICE_OK)
+         probe.error = hub.ProbePort(port, probe.version, probe.serial, g_readyTimeoutMs);
+      probe.time = std::chrono::steady_clock::now();
+      lock.lock();
+      probing_.erase(port);
+      Record(hub, port, probe);
+      probed_.notify_all();
+   }
+
+   const PortResult& result = ports_[port];
+   if (result.error != DEVICE_OK)
+   {
+      hub.LogMessageCode(result.error, true);
+      return MM::CanNotCommunicate;
+   }
+   return MM::CanCommunicate;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // CSerialProtoWorkHUb implementation
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~
 //
 CSerialProtoWorkHub::CSerialProtoWorkHub() :
    initialized_ (false),
-   shutterState_ (0)
+   version_ (0),
+   serialNumber_ (0),
+   shutterState_ (0),
+   commandWindow_ (4),
+   shadowMaxAgeMs_ (0.0),
+   io_ (*this)
 {
    portAvailable_ = false;
    invertedLogic_ = false;
    timedOutputActive_ = false;
+   triggerArmed_ = false;
 
    InitializeDefaultErrorMessages();
 
@@ -92,6 +622,8 @@ CSerialProtoWorkHub::CSerialProtoWorkHub() :
    errorText << "The firmware version on the SerialProtoWork is not compatible with this adapter.  Please use firmware version ";
    errorText <<  g_Min_MMVersion << " to " << g_Max_MMVersion;
    SetErrorText(ERR_VERSION_MISMATCH, errorText.str().c_str());
+   SetErrorText(ERR_COMMUNICATION, "No reply from the SerialProtoWork board");
+   SetErrorText(ERR_COMMAND_FAILED, "The SerialProtoWork board rejected the command");
 
    CPropertyAction* pAct = new CPropertyAction(this, &CSerialProtoWorkHub::OnPort);
    CreateProperty(MM::g_Keyword_Port, "Undefined", MM::String, false, pAct, true);
@@ -101,6 +633,20 @@ CSerialProtoWorkHub::CSerialProtoWorkHub() :
 
    AddAllowedValue("Logic", g_invertedLogicString);
    AddAllowedValue("Logic", g_normalLogicString);
+
+   // commands sent before waiting for the first reply. 1 is stop-and-wait.
+   pAct = new CPropertyAction(this, &CSerialProtoWorkHub::OnCommandWindow);
+   CreateProperty(g_commandWindowProp, "4", MM::Integer, false, pAct, true);
+   AddAllowedValue(g_commandWindowProp, "1");
+   AddAllowedValue(g_commandWindowProp, "2");
+   AddAllowedValue(g_commandWindowProp, "4");
+   AddAllowedValue(g_commandWindowProp, "8");
+
+   // how long a written register value is trusted to skip writing it again,
+   // 0 for as long as the adapter runs
+   pAct = new CPropertyAction(this, &CSerialProtoWorkHub::OnShadowMaxAge);
+   CreateProperty(g_shadowMaxAgeProp, "0", MM::Float, false, pAct);
+   SetPropertyLimits(g_shadowMaxAgeProp, 0.0, 60000.0);
 }
 
 CSerialProtoWorkHub::~CSerialProtoWorkHub()
@@ -119,43 +665,187 @@ bool CSerialProtoWorkHub::Busy()
 }
 
 // private and expects caller to:
-// 1. guard the port
-// 2. purge the port
-int CSerialProtoWorkHub::GetControllerVersion(int& version)
+// 1. purge the port
+// 2. start the I/O thread
+int CSerialProtoWorkHub::GetControllerVersion(SerialProtoWorkIOThread& io, int& version, uint32_t& serial, double timeoutMs)
 {
-   int ret = DEVICE_OK;
-   unsigned char command[1];
-   command[0] = 30;
    version = 0;
+   serial = 0;
+   SerialProtoWorkReply result = io.Post(sproto::PROTO_QUERY, 0, 0, 0, timeoutMs).get();
+   // every firmware answers `q`, so a NAK means it cannot read sequenced frames
+   if (result.error == ERR_COMMAND_FAILED)
+      return ERR_VERSION_MISMATCH;
+   if (result.error != DEVICE_OK)
+      return result.error;
+   std::vector<unsigned char>& reply = result.data;
+
+   // reply is the CBOR device version followed by the CBOR device description
+   // and, from newer firmware, the USB serial number
+   sproto::CborSequenceReader items(reply.data(), reply.size());
+   CborParser parser;
+   CborValue it;
+   uint32_t v = 0;
+   sproto::cbor_string_t description;
+   if (items.next(parser, it) != sproto::NO_ERROR || sproto::cborRead(it, v) != sproto::NO_ERROR)
+      return ERR_BOARD_NOT_FOUND;
+   items.advance(it);
+   if (items.next(parser, it) != sproto::NO_ERROR || sproto::cborRead(it, description) != sproto::NO_ERROR)
+      return ERR_BOARD_NOT_FOUND;
+   if (std::string((const char*) description.data, description.size) != sproto::DEVICE_DESCRIPTION)
+      return ERR_BOARD_NOT_FOUND;
+   items.advance(it);
+   if (!items.atEnd() && (items.next(parser, it) != sproto::NO_ERROR || sproto::cborRead(it, serial) != sproto::NO_ERROR))
+      return ERR_BOARD_NOT_FOUND;
 
-   ret = WriteToComPort(port_.c_str(), (const unsigned char*) command, 1);
-   if (ret != DEVICE_OK)
-      return ret;
+   version = (int) v;
+   return DEVICE_OK;
+}
 
-   std::string answer;
-   ret = GetSerialAnswer(port_.c_str(), "\r\n", answer);
-   if (ret != DEVICE_OK)
-      return ret;
+// Probe with `q` until the board answers. The first probes are short, so a
+// board that is already running answers within milliseconds. Each retry
+// doubles the timeout up to g_replyTimeoutMs while a board that reset on
+// open is still in its bootloader, for up to readyTimeoutMs. Same
+// expectations as GetControllerVersion.
+int CSerialProtoWorkHub::WaitForController(SerialProtoWorkIOThread& io, int& version, uint32_t& serial, double readyTimeoutMs)
+{
+   MM::MMTime startTime = GetCurrentMMTime();
+   double timeoutMs = g_probeTimeoutMs;
+   int ret;
+   do
+   {
+      ret = GetControllerVersion(io, version, serial, timeoutMs);
+      if (ret != ERR_COMMUNICATION)
+         return ret;
+      timeoutMs = (std::min)(2.0 * timeoutMs, g_replyTimeoutMs);
+   } while ((GetCurrentMMTime() - startTime).getMsec() < readyTimeoutMs);
+   return ret;
+}
 
-   if (answer != "MM-Ard")
-      return ERR_BOARD_NOT_FOUND;
+// Look for a board on a port the core asked about. Sets up the port the way
+// the board needs it. A port without a board gets all its settings back; the
+// port of a board keeps them, for the core to record, except the answer
+// timeout. Safe to run for several ports at once.
+int CSerialProtoWorkHub::ProbePort(const std::string& port, int& version, uint32_t& serial, double readyTimeoutMs)
+{
+   MM::Device* pS = GetCoreCallback()->GetDevice(this, port.c_str());
+   if (!pS)
+      return ERR_PORT_OPEN_FAILED;
+
+   // device specific default communication parameters
+   // for SerialProtoWork Duemilanova. The answer timeout comes first.
+   const char* settings[][2] = {
+      {"AnswerTimeout", "500.0"},
+      {MM::g_Keyword_Handshaking, g_Off},
+      {MM::g_Keyword_BaudRate, "57600"},
+      {MM::g_Keyword_StopBits, "1"},
+      {"DelayBetweenCharsMs", "0"},
+   };
+   const size_t nSettings = sizeof(settings) / sizeof(settings[0]);
+   std::vector<std::string> saved(nSettings);
+   for (size_t i = 0; i < nSettings; i++)
+   {
+      char value[MM::MaxStrLength];
+      value[0] = 0;
+      GetCoreCallback()->GetDeviceProperty(port.c_str(), settings[i][0], value);
+      saved[i] = value;
+      GetCoreCallback()->SetDeviceProperty(port.c_str(), settings[i][0], settings[i][1]);
+   }
+   pS->Initialize();
+   PurgeComPort(port.c_str());
+
+   SerialProtoWorkIOThread io(*this);
+   io.Start(port, 1);
+   // returns as soon as the board answers, instead of sleeping through a bootloader that may not be there
+   int ret = WaitForController(io, version, serial, readyTimeoutMs);
+   io.Stop();
+
+   pS->Shutdown();
+   bool board = ret == DEVICE_OK || ret == ERR_VERSION_MISMATCH;
+   for (size_t i = 0; i < nSettings; i++)
+   {
+      if (i == 0 || !board)
+         GetCoreCallback()->SetDeviceProperty(port.c_str(), settings[i][0], saved[i].c_str());
+   }
+   return ret;
+}
 
-   // Check version number of the SerialProtoWork
-   command[0] = 31;
-   ret = WriteToComPort(port_.c_str(), (const unsigned char*) command, 1);
-   if (ret != DEVICE_OK)
-      return ret;
+std::future<SerialProtoWorkReply> CSerialProtoWorkHub::PostCommand(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize)
+{
+   return io_.Post(type, id, params, paramsSize, g_replyTimeoutMs);
+}
 
-   std::string ans;
-   ret = GetSerialAnswer(port_.c_str(), "\r\n", ans);
-   if (ret != DEVICE_OK) {
-         return ret;
+bool CSerialProtoWorkHub::IsFresh(const ShadowRegister& reg)
+{
+   if (!reg.valid)
+      return false;
+   if (shadowMaxAgeMs_ <= 0.0)
+      return true;
+   return std::chrono::steady_clock::now() - reg.time < std::chrono::microseconds((long long) (shadowMaxAgeMs_ * 1000.0));
+}
+
+// A failed write leaves the board register unknown, unless a later write has
+// already replaced the value
+void CSerialProtoWorkHub::InvalidateRegister(uint32_t id, uint32_t value)
+{
+   MMThreadGuard myLock(registersLock_);
+   ShadowRegister& reg = registers_[id];
+   if (reg.value == value)
+      reg.valid = false;
+}
+
+// Set a board register to value. Nothing is sent if the shadow copy already
+// holds value, and a write that has not been sent yet is replaced by this one.
+std::future<SerialProtoWorkReply> CSerialProtoWorkHub::WriteRegister(uint32_t id, uint32_t value)
+{
+   {
+      MMThreadGuard myLock(registersLock_);
+      ShadowRegister& reg = registers_[id];
+      if (IsFresh(reg) && reg.value == value)
+      {
+         std::promise<SerialProtoWorkReply> skipped;
+         SerialProtoWorkReply reply;
+         reply.error = DEVICE_OK;
+         skipped.set_value(reply);
+         return skipped.get_future();
+      }
+      reg.valid = true;
+      reg.value = value;
+      reg.time = std::chrono::steady_clock::now();
    }
-   std::istringstream is(ans);
-   is >> version;
 
-   return ret;
+   unsigned char params[8];
+   CborEncoder enc, array;
+   cbor_encoder_init(&enc, params, sizeof(params), 0);
+   cbor_encoder_create_array(&enc, &array, 1);
+   cbor_encode_uint(&array, value);
+   cbor_encoder_close_container(&enc, &array);
 
+   SerialProtoWorkRequest* req = SerialProtoWorkIOThread::NewRequest(sproto::PROTO_SET, id, params, cbor_encoder_get_buffer_size(&enc, params), g_replyTimeoutMs);
+   req->coalesce = true;
+   req->done = [this, id, value](const SerialProtoWorkReply& reply)
+   {
+      if (reply.error != DEVICE_OK)
+         InvalidateRegister(id, value);
+   };
+   return io_.Post(req);
+}
+
+// The board changes the register by itself, e.g. while playing a sequence.
+// The next write is sent even if it matches the shadow copy.
+void CSerialProtoWorkHub::ForgetRegister(uint32_t id)
+{
+   MMThreadGuard myLock(registersLock_);
+   registers_[id].valid = false;
+}
+
+// Send a command and wait for its reply. A query reply is copied to reply,
+// without the ACK.
+int CSerialProtoWorkHub::SendCommand(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize, std::vector<unsigned char>* reply)
+{
+   SerialProtoWorkReply result = PostCommand(type, id, params, paramsSize).get();
+   if (reply)
+      reply->swap(result.data);
+   return result.error;
 }
 
 bool CSerialProtoWorkHub::SupportsDeviceDetection(void)
@@ -170,7 +860,6 @@ MM::DeviceDetectionStatus CSerialProtoWorkHub::DetectDevice(void)
 
    // all conditions must be satisfied...
    MM::DeviceDetectionStatus result = MM::Misconfigured;
-   char answerTO[MM::MaxStrLength];
    
    try
    {
@@ -181,40 +870,8 @@ MM::DeviceDetectionStatus CSerialProtoWorkHub::DetectDevice(void)
       }
       if( 0< portLowerCase.length() &&  0 != portLowerCase.compare("undefined")  && 0 != portLowerCase.compare("unknown") )
       {
-         result = MM::CanNotCommunicate;
-         // record the default answer time out
-         GetCoreCallback()->GetDeviceProperty(port_.c_str(), "AnswerTimeout", answerTO);
-
-         // device specific default communication parameters
-         // for SerialProtoWork Duemilanova
-         GetCoreCallback()->SetDeviceProperty(port_.c_str(), MM::g_Keyword_Handshaking, g_Off);
-         GetCoreCallback()->SetDeviceProperty(port_.c_str(), MM::g_Keyword_BaudRate, "57600" );
-         GetCoreCallback()->SetDeviceProperty(port_.c_str(), MM::g_Keyword_StopBits, "1");
-         // SerialProtoWork timed out in GetControllerVersion even if AnswerTimeout  = 300 ms
-         GetCoreCallback()->SetDeviceProperty(port_.c_str(), "AnswerTimeout", "500.0");
-         GetCoreCallback()->SetDeviceProperty(port_.c_str(), "DelayBetweenCharsMs", "0");
-         MM::Device* pS = GetCoreCallback()->GetDevice(this, port_.c_str());
-         pS->Initialize();
-         // The first second or so after opening the serial port, the SerialProtoWork is waiting for firmwareupgrades.  Simply sleep 2 seconds.
-         CDeviceUtils::SleepMs(2000);
-         MMThreadGuard myLock(lock_);
-         PurgeComPort(port_.c_str());
-         int v = 0;
-         int ret = GetControllerVersion(v);
          // later, Initialize will explicitly check the version #
-         if( DEVICE_OK != ret )
-         {
-            LogMessageCode(ret,true);
-         }
-         else
-         {
-            // to succeed must reach here....
-            result = MM::CanCommunicate;
-         }
-         pS->Shutdown();
-         // always restore the AnswerTimeout to the default
-         GetCoreCallback()->SetDeviceProperty(port_.c_str(), "AnswerTimeout", answerTO);
-
+         result = g_detector.Detect(*this, port_);
       }
    }
    catch(...)
@@ -233,25 +890,34 @@ int CSerialProtoWorkHub::Initialize()
    if (DEVICE_OK != ret)
       return ret;
 
-   // The first second or so after opening the serial port, the SerialProtoWork is waiting for firmwareupgrades.  Simply sleep 1 second.
-   CDeviceUtils::SleepMs(2000);
-
-   MMThreadGuard myLock(lock_);
-
-   // Check that we have a controller:
+   // Check that we have a controller. From here on only the I/O thread uses the port.
    PurgeComPort(port_.c_str());
-   ret = GetControllerVersion(version_);
-   if( DEVICE_OK != ret)
+   {
+      // the board may have been reset since the registers were written
+      MMThreadGuard myLock(registersLock_);
+      registers_.clear();
+   }
+   io_.Start(port_, commandWindow_);
+   ret = WaitForController(io_, version_, serialNumber_, g_readyTimeoutMs);
+   if (ret == DEVICE_OK && (version_ < g_Min_MMVersion || version_ > g_Max_MMVersion))
+      ret = ERR_VERSION_MISMATCH;
+   if (ret != DEVICE_OK)
+   {
+      io_.Stop();
       return ret;
-
-   if (version_ < g_Min_MMVersion || version_ > g_Max_MMVersion)
-      return ERR_VERSION_MISMATCH;
+   }
+   io_.SetBatching(version_ >= g_Min_BatchVersion);
 
    CPropertyAction* pAct = new CPropertyAction(this, &CSerialProtoWorkHub::OnVersion);
    std::ostringstream sversion;
    sversion << version_;
    CreateProperty(g_versionProp, sversion.str().c_str(), MM::Integer, true, pAct);
 
+   // identifies the board whichever port it enumerates on. 0 if the firmware does not report it.
+   std::ostringstream sserial;
+   sserial << serialNumber_;
+   CreateProperty(g_serialNumberProp, sserial.str().c_str(), MM::String, true);
+
    ret = UpdateStatus();
    if (ret != DEVICE_OK)
       return ret;
@@ -287,6 +953,7 @@ int CSerialProtoWorkHub::DetectInstalledDevices()
 
 int CSerialProtoWorkHub::Shutdown()
 {
+   io_.Stop();
    initialized_ = false;
    return DEVICE_OK;
 }
@@ -314,6 +981,32 @@ int CSerialProtoWorkHub::OnVersion(MM::PropertyBase* pProp, MM::ActionType pAct)
    return DEVICE_OK;
 }
 
+int CSerialProtoWorkHub::OnCommandWindow(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(commandWindow_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(commandWindow_);
+   }
+   return DEVICE_OK;
+}
+
+int CSerialProtoWorkHub::OnShadowMaxAge(MM::PropertyBase* pProp, MM::ActionType pAct)
+{
+   if (pAct == MM::BeforeGet)
+   {
+      pProp->Set(shadowMaxAgeMs_);
+   }
+   else if (pAct == MM::AfterSet)
+   {
+      pProp->Get(shadowMaxAgeMs_);
+   }
+   return DEVICE_OK;
+}
+
 int CSerialProtoWorkHub::OnLogic(MM::PropertyBase* pProp, MM::ActionType pAct)
 {
    if (pAct == MM::BeforeGet)
@@ -338,7 +1031,7 @@ int CSerialProtoWorkHub::OnLogic(MM::PropertyBase* pProp, MM::ActionType pAct)
 // CSerialProtoWorkShutter implementation
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-CSerialProtoWorkShutter::CSerialProtoWorkShutter() : initialized_(false), name_(g_DeviceNameSerialProtoWorkShutter)
+CSerialProtoWorkShutter::CSerialProtoWorkShutter() : asyncError_(DEVICE_OK), initialized_(false), name_(g_DeviceNameSerialProtoWorkShutter)
 {
    InitializeDefaultErrorMessages();
    EnableDelay();
@@ -369,7 +1062,21 @@ void CSerialProtoWorkShutter::GetName(char* name) const
 
 bool CSerialProtoWorkShutter::Busy()
 {
-   MM::MMTime interval = GetCurrentMMTime() - changedTime_;
+   // busy until the board has acknowledged every write
+   {
+      MMThreadGuard myLock(lock_);
+      int ret = CollectReplies(false);
+      if (ret != DEVICE_OK && asyncError_ == DEVICE_OK)
+         asyncError_ = ret;
+      if (!pending_.empty())
+         return true;
+   }
+
+   MM::MMTime now = GetCurrentMMTime();
+   if (now < fireEnd_)
+      return true;
+
+   MM::MMTime interval = now - changedTime_;
 
    if (interval < (1000.0 * GetDelayMs() ))
       return true;
@@ -421,6 +1128,8 @@ int CSerialProtoWorkShutter::Shutdown()
 {
    if (initialized_)
    {
+      MMThreadGuard myLock(lock_);
+      CollectReplies(true);
       initialized_ = false;
    }
    return DEVICE_OK;
@@ -450,48 +1159,175 @@ int CSerialProtoWorkShutter::GetOpen(bool& open)
    return DEVICE_OK;
 }
 
-int CSerialProtoWorkShutter::Fire(double /*deltaT*/)
-{
-   return DEVICE_UNSUPPORTED_COMMAND;
-}
-
-int CSerialProtoWorkShutter::WriteToPort(long value)
+// Open for deltaT ms, timed by the board. The open and closing patterns go
+// out as one sequence so host and USB latency do not add to the exposure.
+int CSerialProtoWorkShutter::Fire(double deltaT)
 {
    CSerialProtoWorkHub* hub = static_cast<CSerialProtoWorkHub*>(GetParentHub());
    if (!hub || !hub->IsPortAvailable())
       return ERR_NO_PORT_SET;
+   // the board NAKs a shorter step
+   double durationUs = deltaT * 1000.0;
+   if (!(durationUs >= sproto::SEQUENCE_MIN_STEP_US && durationUs < 4294967295.0))
+      return DEVICE_INVALID_INPUT_PARAM;
 
-   MMThreadGuard myLock(hub->GetLock());
+   MMThreadGuard myLock(lock_);
+
+   int ret = CollectReplies(false);
+   if (ret == DEVICE_OK)
+      ret = asyncError_;
+   asyncError_ = DEVICE_OK;
+   if (ret != DEVICE_OK)
+      return ret;
+
+   // open, then back to whatever the shutter showed before
+   unsigned char params[32];
+   CborEncoder enc, steps, step;
+   cbor_encoder_init(&enc, params, sizeof(params), 0);
+   cbor_encoder_create_array(&enc, &steps, 2);
+   cbor_encoder_create_array(&steps, &step, 2);
+   cbor_encode_uint(&step, OutputPattern(hub, 1));
+   cbor_encode_uint(&step, (uint32_t) durationUs);
+   cbor_encoder_close_container(&steps, &step);
+   cbor_encoder_create_array(&steps, &step, 2);
+   cbor_encode_uint(&step, OutputPattern(hub, hub->GetShutterState()));
+   cbor_encode_uint(&step, 0);
+   cbor_encoder_close_container(&steps, &step);
+   cbor_encoder_close_container(&enc, &steps);
+   pending_.push_back(hub->PostCommand(sproto::PROTO_SET, sproto::CMD_SEQUENCE, params, cbor_encoder_get_buffer_size(&enc, params)));
+
+   cbor_encoder_init(&enc, params, sizeof(params), 0);
+   cbor_encoder_create_array(&enc, &steps, 1);
+   cbor_encode_uint(&steps, 1);
+   cbor_encoder_close_container(&enc, &steps);
+   pending_.push_back(hub->PostCommand(sproto::PROTO_SET, sproto::CMD_SEQUENCE_RUN, params, cbor_encoder_get_buffer_size(&enc, params)));
+
+   hub->ForgetRegister(sproto::CMD_DIGITAL_OUT);
+   hub->SetTimedOutput(true);
+   hub->SetTriggerArmed(false);
+   fireEnd_ = GetCurrentMMTime() + MM::MMTime(durationUs);
+
+   if (!hub->IsPipelined())
+      return CollectReplies(true);
+   return DEVICE_OK;
+}
 
+// Pattern written to the outputs for a shutter state
+long CSerialProtoWorkShutter::OutputPattern(CSerialProtoWorkHub* hub, long value)
+{
    value = 63 & value;
    if (hub->IsLogicInverted())
-      value = ~value;
+      value = 63 & ~value;
+   return value;
+}
+
+int CSerialProtoWorkShutter::WriteToPort(long value)
+{
+   CSerialProtoWorkHub* hub = static_cast<CSerialProtoWorkHub*>(GetParentHub());
+   if (!hub || !hub->IsPortAvailable())
+      return ERR_NO_PORT_SET;
 
-   hub->PurgeComPortH();
+   MMThreadGuard myLock(lock_);
 
-   unsigned char command[2];
-   command[0] = 1;
-   command[1] = (unsigned char) value;
-   int ret = hub->WriteToComPortH((const unsigned char*) command, 2);
+   // report a failed earlier write before sending the next one
+   int ret = CollectReplies(false);
+   if (ret == DEVICE_OK)
+      ret = asyncError_;
+   asyncError_ = DEVICE_OK;
    if (ret != DEVICE_OK)
       return ret;
 
-   MM::MMTime startTime = GetCurrentMMTime();
-   unsigned long bytesRead = 0;
-   unsigned char answer[1];
-   while ((bytesRead < 1) && ( (GetCurrentMMTime() - startTime).getMsec() < 250)) {
-      ret = hub->ReadFromComPortH(answer, 1, bytesRead);
-      if (ret != DEVICE_OK)
-         return ret;
-   }
-   if (answer[0] != 1)
-      return ERR_COMMUNICATION;
+   value = OutputPattern(hub, value);
+
+   // nothing is sent if the outputs already show value
+   pending_.push_back(hub->WriteRegister(sproto::CMD_DIGITAL_OUT, (uint32_t) value));
 
    hub->SetTimedOutput(false);
+   hub->SetTriggerArmed(false);
 
+   // stop-and-wait unless the hub lets commands pipeline, then Busy() waits for the ACK
+   if (!hub->IsPipelined())
+      return CollectReplies(true);
    return DEVICE_OK;
 }
 
+// Send a SET once every earlier write has been acknowledged and wait for its
+// ACK. Expects the caller to hold lock_.
+int CSerialProtoWorkShutter::SetAndWait(CSerialProtoWorkHub* hub, uint32_t id, const unsigned char* params, size_t paramsSize)
+{
+   int ret = CollectReplies(true);
+   if (ret == DEVICE_OK)
+      ret = asyncError_;
+   asyncError_ = DEVICE_OK;
+   if (ret != DEVICE_OK)
+      return ret;
+   pending_.push_back(hub->PostCommand(sproto::PROTO_SET, id, params, paramsSize));
+   return CollectReplies(true);
+}
+
+// Upload the OnOff values of a property sequence as output patterns, all in
+// one frame
+int CSerialProtoWorkShutter::LoadTriggeredSequence(CSerialProtoWorkHub* hub, const std::vector<std::string>& sequence)
+{
+   if (!hub || !hub->IsPortAvailable())
+      return ERR_NO_PORT_SET;
+   if (sequence.size() > sproto::SEQUENCE_MAX_STEPS)
+      return DEVICE_SEQUENCE_TOO_LARGE;
+
+   std::vector<uint32_t> patterns(sequence.size());
+   for (size_t i = 0; i < sequence.size(); i++)
+      patterns[i] = OutputPattern(hub, atol(sequence[i].c_str()) > 0 ? 1 : 0);
+   std::vector<unsigned char> params(5 + 2 * sequence.size()); // array head, one byte per pattern
+   size_t paramsSize = sproto::encodeTriggered(params.data(), params.size(), patterns.data(), patterns.size());
+   if (paramsSize == 0)
+      return DEVICE_SEQUENCE_TOO_LARGE;
+
+   MMThreadGuard myLock(lock_);
+   return SetAndWait(hub, sproto::CMD_TRIGGERED, params.data(), paramsSize);
+}
+
+// Follow the trigger input through the loaded sequence, or stop following it
+int CSerialProtoWorkShutter::ArmTriggeredSequence(CSerialProtoWorkHub* hub, bool arm)
+{
+   if (!hub || !hub->IsPortAvailable())
+      return ERR_NO_PORT_SET;
+   unsigned char params[4];
+   CborEncoder enc, array;
+   cbor_encoder_init(&enc, params, sizeof(params), 0);
+   cbor_encoder_create_array(&enc, &array, 1);
+   cbor_encode_boolean(&array, arm);
+   cbor_encoder_close_container(&enc, &array);
+
+   MMThreadGuard myLock(lock_);
+   int ret = SetAndWait(hub, sproto::CMD_TRIGGER_ARM, params, cbor_encoder_get_buffer_size(&enc, params));
+   // the board steps the outputs on its own, or has stopped somewhere in the sequence
+   hub->ForgetRegister(sproto::CMD_DIGITAL_OUT);
+   hub->SetTriggerArmed(arm && ret == DEVICE_OK);
+   return ret;
+}
+
+// Collect replies to earlier writes in order. Stops at the first reply still
+// in flight unless wait is set. Returns the first failure. Expects the caller
+// to hold lock_.
+int CSerialProtoWorkShutter::CollectReplies(bool wait)
+{
+   int result = DEVICE_OK;
+   while (!pending_.empty())
+   {
+      if (!wait && pending_.front().wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+         break;
+      int ret = pending_.front().get().error;
+      pending_.pop_front();
+      if (ret != DEVICE_OK)
+      {
+         LogMessageCode(ret, false);
+         if (result == DEVICE_OK)
+            result = ret;
+      }
+   }
+   return result;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 // Action handlers
 ///////////////////////////////////////////////////////////////////////////////
@@ -518,6 +1354,22 @@ int CSerialProtoWorkShutter::OnOnOff(MM::PropertyBase* pProp, MM::ActionType eAc
       hub->SetShutterState(pos);
       changedTime_ = GetCurrentMMTime();
    }
+   else if (eAct == MM::IsSequenceable)
+   {
+      pProp->SetSequenceable(sproto::SEQUENCE_MAX_STEPS);
+   }
+   else if (eAct == MM::AfterLoadSequence)
+   {
+      return LoadTriggeredSequence(hub, pProp->GetSequence());
+   }
+   else if (eAct == MM::StartSequence)
+   {
+      return ArmTriggeredSequence(hub, true);
+   }
+   else if (eAct == MM::StopSequence)
+   {
+      return ArmTriggeredSequence(hub, false);
+   }
 
    return DEVICE_OK;
 }
@@ -19,8 +19,25 @@
 
 #include "MMDevice.h"
 #include "DeviceBase.h"
+// winerror.h defines NO_ERROR and ERROR_TIMEOUT, which collide with the sproto error codes
+#ifdef NO_ERROR
+#undef NO_ERROR
+#endif
+#ifdef ERROR_TIMEOUT
+#undef ERROR_TIMEOUT
+#endif
+#include "slippipeline.h"
 #include <string>
 #include <map>
+#include <set>
+#include <deque>
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
 //////////////////////////////////////////////////////////////////////////////
 // Error codes
@@ -34,11 +51,204 @@
 #define ERR_COMMUNICATION 107
 #define ERR_NO_PORT_SET 108
 #define ERR_VERSION_MISMATCH 109
+#define ERR_COMMAND_FAILED 110
 
-//class SerialProtoWorkInputMonitorThread;
+class CSerialProtoWorkHub;
+
+// SLIP protocol over the hub's serial port. ReadFromComPort never blocks,
+// so neither does readSlipFrame. Writes are collected until writeNow(), so
+// a batch of frames goes out in one WriteToComPort.
+class MMSlipProtocol : public sproto::SlipProtocolBase<MMSlipProtocol>
+{
+   typedef sproto::SlipProtocolBase<MMSlipProtocol> base_t;
+   friend base_t;
+
+public:
+   MMSlipProtocol(CSerialProtoWorkHub& hub) : base_t(true), hub_(hub), writeFailed_(false)
+   {
+      setFlushPolicy(sproto::FLUSH_NONE);
+   }
+
+   void SetPort(const std::string& port) {port_ = port;}
+
+   // true if a write failed since the last call
+   bool WriteFailed() {bool failed = writeFailed_; writeFailed_ = false; return failed;}
+
+protected:
+   size_t writeBytes_impl(const uint8_t* buffer, size_t size);
+   size_t readBytes_impl(uint8_t* buffer, size_t size);
+   void writeNow_impl();
+   void clearInput_impl();
+   bool isStreamReady_impl();
+
+   CSerialProtoWorkHub& hub_;
+   std::string port_;
+   std::vector<unsigned char> txbuffer_;
+   bool writeFailed_;
+};
+
+// replies as large as the firmware's, which holds the status of every command in a batch,
+// and room to send the largest batch frame again
+typedef sproto::CommandPipeline<MMSlipProtocol, 8, 512,
+   MMSlipProtocol::framing_t::maxFrameSize(1024 + 3)> MMCommandPipeline;
+
+// Outcome of a command sent through the hub
+struct SerialProtoWorkReply
+{
+   int error;                       // DEVICE_OK or the reason the command failed
+   std::vector<unsigned char> data; // CBOR reply payload after the ACK
+};
+
+struct SerialProtoWorkRequest
+{
+   SerialProtoWorkRequest* next;    // submit queue link
+   uint8_t type;
+   uint32_t id;
+   std::vector<unsigned char> params;
+   uint8_t seq;
+   double timeoutMs;
+   std::chrono::steady_clock::time_point deadline;
+   bool coalesce;                   // may replace an unsent SET of the same id
+   SerialProtoWorkRequest* merged;  // requests it replaced, completed with it
+   SerialProtoWorkRequest* batched; // next request sent in the same batch frame
+   bool resent;                     // sent again once its deadline passed
+   std::function<void(const SerialProtoWorkReply&)> done; // called on completion, before the future is set
+   std::promise<SerialProtoWorkReply> reply;
+};
+
+// Lock-free queue from any number of device threads to the I/O thread.
+// Producers push onto an intrusive stack, the I/O thread takes the whole
+// stack at once and reverses it.
+class SerialProtoWorkSubmitQueue
+{
+public:
+   SerialProtoWorkSubmitQueue() : head_(0) {}
+
+   void Push(SerialProtoWorkRequest* req)
+   {
+      req->next = head_.load(std::memory_order_relaxed);
+      while (!head_.compare_exchange_weak(req->next, req))
+         ;
+   }
+
+   // every queued request, oldest first, linked through next
+   SerialProtoWorkRequest* TakeAll()
+   {
+      SerialProtoWorkRequest* req = head_.exchange(0, std::memory_order_acquire);
+      SerialProtoWorkRequest* oldest = 0;
+      while (req)
+      {
+         SerialProtoWorkRequest* next = req->next;
+         req->next = oldest;
+         oldest = req;
+         req = next;
+      }
+      return oldest;
+   }
+
+   bool Empty() const {return head_.load() == 0;}
+
+private:
+   std::atomic<SerialProtoWorkRequest*> head_;
+};
+
+// Owns the serial port while running. Device threads post commands and wait
+// on the returned future; this thread sends them in batches as the command
+// window allows, demultiplexes replies by sequence number and times out
+// commands that are not answered. If the board takes batch frames, commands
+// queued back to back share a frame and its ACK.
+class SerialProtoWorkIOThread : public MMDeviceThreadBase
+{
+public:
+   SerialProtoWorkIOThread(CSerialProtoWorkHub& hub);
+   ~SerialProtoWorkIOThread();
+
+   int svc();
+   void Start(const std::string& port, long window);
+   void Stop();
+   bool IsRunning() {return running_;}
+   // the board takes batch frames. Off after Start.
+   void SetBatching(bool batching) {batching_ = batching;}
+
+   static SerialProtoWorkRequest* NewRequest(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize, double timeoutMs);
+   std::future<SerialProtoWorkReply> Post(SerialProtoWorkRequest* req);
+   std::future<SerialProtoWorkReply> Post(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize, double timeoutMs)
+   {
+      return Post(NewRequest(type, id, params, paramsSize, timeoutMs));
+   }
+
+private:
+   static void Complete(SerialProtoWorkRequest* req, const SerialProtoWorkReply& reply);
+   static void Complete(SerialProtoWorkRequest* req, int error);
+   static void Enqueue(std::deque<SerialProtoWorkRequest*>& backlog, SerialProtoWorkRequest* req);
+   static void Fail(SerialProtoWorkRequest* req, int error);
+   static void CompleteBatch(SerialProtoWorkRequest* req, sproto::error_t err, const uint8_t* data, size_t size);
+   static bool IsBatchable(const SerialProtoWorkRequest* req);
+   static int ReplyToError(sproto::error_t err);
+   void FailAll(std::deque<SerialProtoWorkRequest*>& requests, int error);
+   sproto::error_t Submit(SerialProtoWorkRequest* req);
+   sproto::error_t SubmitBatch(SerialProtoWorkRequest* req, std::deque<SerialProtoWorkRequest*>& backlog);
+
+   MMSlipProtocol proto_;
+   unsigned char rxbuffer_[1024];
+   unsigned char batchBuffer_[1024]; // commands of the batch frame being sent
+   MMCommandPipeline pipeline_;
+   SerialProtoWorkSubmitQueue queue_;
+   std::atomic<bool> running_;
+   std::atomic<bool> stop_;
+   std::atomic<bool> sleeping_;
+   std::atomic<bool> batching_;
+   std::mutex wakeMutex_;
+   std::condition_variable wake_;
+};
+
+// Results of probing serial ports, shared by every hub in the process. Only
+// the port the core asks about is probed. The core may ask about several
+// ports at once; those probes run side by side, and a question repeated
+// within g_detectValidMs is answered from here. Boards are remembered by the
+// USB serial number they report in the `q` reply, with the port and firmware
+// version they were last found with, in a file that outlives the process. A
+// port a board was last found on is confirmed with short probes first.
+class SerialProtoWorkDetector
+{
+public:
+   SerialProtoWorkDetector() : loaded_(false) {}
+
+   MM::DeviceDetectionStatus Detect(CSerialProtoWorkHub& hub, const std::string& port);
+
+private:
+   struct PortResult
+   {
+      int error;       // DEVICE_OK if a board answered
+      int version;
+      uint32_t serial; // USB serial number, 0 if the firmware does not report one
+      std::chrono::steady_clock::time_point time;
+   };
+
+   struct BoardRecord
+   {
+      std::string port; // port the board was last found on
+      int version;
+   };
+
+   bool IsFresh(const std::string& port, std::chrono::steady_clock::time_point now);
+   bool IsKnownPort(const std::string& port);
+   void Record(CSerialProtoWorkHub& hub, const std::string& port, const PortResult& result);
+   void Load();
+   void Save();
+
+   std::mutex mutex_;
+   std::condition_variable probed_;         // a probe finished
+   std::set<std::string> probing_;          // one probe of a port at a time
+   std::map<std::string, PortResult> ports_;
+   bool loaded_;                            // boards_ read from the cache file
+   std::map<uint32_t, BoardRecord> boards_; // by USB serial number
+};
 
 class CSerialProtoWorkHub : public HubBase<CSerialProtoWorkHub>  
 {
+   friend class SerialProtoWorkDetector;
+
 public:
    CSerialProtoWorkHub();
    ~CSerialProtoWorkHub();
@@ -56,33 +266,65 @@ public:
    int OnPort(MM::PropertyBase* pPropt, MM::ActionType eAct);
    int OnLogic(MM::PropertyBase* pPropt, MM::ActionType eAct);
    int OnVersion(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnCommandWindow(MM::PropertyBase* pPropt, MM::ActionType eAct);
+   int OnShadowMaxAge(MM::PropertyBase* pPropt, MM::ActionType eAct);
 
    // custom interface for child devices
    bool IsPortAvailable() {return portAvailable_;}
    bool IsLogicInverted() {return invertedLogic_;}
    bool IsTimedOutputActive() {return timedOutputActive_;}
    void SetTimedOutput(bool active) {timedOutputActive_ = active;}
+   bool IsTriggerArmed() {return triggerArmed_;}
+   void SetTriggerArmed(bool armed) {triggerArmed_ = armed;}
 
-   int PurgeComPortH() {return PurgeComPort(port_.c_str());}
-   int WriteToComPortH(const unsigned char* command, unsigned len) {return WriteToComPort(port_.c_str(), command, len);}
-   int ReadFromComPortH(unsigned char* answer, unsigned maxLen, unsigned long& bytesRead)
+   int PurgeComPortH(const char* port) {return PurgeComPort(port);}
+   int WriteToComPortH(const char* port, const unsigned char* command, unsigned len) {return WriteToComPort(port, command, len);}
+   int ReadFromComPortH(const char* port, unsigned char* answer, unsigned maxLen, unsigned long& bytesRead)
    {
-      return ReadFromComPort(port_.c_str(), answer, maxLen, bytesRead);
+      return ReadFromComPort(port, answer, maxLen, bytesRead);
    }
-   static MMThreadLock& GetLock() {return lock_;}
+
+   // commands, safe to call from any thread. The future is always completed,
+   // with ERR_COMMUNICATION if the board does not answer in time.
+   std::future<SerialProtoWorkReply> PostCommand(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize);
+   int SendCommand(uint8_t type, uint32_t id, const unsigned char* params, size_t paramsSize, std::vector<unsigned char>* reply = 0);
+   bool IsPipelined() {return commandWindow_ > 1;}
+
+   // shadow copies of board registers, the single parameter of a SET command.
+   // They only let a write of the value already there be skipped.
+   std::future<SerialProtoWorkReply> WriteRegister(uint32_t id, uint32_t value);
+   void ForgetRegister(uint32_t id);
+
    void SetShutterState(unsigned state) {shutterState_ = state;}
    unsigned GetShutterState() {return shutterState_;}
 
 private:
-   int GetControllerVersion(int&);
+   int GetControllerVersion(SerialProtoWorkIOThread& io, int& version, uint32_t& serial, double timeoutMs);
+   int WaitForController(SerialProtoWorkIOThread& io, int& version, uint32_t& serial, double readyTimeoutMs);
+   int ProbePort(const std::string& port, int& version, uint32_t& serial, double readyTimeoutMs);
+
+   struct ShadowRegister
+   {
+      bool valid;
+      uint32_t value;
+      std::chrono::steady_clock::time_point time; // last written or read
+   };
+   bool IsFresh(const ShadowRegister& reg);
+   void InvalidateRegister(uint32_t id, uint32_t value);
    std::string port_;
    bool initialized_;
    bool portAvailable_;
    bool invertedLogic_;
    bool timedOutputActive_;
+   bool triggerArmed_;
    int version_;
-   static MMThreadLock lock_;
+   uint32_t serialNumber_;
    unsigned shutterState_;
+   long commandWindow_;
+   double shadowMaxAgeMs_;
+   MMThreadLock registersLock_;
+   std::map<uint32_t, ShadowRegister> registers_;
+   SerialProtoWorkIOThread io_;
 };
 
 class CSerialProtoWorkShutter : public CShutterBase<CSerialProtoWorkShutter>  
@@ -110,7 +352,16 @@ public:
 
 private:
    int WriteToPort(long lnValue);
+   long OutputPattern(CSerialProtoWorkHub* hub, long value);
+   int SetAndWait(CSerialProtoWorkHub* hub, uint32_t id, const unsigned char* params, size_t paramsSize);
+   int LoadTriggeredSequence(CSerialProtoWorkHub* hub, const std::vector<std::string>& sequence);
+   int ArmTriggeredSequence(CSerialProtoWorkHub* hub, bool arm);
+   int CollectReplies(bool wait);
+   MMThreadLock lock_;       // guards pending_ and asyncError_
+   std::deque<std::future<SerialProtoWorkReply> > pending_; // replies not yet collected
+   int asyncError_;          // failure of a command collected by Busy()
    MM::MMTime changedTime_;
+   MM::MMTime fireEnd_;      // a Fire() sequence plays until then
    bool initialized_;
    std::string name_;
 };